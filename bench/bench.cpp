@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "../src/common.h"
+#include "../src/compute/compute.h"
+#include "../src/render/render.h"
+
+using namespace sunstorm;
+
+struct BenchResult
+{
+  unsigned int width;
+  unsigned int height;
+  size_t local[2];
+  unsigned int spheres;
+  double mean;
+  double variance;
+  double min;
+  double max;
+  double mraysPerSecond;
+};
+
+/**
+ * Times repeated runs of one configuration, each sample is the mean frame
+ * time of a run so that timer resolution does not dominate small frames.
+ */
+BenchResult measure(rt::OffscreenRayTracer& tracer, const size_t* local, unsigned int frames, unsigned int warmup, unsigned int repeats)
+{
+  // the kernel discards the work items padding the global size
+  unsigned int w = tracer.getWidth(), h = tracer.getHeight();
+  size_t image[] = { w, h };
+  cmp::LaunchSize size = cmp::Autotuner::fit(image, local);
+
+  for (unsigned int i = 0; i < warmup; i++) {
+    tracer.execute(size.getLocal(), size.global);
+  }
+
+  std::vector<double> samples;
+  for (unsigned int r = 0; r < repeats; r++) {
+    long long t0 = time::getTimeMicroseconds();
+    for (unsigned int i = 0; i < frames; i++) {
+      tracer.execute(size.getLocal(), size.global);
+    }
+    samples.push_back((time::getTimeMicroseconds() - t0) / 1000.0 / frames);
+  }
+
+  BenchResult result = {};
+  result.width = w;
+  result.height = h;
+  result.local[0] = local ? local[0] : 0;
+  result.local[1] = local ? local[1] : 0;
+  result.min = *std::min_element(samples.begin(), samples.end());
+  result.max = *std::max_element(samples.begin(), samples.end());
+
+  for (double s : samples) {
+    result.mean += s / samples.size();
+  }
+  for (double s : samples) {
+    result.variance += (s - result.mean) * (s - result.mean) / std::max<size_t>(1, samples.size() - 1);
+  }
+
+  result.mraysPerSecond = tracer.getRaysPerFrame() / (result.mean / 1000.0) / 1e6;
+  return result;
+}
+
+std::string escape(const std::string& value)
+{
+  std::string out;
+  for (char c : value) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+/**
+ * Benchmark entry point - bench [output.json] [frames] [repeats]
+ */
+int main(int argc, char const *argv[])
+{
+  std::string output = argc > 1 ? argv[1] : "bench.json";
+  unsigned int frames  = argc > 2 ? std::stoi(argv[2]) : 20;
+  unsigned int repeats = argc > 3 ? std::stoi(argv[3]) : 5;
+  unsigned int warmup = 3;
+
+  const unsigned int resolutions[][2] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+  const size_t localSizes[][2] = { { 0, 0 }, { 8, 8 }, { 16, 8 }, { 16, 16 }, { 32, 8 } };
+  const unsigned int sphereCounts[] = { 0, 16, 64, 256 };
+
+  try {
+    cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+    cl_command_queue queue = handler.createQueue(0);
+    cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+    cmp::ComputeKernel* kernel = program->createKernel("trace");
+
+    size_t maxWorkGroup = 0;
+    cmp::ComputeHandler::handleError(clGetKernelWorkGroupInfo(kernel->getKernel(), handler.getDevice(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroup, NULL));
+
+    std::vector<BenchResult> results;
+    for (unsigned int spheres : sphereCounts) {
+      rt::Scene scene = rt::Scene();
+      rt::Scene::createSphereField(scene, spheres);
+      scene.bind(kernel, 3);
+      scene.upload(queue);
+
+      for (const unsigned int* resolution : resolutions) {
+        rt::OffscreenRayTracer tracer = rt::OffscreenRayTracer(kernel, resolution[0], resolution[1]);
+
+        for (const size_t* local : localSizes) {
+          if (local[0] * local[1] > maxWorkGroup) {
+            continue;
+          }
+
+          BenchResult result = measure(tracer, local[0] ? local : nullptr, frames, warmup, repeats);
+          result.spheres = (unsigned int) scene.getSphereGeometry().size();
+          results.push_back(result);
+
+          std::cout << std::setw(4) << result.width << "x" << std::setw(4) << result.height 
+                    << " local " << std::setw(2) << result.local[0] << "x" << std::setw(2) << result.local[1]
+                    << " spheres " << std::setw(3) << result.spheres << ": " << std::fixed << std::setprecision(3)
+                    << result.mean << " ms/frame (sd " << std::sqrt(result.variance) << "), "
+                    << result.mraysPerSecond << " Mrays/s" << std::endl;
+        }
+      }
+    }
+
+    // the device strings identify the machine and driver so runs can be compared across builds
+    std::ofstream file(output);
+    file << std::fixed << std::setprecision(4);
+    file << "{" << std::endl;
+    file << "  \"device\": \"" << escape(cmp::getDeviceString(handler.getDevice(), CL_DEVICE_NAME)) << "\"," << std::endl;
+    file << "  \"version\": \"" << escape(cmp::getDeviceString(handler.getDevice(), CL_DEVICE_VERSION)) << "\"," << std::endl;
+    file << "  \"driver\": \"" << escape(cmp::getDeviceString(handler.getDevice(), CL_DRIVER_VERSION)) << "\"," << std::endl;
+    file << "  \"frames\": " << frames << ", \"repeats\": " << repeats << ", \"warmup\": " << warmup << "," << std::endl;
+    file << "  \"results\": [";
+
+    for (size_t i = 0; i < results.size(); i++) {
+      const BenchResult& r = results[i];
+      file << (i ? "," : "") << std::endl << "    { \"width\": " << r.width << ", \"height\": " << r.height
+           << ", \"local\": " << (r.local[0] ? "[" + std::to_string(r.local[0]) + ", " + std::to_string(r.local[1]) + "]" : std::string("null"))
+           << ", \"spheres\": " << r.spheres << ", \"ms_per_frame\": " << r.mean << ", \"ms_variance\": " << r.variance
+           << ", \"ms_min\": " << r.min << ", \"ms_max\": " << r.max << ", \"mrays_per_second\": " << r.mraysPerSecond << " }";
+    }
+    file << std::endl << "  ]" << std::endl << "}" << std::endl;
+
+    if (!file) {
+      std::cerr << "[Error] Failed to write results: " << output << "!" << std::endl;
+      return 1;
+    }
+    SSRT_DBG_OUTPUT("Wrote results to: " << output);
+  }
+  catch(const std::exception& e) {
+    std::cerr << "[Error] " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
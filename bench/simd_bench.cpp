@@ -0,0 +1,204 @@
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include "../src/common.h"
+#include "../src/simd/simd.h"
+#include "../src/utils/utils.h"
+
+using namespace sunstorm;
+
+struct SIMDResult
+{
+  std::string isa;
+  std::string primitive;
+  unsigned int width;
+  size_t primitives;
+  double mean;
+  double mtestsPerSecond;
+  double speedup;
+  size_t mismatches;
+};
+
+/**
+ * Ray directions and the hit buffers the kernels write, reset before each run.
+ */
+struct RayBuffers
+{
+  std::vector<float> ox, oy, oz, dx, dy, dz, dist;
+  std::vector<int> primitive;
+
+  RayBuffers(size_t count, std::mt19937& rng)
+  {
+    std::uniform_real_distribution<float> spread(-0.6f, 0.6f);
+    for (size_t i = 0; i < count; i++) {
+      float x = spread(rng), y = spread(rng), z = -1.0f;
+      float length = std::sqrt(x * x + y * y + z * z);
+
+      // same eye as createCameraRay so the rays see the generated scene
+      ox.push_back(0.0f);
+      oy.push_back(0.0f);
+      oz.push_back(1.0f);
+      dx.push_back(x / length);
+      dy.push_back(y / length);
+      dz.push_back(z / length);
+    }
+    dist.resize(count);
+    primitive.resize(count);
+  }
+
+  simd::RayStream reset()
+  {
+    std::fill(dist.begin(), dist.end(), std::numeric_limits<float>::infinity());
+    std::fill(primitive.begin(), primitive.end(), -1);
+    return { ox.data(), oy.data(), oz.data(), dx.data(), dy.data(), dz.data(), dist.data(), primitive.data(), dist.size() };
+  }
+};
+
+/**
+ * Times repeated runs of one primitive set, each sample is the mean of a run
+ * so that timer resolution does not dominate small sets.
+ */
+template <typename Primitives>
+double measure(const simd::Intersector& intersector, RayBuffers& rays, const Primitives& primitives, unsigned int runs, unsigned int repeats)
+{
+  // warm up caches and the clock before timing
+  intersector.intersect(rays.reset(), primitives);
+
+  double best = std::numeric_limits<double>::max();
+  for (unsigned int r = 0; r < repeats; r++) {
+    long long t0 = time::getTimeMicroseconds();
+    for (unsigned int i = 0; i < runs; i++) {
+      intersector.intersect(rays.reset(), primitives);
+    }
+    best = std::min(best, (time::getTimeMicroseconds() - t0) / 1000.0 / runs);
+  }
+
+  // leaves the hits of one clean run for comparison against the scalar kernels
+  intersector.intersect(rays.reset(), primitives);
+  return best;
+}
+
+template <typename Primitives>
+void benchPrimitive(const std::string& name, const Primitives& primitives, RayBuffers& rays, unsigned int runs, unsigned int repeats, std::vector<SIMDResult>& results)
+{
+  double scalarTime = 0.0;
+  std::vector<int> reference;
+
+  for (int level = 0; level <= (int) simd::ISA::AVX512; level++) {
+    simd::ISA isa = (simd::ISA) level;
+    if (!simd::isSupported(isa)) {
+      continue;
+    }
+
+    simd::Intersector intersector = simd::Intersector(isa);
+    double ms = measure(intersector, rays, primitives, runs, repeats);
+
+    // differently fused arithmetic can move a grazing hit, so a few disagreements are expected
+    size_t mismatches = 0;
+    if (isa == simd::ISA::Scalar) {
+      scalarTime = ms;
+      reference = rays.primitive;
+    } else {
+      for (size_t i = 0; i < reference.size(); i++) {
+        mismatches += reference[i] != rays.primitive[i];
+      }
+    }
+
+    SIMDResult result = {};
+    result.isa = simd::getISAName(isa);
+    result.primitive = name;
+    result.width = intersector.getWidth();
+    result.primitives = primitives.size();
+    result.mean = ms;
+    result.mtestsPerSecond = (double) rays.dist.size() * primitives.size() / (ms / 1000.0) / 1e6;
+    result.speedup = scalarTime / ms;
+    result.mismatches = mismatches;
+    results.push_back(result);
+
+    std::cout << std::setw(9) << result.primitive << " x" << std::setw(4) << result.primitives << " " << std::setw(7) << result.isa
+              << " (" << std::setw(2) << result.width << " wide): " << std::fixed << std::setprecision(3) << result.mean << " ms, "
+              << std::setprecision(1) << result.mtestsPerSecond << " Mtests/s, " << std::setprecision(2) << result.speedup << "x scalar, "
+              << result.mismatches << " mismatches" << std::endl;
+  }
+}
+
+/**
+ * Microbenchmark entry point - bench_simd [output.json] [rays] [runs] [repeats]
+ */
+int main(int argc, char const *argv[])
+{
+  std::string output   = argc > 1 ? argv[1] : "bench_simd.json";
+  size_t rayCount      = argc > 2 ? std::stoul(argv[2]) : 65536;
+  unsigned int runs    = argc > 3 ? std::stoi(argv[3]) : 10;
+  unsigned int repeats = argc > 4 ? std::stoi(argv[4]) : 5;
+
+  const size_t primitiveCounts[] = { 16, 64, 256 };
+
+  // a fixed seed keeps the scenes identical between runs and builds
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+  std::uniform_real_distribution<float> depth(-12.0f, -2.0f);
+  std::uniform_real_distribution<float> size(0.1f, 0.6f);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  RayBuffers rays = RayBuffers(rayCount, rng);
+  std::vector<SIMDResult> results;
+  std::cout << "Detected instruction set: " << simd::getISAName(simd::detectISA()) << std::endl;
+
+  for (size_t count : primitiveCounts) {
+    simd::Spheres spheres;
+    simd::Planes planes;
+    simd::Triangles triangles;
+    simd::Boxes boxes;
+
+    for (size_t i = 0; i < count; i++) {
+      float center[] = { position(rng), position(rng), depth(rng) };
+      float extent = size(rng);
+      spheres.add(center[0], center[1], center[2], extent);
+
+      float nx = unit(rng), ny = unit(rng), nz = unit(rng);
+      float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+      planes.add(nx / length, ny / length, nz / length, depth(rng));
+
+      float v0[] = { center[0] - extent, center[1] - extent, center[2] };
+      float v1[] = { center[0] + extent, center[1] - extent, center[2] + unit(rng) * extent };
+      float v2[] = { center[0], center[1] + extent, center[2] };
+      triangles.add(v0, v1, v2);
+
+      float min[] = { center[0] - extent, center[1] - extent, center[2] - extent };
+      float max[] = { center[0] + extent, center[1] + extent, center[2] + extent };
+      boxes.add(min, max);
+    }
+
+    benchPrimitive("sphere", spheres, rays, runs, repeats, results);
+    benchPrimitive("plane", planes, rays, runs, repeats, results);
+    benchPrimitive("triangle", triangles, rays, runs, repeats, results);
+    benchPrimitive("box", boxes, rays, runs, repeats, results);
+  }
+
+  std::ofstream file(output);
+  file << std::fixed << std::setprecision(4);
+  file << "{" << std::endl;
+  file << "  \"detected\": \"" << simd::getISAName(simd::detectISA()) << "\"," << std::endl;
+  file << "  \"rays\": " << rayCount << ", \"runs\": " << runs << ", \"repeats\": " << repeats << "," << std::endl;
+  file << "  \"results\": [";
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const SIMDResult& r = results[i];
+    file << (i ? "," : "") << std::endl << "    { \"isa\": \"" << r.isa << "\", \"width\": " << r.width << ", \"primitive\": \"" << r.primitive
+         << "\", \"count\": " << r.primitives << ", \"ms\": " << r.mean << ", \"mtests_per_second\": " << r.mtestsPerSecond
+         << ", \"speedup\": " << r.speedup << ", \"mismatches\": " << r.mismatches << " }";
+  }
+  file << std::endl << "  ]" << std::endl << "}" << std::endl;
+
+  if (!file) {
+    std::cerr << "[Error] Failed to write results: " << output << "!" << std::endl;
+    return 1;
+  }
+  SSRT_DBG_OUTPUT("Wrote results to: " << output);
+  return 0;
+}
@@ -0,0 +1,60 @@
+
+// element of the indirect draw buffer, matches DrawElementsIndirectCommand in OpenGL
+#define COMMAND_INSTANCE_COUNT 1
+
+/**
+ * Tests each instance's world space bounds against the frustum planes and
+ * appends the transforms of the visible ones to the instance buffer the
+ * indirect draw reads. The instance count of the draw command doubles as the
+ * append counter, reset to zero by the host before each launch.
+ */
+__kernel void cullInstances(
+    __global const float16* transforms,
+    __global const float4* bounds,
+    __constant float4* planes,
+    unsigned int instanceCount,
+    __global float16* visibleTransforms,
+    __global unsigned int* command
+  )
+{
+  __local unsigned int groupCount;
+  __local unsigned int groupBase;
+
+  unsigned int i = get_global_id(0);
+  unsigned int lid = get_local_id(0);
+
+  if (lid == 0) {
+    groupCount = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // no early return, every work-item must reach the barriers
+  bool visible = i < instanceCount;
+  if (visible) {
+    float3 bmin = bounds[i * 2].xyz;
+    float3 bmax = bounds[i * 2 + 1].xyz;
+    float3 center = (bmin + bmax) * 0.5f;
+    float3 extent = (bmax - bmin) * 0.5f;
+
+    for (int p = 0; p < 6 && visible; p++) {
+      float4 plane = planes[p];
+      visible = dot(plane.xyz, center) + plane.w + dot(fabs(plane.xyz), extent) >= 0.0f;
+    }
+  }
+
+  unsigned int slot = 0;
+  if (visible) {
+    slot = atomic_inc(&groupCount);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // one global atomic per group keeps contention on the command low
+  if (lid == 0) {
+    groupBase = groupCount ? atomic_add(&command[COMMAND_INSTANCE_COUNT], groupCount) : 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if (visible) {
+    visibleTransforms[groupBase + slot] = transforms[i];
+  }
+}
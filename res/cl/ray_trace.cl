@@ -2,6 +2,8 @@
 /* Structs and Constants */
 __constant float PI         = 3.14159265359f;
 __constant float EPSILON    = 0.00001f;
+__constant float AMBIENT    = 0.05f;
+__constant float SHADOW_BIAS = 0.0001f;
 
 typedef struct Ray {
   float3 pos;
@@ -35,7 +37,8 @@ Ray createCameraRay(float2 coord, float2 dim)
   float wx = (ux - 0.5f) * aspect;
   float wy = (uy - 0.5f);
 
-  float3 px = (float3)(wx, -wy, 0.0f);
+  // rows are bottom-up to match OpenGL textures
+  float3 px = (float3)(wx, wy, 0.0f);
 
   Ray r;
   r.pos = (float3)(0.0f, 0.0f, 1.0f);
@@ -83,8 +86,9 @@ RayHit rayPlaneIntersect(Ray* ray, Plane* plane)
   hit.pos = (float3)(0.0f, 0.0f, 0.0f);
   hit.normal = (float3)(0.0f, 0.0f, 0.0f);
 
+  // points on the plane satisfy dot(normal, p) + d = 0
   if (b != 0.0f) {
-    hit.dist = a / b;
+    hit.dist = -a / b;
     hit.pos = hit.dist * ray->dir + ray->pos;
     hit.normal = plane->normal;
   }
@@ -92,12 +96,145 @@ RayHit rayPlaneIntersect(Ray* ray, Plane* plane)
   return hit;
 }
 
+/* Scene buffers, one array per primitive attribute. */
+
+typedef struct Scene {
+  __global const float4* sphereGeometry;    // center xyz, radius w
+  __global const int*    sphereMaterials;
+  unsigned int           sphereCount;
+  __global const float4* planeGeometry;     // normal xyz, offset w
+  __global const int*    planeMaterials;
+  unsigned int           planeCount;
+  __global const float4* lightPositions;
+  __global const float4* lightColours;
+  unsigned int           lightCount;
+  __global const float4* materialColours;
+} Scene;
+
+RayHit sceneIntersect(Ray* ray, Scene* scene, int* material)
+{
+  RayHit closest;
+  closest.dist = 0.0f;
+  *material = -1;
+
+  for (unsigned int i = 0; i < scene->sphereCount; i++) {
+    float4 g = scene->sphereGeometry[i];
+    Sphere sphere;
+    sphere.center = g.xyz;
+    sphere.radius = g.w;
+
+    RayHit hit = raySphereIntersect(ray, &sphere);
+    if (hit.dist > 0.0f && (closest.dist <= 0.0f || hit.dist < closest.dist)) {
+      closest = hit;
+      *material = scene->sphereMaterials[i];
+    }
+  }
+
+  for (unsigned int i = 0; i < scene->planeCount; i++) {
+    float4 g = scene->planeGeometry[i];
+    Plane plane;
+    plane.normal = g.xyz;
+    plane.d = g.w;
+
+    RayHit hit = rayPlaneIntersect(ray, &plane);
+    if (hit.dist > 0.0f && (closest.dist <= 0.0f || hit.dist < closest.dist)) {
+      closest = hit;
+      *material = scene->planeMaterials[i];
+    }
+  }
+
+  return closest;
+}
+
+bool sceneOccluded(Ray* ray, Scene* scene, float maxDist)
+{
+  for (unsigned int i = 0; i < scene->sphereCount; i++) {
+    float4 g = scene->sphereGeometry[i];
+    Sphere sphere;
+    sphere.center = g.xyz;
+    sphere.radius = g.w;
+
+    RayHit hit = raySphereIntersect(ray, &sphere);
+    if (hit.dist > 0.0f && hit.dist < maxDist) {
+      return true;
+    }
+  }
+
+  for (unsigned int i = 0; i < scene->planeCount; i++) {
+    float4 g = scene->planeGeometry[i];
+    Plane plane;
+    plane.normal = g.xyz;
+    plane.d = g.w;
+
+    RayHit hit = rayPlaneIntersect(ray, &plane);
+    if (hit.dist > EPSILON && hit.dist < maxDist) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+float4 shadeHit(Ray* ray, RayHit* hit, int material, Scene* scene)
+{
+  // planes are two sided so face the normal towards the viewer
+  float3 normal = dot(hit->normal, ray->dir) > 0.0f ? -hit->normal : hit->normal;
+  float3 albedo = scene->materialColours[material].xyz;
+  float3 colour = albedo * AMBIENT;
+
+  for (unsigned int i = 0; i < scene->lightCount; i++) {
+    float3 toLight = scene->lightPositions[i].xyz - hit->pos;
+    float dist = length(toLight);
+    float3 dir = toLight / dist;
+
+    float lambert = dot(normal, dir);
+    if (lambert <= 0.0f) {
+      continue;
+    }
+
+    Ray shadow;
+    shadow.pos = hit->pos + normal * SHADOW_BIAS;
+    shadow.dir = dir;
+
+    if (!sceneOccluded(&shadow, scene, dist)) {
+      colour += albedo * scene->lightColours[i].xyz * lambert;
+    }
+  }
+
+  return (float4)(colour, 1.0f);
+}
+
+float4 tracePixel(int x, int y, unsigned int width, unsigned int height, Scene* scene)
+{
+  Ray ray = createCameraRay((float2)(x, y), (float2)(width, height));
+
+  int material;
+  RayHit hit = sceneIntersect(&ray, scene, &material);
+
+  float4 color = (float4)(0.0f, 0.0f, 0.0f, 1.0f);
+  if (material >= 0) {
+    color = shadeHit(&ray, &hit, material, scene);
+  }
+
+  return color;
+}
+
 /* Kernel method draws full image.  */
 
 __kernel void trace (
     __write_only image2d_t img,
     unsigned int width,
-    unsigned int height
+    unsigned int height,
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours
   )
 {
   int x = get_global_id(0);
@@ -105,43 +242,781 @@ __kernel void trace (
 
   if (x < width && y < height) 
   {
-    // Scene
-    Ray ray = createCameraRay((float2)(x, y), (float2)(width, height));
-    
-    Sphere sphere;
-    sphere.radius = 1.0f;
-    sphere.center = (float3)(0.0f, 0.0f, -3.0f);
+    Scene scene = { 
+      sphereGeometry, sphereMaterials, sphereCount, 
+      planeGeometry, planeMaterials, planeCount, 
+      lightPositions, lightColours, lightCount, 
+      materialColours 
+    };
 
-    Plane plane;
-    plane.normal = normalize((float3)(0.0f, 1.0f, 0.0f));
-    plane.d = 2.f;
-
-    // intersection
-    RayHit hit = raySphereIntersect(&ray, &sphere);
-    RayHit hit0 = rayPlaneIntersect(&ray, &plane);
-
-    float3 lightPos = (float3)(-500.0f, 1000.0f, -700.0f);
-    // float3 lightPos = (float3)(0.0f, 2.0f, 1.0f);
-
-    float4 color = (float4)(0.0f, 0.0f, 0.0f, 1.0f);
-
-    if (hit.dist > 0.0f && (hit0.dist <= 0.0f || hit.dist < hit0.dist)) {
-      color = (float4)(1.0f, 0.0f, 0.0f, 1.0f) * max(0.10f + dot(normalize(hit.pos - lightPos), hit.normal) / 2.0f, 0.05f);
-    } else if (hit0.dist > 0.0f) {
-      Ray ray0;
-      ray0.pos = hit0.pos;
-      ray0.dir = -normalize(lightPos - hit0.pos);
-      
-      float lighting = max(0.5f + 0.5f * dot(normalize(lightPos - hit0.pos), hit0.normal), 0.05f);
-      RayHit hit1 = raySphereIntersect(&ray0, &sphere);
-
-      if (hit1.dist > 0.0f) {
-        lighting = 0.15f;
+    write_imagef(img, (int2)(x, y), tracePixel(x, y, width, height, &scene));
+  }
+}
+
+/* Kernel method draws one tile of a larger image, the global offset places the tile in the frame and the image holds only the tile. */
+
+__kernel void traceTile (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours
+  )
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  int2 pixel = (int2)(x - get_global_offset(0), y - get_global_offset(1));
+
+  // the global size is padded to whole work-groups so may overrun the tile as well as the frame
+  if (x < width && y < height && pixel.x < get_image_width(img) && pixel.y < get_image_height(img)) 
+  {
+    Scene scene = { 
+      sphereGeometry, sphereMaterials, sphereCount, 
+      planeGeometry, planeMaterials, planeCount, 
+      lightPositions, lightColours, lightCount, 
+      materialColours 
+    };
+
+    write_imagef(img, pixel, tracePixel(x, y, width, height, &scene));
+  }
+}
+
+/* Persistent threads, only enough groups to fill the device are launched and they pull tiles until none are left. */
+
+__kernel void tracePersistent (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours,
+    __global volatile unsigned int* tileCounter,
+    unsigned int tileSize
+  )
+{
+  __local unsigned int tile;
+
+  Scene scene = { 
+    sphereGeometry, sphereMaterials, sphereCount, 
+    planeGeometry, planeMaterials, planeCount, 
+    lightPositions, lightColours, lightCount, 
+    materialColours 
+  };
+
+  unsigned int tilesX = (width + tileSize - 1) / tileSize;
+  unsigned int tileCount = tilesX * ((height + tileSize - 1) / tileSize);
+  unsigned int lid = get_local_id(0);
+  unsigned int groupSize = get_local_size(0);
+
+  while (true)
+  {
+    // one fetch per group keeps the counter traffic to one atomic per tile
+    if (lid == 0) {
+      tile = atomic_inc(tileCounter);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    unsigned int current = tile;
+    if (current >= tileCount) {
+      break;
+    }
+
+    int x0 = (current % tilesX) * tileSize;
+    int y0 = (current / tilesX) * tileSize;
+    for (unsigned int p = lid; p < tileSize * tileSize; p += groupSize) {
+      int x = x0 + p % tileSize;
+      int y = y0 + p / tileSize;
+
+      if (x < width && y < height) {
+        write_imagef(img, (int2)(x, y), tracePixel(x, y, width, height, &scene));
+      }
+    }
+
+    // every item must have read the tile before it is overwritten by the next fetch
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
+
+/* Progressive path tracing, samples are averaged across frames in a float buffer. */
+
+#define MAX_BOUNCES 4
+
+uint hashSeed(uint x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+float randomFloat(uint* state)
+{
+  // xorshift32, the top 24 bits map exactly onto [0, 1)
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return (*state >> 8) * (1.0f / 16777216.0f);
+}
+
+float3 sampleHemisphere(float3 normal, uint* state)
+{
+  // cosine weighted so the lambert term and pdf cancel
+  float r1 = 2.0f * PI * randomFloat(state);
+  float r2 = randomFloat(state);
+  float r = sqrt(r2);
+
+  float3 tangent = normalize(cross(fabs(normal.x) > 0.1f ? (float3)(0.0f, 1.0f, 0.0f) : (float3)(1.0f, 0.0f, 0.0f), normal));
+  float3 bitangent = cross(normal, tangent);
+  return normalize(tangent * cos(r1) * r + bitangent * sin(r1) * r + normal * sqrt(1.0f - r2));
+}
+
+float3 directLight(RayHit* hit, float3 normal, float3 albedo, Scene* scene)
+{
+  float3 colour = (float3)(0.0f, 0.0f, 0.0f);
+
+  for (unsigned int i = 0; i < scene->lightCount; i++) {
+    float3 toLight = scene->lightPositions[i].xyz - hit->pos;
+    float dist = length(toLight);
+    float3 dir = toLight / dist;
+
+    float lambert = dot(normal, dir);
+    if (lambert <= 0.0f) {
+      continue;
+    }
+
+    Ray shadow;
+    shadow.pos = hit->pos + normal * SHADOW_BIAS;
+    shadow.dir = dir;
+
+    if (!sceneOccluded(&shadow, scene, dist)) {
+      colour += albedo * scene->lightColours[i].xyz * lambert;
+    }
+  }
+
+  return colour;
+}
+
+float3 tracePath(Ray ray, Scene* scene, uint* state)
+{
+  float3 radiance = (float3)(0.0f, 0.0f, 0.0f);
+  float3 throughput = (float3)(1.0f, 1.0f, 1.0f);
+
+  for (int bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+    int material;
+    RayHit hit = sceneIntersect(&ray, scene, &material);
+
+    // the sky is a dim uniform light matching the ambient term of trace
+    if (material < 0) {
+      radiance += throughput * AMBIENT;
+      break;
+    }
+
+    float3 normal = dot(hit.normal, ray.dir) > 0.0f ? -hit.normal : hit.normal;
+    float3 albedo = scene->materialColours[material].xyz;
+
+    radiance += throughput * directLight(&hit, normal, albedo, scene);
+    throughput *= albedo;
+
+    ray.pos = hit.pos + normal * SHADOW_BIAS;
+    ray.dir = sampleHemisphere(normal, state);
+  }
+
+  return radiance;
+}
+
+__kernel void pathTrace (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours,
+    __global float4* accumulation,
+    unsigned int sampleCount,
+    unsigned int samplesPerPixel
+  )
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+
+  if (x < width && y < height) 
+  {
+    Scene scene = { 
+      sphereGeometry, sphereMaterials, sphereCount, 
+      planeGeometry, planeMaterials, planeCount, 
+      lightPositions, lightColours, lightCount, 
+      materialColours 
+    };
+
+    int index = y * width + x;
+    uint state = hashSeed(index ^ hashSeed(sampleCount + 1)) | 1u;
+    float3 sum = (float3)(0.0f, 0.0f, 0.0f);
+
+    // jittered sub-pixel positions anti-alias edges as the image converges
+    for (unsigned int s = 0; s < samplesPerPixel; s++) {
+      float2 coord = (float2)(x + randomFloat(&state) - 0.5f, y + randomFloat(&state) - 0.5f);
+      Ray ray = createCameraRay(coord, (float2)(width, height));
+      sum += tracePath(ray, &scene, &state);
+    }
+
+    // the first frame after a reset overwrites stale history instead of clearing it first
+    float4 total = (sampleCount > 0 ? accumulation[index] : (float4)(0.0f)) + (float4)(sum, 0.0f);
+    accumulation[index] = total;
+
+    float3 colour = total.xyz / (float)(sampleCount + samplesPerPixel);
+    write_imagef(img, (int2)(x, y), (float4)(colour, 1.0f));
+  }
+}
+
+/* Adaptive sampling, only tiles whose error estimate is above a threshold are traced. */
+
+__constant float3 LUMINANCE = (float3)(0.2126f, 0.7152f, 0.0722f);
+
+// keeps the relative error of near-black pixels from blowing up
+__constant float ERROR_FLOOR = 0.05f;
+
+__kernel void pathTraceAdaptive (
+    __global float4* accumulation,
+    unsigned int width,
+    unsigned int height,
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours,
+    __global const unsigned int* tileSamples,
+    __global const unsigned int* activeTiles,
+    __global int* tileErrors,
+    unsigned int tileSize,
+    unsigned int samplesPerPass
+  )
+{
+  // dimension 2 walks the compacted list of tiles that have not converged
+  unsigned int tile = activeTiles[get_global_id(2)];
+  unsigned int tilesX = (width + tileSize - 1) / tileSize;
+  int x = (tile % tilesX) * tileSize + get_global_id(0);
+  int y = (tile / tilesX) * tileSize + get_global_id(1);
+
+  if (x < width && y < height) 
+  {
+    Scene scene = { 
+      sphereGeometry, sphereMaterials, sphereCount, 
+      planeGeometry, planeMaterials, planeCount, 
+      lightPositions, lightColours, lightCount, 
+      materialColours 
+    };
+
+    int index = y * width + x;
+    unsigned int previous = tileSamples[tile];
+    uint state = hashSeed(index ^ hashSeed(previous + 1)) | 1u;
+    float3 sum = (float3)(0.0f, 0.0f, 0.0f);
+    float sumSquares = 0.0f;
+
+    for (unsigned int s = 0; s < samplesPerPass; s++) {
+      float2 coord = (float2)(x + randomFloat(&state) - 0.5f, y + randomFloat(&state) - 0.5f);
+      Ray ray = createCameraRay(coord, (float2)(width, height));
+      float3 sample = tracePath(ray, &scene, &state);
+      float luminance = dot(sample, LUMINANCE);
+      sum += sample;
+      sumSquares += luminance * luminance;
+    }
+
+    // w holds the running sum of squared luminance for the variance estimate
+    float4 total = (previous > 0 ? accumulation[index] : (float4)(0.0f)) + (float4)(sum, sumSquares);
+    accumulation[index] = total;
+
+    float n = (float)(previous + samplesPerPass);
+    float mean = dot(total.xyz, LUMINANCE) / n;
+    float variance = max(total.w / n - mean * mean, 0.0f);
+
+    // relative standard error of the pixel mean, the worst pixel decides for its tile
+    float error = sqrt(variance / n) / (mean + ERROR_FLOOR);
+    atomic_max(&tileErrors[tile], as_int(error));
+  }
+}
+
+__kernel void resolveTiles (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const float4* accumulation,
+    __global const unsigned int* tileSamples,
+    unsigned int tileSize
+  )
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+
+  if (x < width && y < height) 
+  {
+    unsigned int tilesX = (width + tileSize - 1) / tileSize;
+    unsigned int samples = tileSamples[(y / tileSize) * tilesX + x / tileSize];
+
+    float4 total = accumulation[y * width + x];
+    float3 colour = samples > 0 ? total.xyz / (float) samples : (float3)(0.0f, 0.0f, 0.0f);
+    write_imagef(img, (int2)(x, y), (float4)(colour, 1.0f));
+  }
+}
+
+/* Wavefront path tracing, each stage is its own kernel and paths are passed through queues. */
+
+// layouts must match the structs in src/render/render.h
+typedef struct WavefrontRay {
+  float4 origin;
+  float4 direction;
+  float4 throughput;
+  int    pixel;
+  int    bounce;
+  uint   seed;
+  int    pad;
+} WavefrontRay;
+
+typedef struct WavefrontHit {
+  float4 normal;      // xyz, distance w
+  int    material;
+  int    pad0, pad1, pad2;
+} WavefrontHit;
+
+typedef struct ShadowRay {
+  float4 origin;      // xyz, distance to the light w
+  float4 direction;
+  float4 contribution;
+  int    pixel;
+  int    pad0, pad1, pad2;
+} ShadowRay;
+
+// indices into the counter buffer, the two path queues alternate between bounces
+#define SHADOW_QUEUE 2
+
+__kernel void wavefrontGenerate (
+    __global WavefrontRay* rays,
+    __global float4* accumulation,
+    unsigned int width,
+    unsigned int height,
+    unsigned int sampleCount
+  )
+{
+  int index = get_global_id(0);
+
+  if (index < width * height)
+  {
+    int x = index % width;
+    int y = index / width;
+
+    uint state = hashSeed(index ^ hashSeed(sampleCount + 1)) | 1u;
+    float2 coord = (float2)(x + randomFloat(&state) - 0.5f, y + randomFloat(&state) - 0.5f);
+    Ray ray = createCameraRay(coord, (float2)(width, height));
+
+    // every pixel starts one path, so the queue is filled densely without atomics
+    WavefrontRay path;
+    path.origin = (float4)(ray.pos, 0.0f);
+    path.direction = (float4)(ray.dir, 0.0f);
+    path.throughput = (float4)(1.0f, 1.0f, 1.0f, 0.0f);
+    path.pixel = index;
+    path.bounce = 0;
+    path.seed = state;
+    path.pad = 0;
+    rays[index] = path;
+
+    if (sampleCount == 0) {
+      accumulation[index] = (float4)(0.0f);
+    }
+  }
+}
+
+__kernel void wavefrontExtend (
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours,
+    __global const WavefrontRay* rays,
+    __global const unsigned int* counters,
+    unsigned int queue,
+    __global WavefrontHit* hits
+  )
+{
+  int index = get_global_id(0);
+
+  if (index < counters[queue])
+  {
+    Scene scene = { 
+      sphereGeometry, sphereMaterials, sphereCount, 
+      planeGeometry, planeMaterials, planeCount, 
+      lightPositions, lightColours, lightCount, 
+      materialColours 
+    };
+
+    Ray ray;
+    ray.pos = rays[index].origin.xyz;
+    ray.dir = rays[index].direction.xyz;
+
+    int material;
+    RayHit hit = sceneIntersect(&ray, &scene, &material);
+
+    WavefrontHit result;
+    result.normal = (float4)(hit.normal, hit.dist);
+    result.material = material;
+    result.pad0 = result.pad1 = result.pad2 = 0;
+    hits[index] = result;
+  }
+}
+
+__kernel void wavefrontShade (
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours,
+    __global const WavefrontRay* rays,
+    __global unsigned int* counters,
+    unsigned int queue,
+    __global const WavefrontHit* hits,
+    __global WavefrontRay* nextRays,
+    unsigned int nextQueue,
+    __global ShadowRay* shadowRays,
+    __global float4* accumulation
+  )
+{
+  int index = get_global_id(0);
+
+  if (index < counters[queue])
+  {
+    WavefrontRay path = rays[index];
+    WavefrontHit hit = hits[index];
+    float3 throughput = path.throughput.xyz;
+
+    // a path can only be in one queue at a time, so no other work item writes its pixel in this launch
+    if (hit.material < 0) {
+      accumulation[path.pixel] += (float4)(throughput * AMBIENT, 0.0f);
+      return;
+    }
+
+    uint state = path.seed;
+    float3 dir = path.direction.xyz;
+    float3 pos = path.origin.xyz + dir * hit.normal.w;
+    float3 normal = dot(hit.normal.xyz, dir) > 0.0f ? -hit.normal.xyz : hit.normal.xyz;
+    float3 albedo = materialColours[hit.material].xyz;
+
+    // one randomly chosen light per hit, weighted by the light count to stay unbiased
+    if (lightCount > 0) {
+      unsigned int light = min((unsigned int)(randomFloat(&state) * lightCount), lightCount - 1);
+      float3 toLight = lightPositions[light].xyz - pos;
+      float dist = length(toLight);
+      float3 lightDir = toLight / dist;
+      float lambert = dot(normal, lightDir);
+
+      if (lambert > 0.0f) {
+        ShadowRay shadow;
+        shadow.origin = (float4)(pos + normal * SHADOW_BIAS, dist);
+        shadow.direction = (float4)(lightDir, 0.0f);
+        shadow.contribution = (float4)(throughput * albedo * lightColours[light].xyz * lambert * lightCount, 0.0f);
+        shadow.pixel = path.pixel;
+        shadow.pad0 = shadow.pad1 = shadow.pad2 = 0;
+        shadowRays[atomic_inc(&counters[SHADOW_QUEUE])] = shadow;
+      }
+    }
+
+    throughput *= albedo;
+
+    // russian roulette ends dim paths early, survivors are reweighted to keep the estimate unbiased
+    if (path.bounce > 0) {
+      float survival = clamp(max(throughput.x, max(throughput.y, throughput.z)), 0.05f, 1.0f);
+      if (randomFloat(&state) >= survival) {
+        return;
       }
+      throughput /= survival;
+    }
+
+    if (path.bounce + 1 < MAX_BOUNCES) {
+      WavefrontRay next;
+      next.origin = (float4)(pos + normal * SHADOW_BIAS, 0.0f);
+      next.direction = (float4)(sampleHemisphere(normal, &state), 0.0f);
+      next.throughput = (float4)(throughput, 0.0f);
+      next.pixel = path.pixel;
+      next.bounce = path.bounce + 1;
+      next.seed = state;
+      next.pad = 0;
+
+      // atomic append compacts the surviving paths to the front of the next queue
+      nextRays[atomic_inc(&counters[nextQueue])] = next;
+    }
+  }
+}
+
+__kernel void wavefrontConnect (
+    __global const float4* sphereGeometry,
+    __global const int* sphereMaterials,
+    unsigned int sphereCount,
+    __global const float4* planeGeometry,
+    __global const int* planeMaterials,
+    unsigned int planeCount,
+    __global const float4* lightPositions,
+    __global const float4* lightColours,
+    unsigned int lightCount,
+    __global const float4* materialColours,
+    __global const ShadowRay* shadowRays,
+    __global const unsigned int* counters,
+    __global float4* accumulation
+  )
+{
+  int index = get_global_id(0);
 
-      color = (float4)(0.96f, 0.31f, 0.21f, 1.0f) * lighting;
+  if (index < counters[SHADOW_QUEUE])
+  {
+    Scene scene = { 
+      sphereGeometry, sphereMaterials, sphereCount, 
+      planeGeometry, planeMaterials, planeCount, 
+      lightPositions, lightColours, lightCount, 
+      materialColours 
+    };
+
+    ShadowRay shadow = shadowRays[index];
+    Ray ray;
+    ray.pos = shadow.origin.xyz;
+    ray.dir = shadow.direction.xyz;
+
+    if (!sceneOccluded(&ray, &scene, shadow.origin.w)) {
+      accumulation[shadow.pixel] += shadow.contribution;
     }
+  }
+}
 
-    write_imagef(img, (int2)(x, y), color);
+__kernel void resolveAccumulation (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const float4* accumulation,
+    unsigned int sampleCount
+  )
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+
+  if (x < width && y < height) 
+  {
+    float3 colour = accumulation[y * width + x].xyz / (float) max(sampleCount, 1u);
+    write_imagef(img, (int2)(x, y), (float4)(colour, 1.0f));
   }
-}
\ No newline at end of file
+}
+
+/* Triangle mesh ray tracing using a flattened bounding volume hierarchy. */
+
+#define BVH_STACK_SIZE 64
+
+typedef struct BVHNode {
+  float minX, minY, minZ;
+  int   leftFirst;
+  float maxX, maxY, maxZ;
+  int   count;
+} BVHNode;
+
+typedef struct Triangle {
+  float4 v0;
+  float4 e1;
+  float4 e2;
+  float4 normal;
+} Triangle;
+
+float rayAABBIntersect(Ray* ray, float3 invDir, __global const BVHNode* node, float tMax)
+{
+  float3 t0 = ((float3)(node->minX, node->minY, node->minZ) - ray->pos) * invDir;
+  float3 t1 = ((float3)(node->maxX, node->maxY, node->maxZ) - ray->pos) * invDir;
+  float3 tNear3 = fmin(t0, t1);
+  float3 tFar3  = fmax(t0, t1);
+
+  float tNear = max(max(tNear3.x, tNear3.y), tNear3.z);
+  float tFar  = min(min(tFar3.x, tFar3.y), tFar3.z);
+
+  if (tFar >= tNear && tFar > 0.0f && tNear < tMax) {
+    return tNear;
+  }
+  return INFINITY;
+}
+
+float rayTriangleIntersect(Ray* ray, __global const Triangle* tri)
+{
+  // Moller-Trumbore with precomputed edges
+  float3 e1 = tri->e1.xyz;
+  float3 e2 = tri->e2.xyz;
+  float3 p  = cross(ray->dir, e2);
+  float det = dot(e1, p);
+
+  if (fabs(det) < EPSILON) {
+    return 0.0f;
+  }
+
+  float invDet = 1.0f / det;
+  float3 s = ray->pos - tri->v0.xyz;
+  float u = dot(s, p) * invDet;
+  if (u < 0.0f || u > 1.0f) {
+    return 0.0f;
+  }
+
+  float3 q = cross(s, e1);
+  float v = dot(ray->dir, q) * invDet;
+  if (v < 0.0f || u + v > 1.0f) {
+    return 0.0f;
+  }
+
+  float t = dot(e2, q) * invDet;
+  return t > EPSILON ? t : 0.0f;
+}
+
+RayHit rayBVHIntersect(Ray* ray, __global const BVHNode* nodes, __global const Triangle* tris)
+{
+  RayHit hit;
+  hit.dist = 0.0f;
+  hit.pos = (float3)(0.0f, 0.0f, 0.0f);
+  hit.normal = (float3)(0.0f, 0.0f, 0.0f);
+
+  float3 invDir = 1.0f / ray->dir;
+  float closest = INFINITY;
+  int closestTri = -1;
+
+  // each node is stacked with the distance its box was entered at, so it is slab tested only once
+  int stack[BVH_STACK_SIZE];
+  float entry[BVH_STACK_SIZE];
+  int top = 0;
+  entry[top] = rayAABBIntersect(ray, invDir, &nodes[0], closest);
+  stack[top++] = 0;
+
+  while (top > 0) {
+    top--;
+
+    // a hit found since the node was pushed may already be closer than its box
+    if (entry[top] >= closest) {
+      continue;
+    }
+    __global const BVHNode* node = &nodes[stack[top]];
+
+    if (node->count > 0) {
+      for (int i = node->leftFirst; i < node->leftFirst + node->count; i++) {
+        float t = rayTriangleIntersect(ray, &tris[i]);
+        if (t > 0.0f && t < closest) {
+          closest = t;
+          closestTri = i;
+        }
+      }
+      continue;
+    }
+
+    // visits the nearer child first so the far one is culled more often
+    int left = node->leftFirst;
+    float dLeft  = rayAABBIntersect(ray, invDir, &nodes[left], closest);
+    float dRight = rayAABBIntersect(ray, invDir, &nodes[left + 1], closest);
+
+    if (dLeft > dRight) {
+      if (dLeft != INFINITY) { entry[top] = dLeft; stack[top++] = left; }
+      if (dRight != INFINITY) { entry[top] = dRight; stack[top++] = left + 1; }
+    } else {
+      if (dRight != INFINITY) { entry[top] = dRight; stack[top++] = left + 1; }
+      if (dLeft != INFINITY) { entry[top] = dLeft; stack[top++] = left; }
+    }
+  }
+
+  if (closestTri >= 0) {
+    hit.dist = closest;
+    hit.pos = closest * ray->dir + ray->pos;
+    hit.normal = tris[closestTri].normal.xyz;
+  }
+
+  return hit;
+}
+
+float4 traceMeshPixel(int x, int y, unsigned int width, unsigned int height, __global const BVHNode* nodes, __global const Triangle* tris)
+{
+  Ray ray = createCameraRay((float2)(x, y), (float2)(width, height));
+  RayHit hit = rayBVHIntersect(&ray, nodes, tris);
+
+  float3 lightPos = (float3)(-500.0f, 1000.0f, -700.0f);
+  float4 color = (float4)(0.0f, 0.0f, 0.0f, 1.0f);
+
+  if (hit.dist > 0.0f) {
+    // shades both faces as meshes are not guaranteed to be closed
+    float3 normal = dot(hit.normal, ray.dir) > 0.0f ? -hit.normal : hit.normal;
+    float lighting = max(0.1f + 0.9f * dot(normalize(lightPos - hit.pos), normal), 0.05f);
+    color = (float4)(0.21f, 0.31f, 0.96f, 1.0f) * lighting;
+    color.w = 1.0f;
+  }
+
+  return color;
+}
+
+/* Kernel method draws full image of a triangle mesh. */
+
+__kernel void traceMesh (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const BVHNode* nodes,
+    __global const Triangle* tris
+  )
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+
+  if (x < width && y < height) 
+  {
+    write_imagef(img, (int2)(x, y), traceMeshPixel(x, y, width, height, nodes, tris));
+  }
+}
+
+/* Kernel method draws one tile of a larger image of a triangle mesh, addressed like traceTile. */
+
+__kernel void traceMeshTile (
+    __write_only image2d_t img,
+    unsigned int width,
+    unsigned int height,
+    __global const BVHNode* nodes,
+    __global const Triangle* tris
+  )
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  int2 pixel = (int2)(x - get_global_offset(0), y - get_global_offset(1));
+
+  if (x < width && y < height && pixel.x < get_image_width(img) && pixel.y < get_image_height(img)) 
+  {
+    write_imagef(img, pixel, traceMeshPixel(x, y, width, height, nodes, tris));
+  }
+}
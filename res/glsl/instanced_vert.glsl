@@ -1,4 +1,3 @@
-
 #version 300 es
 
 precision highp float;
@@ -8,9 +7,13 @@ layout(location = 0) in vec3 vertex;
 layout(location = 1) in vec2 texCoord;
 layout(location = 2) in vec3 normal;
 
-uniform mat4 projection;
-uniform mat4 transformation;
-uniform mat4 view;
+// per-instance model matrix streamed by gfx::BatchRenderer, occupies locations 3 to 6
+layout(location = 3) in mat4 transformation;
+
+layout(std140) uniform Camera {
+  mat4 projection;
+  mat4 view;
+};
 
 out vec2 uv;
 out vec3 norm;
@@ -24,4 +27,4 @@ void main() {
   gl_Position = projection * view * worldPos;
 
   toCamera = normalize(inverse(view) * vec4(0.0, 0.0, 0.0, 1.0) - worldPos).xyz;
-}
\ No newline at end of file
+}
@@ -0,0 +1,112 @@
+#include "compute.h"
+
+#include <sstream>
+
+namespace sunstorm
+{
+  namespace cmp
+  {
+    Autotuner::Autotuner(cl_device_id device) : device(device)
+    {
+      // driver updates change code generation, so they invalidate results like in the program cache
+      std::string key = getDeviceString(device, CL_DEVICE_NAME) + "|" + getDeviceString(device, CL_DRIVER_VERSION);
+      path = CACHE_DIR + "tuning/" + io::toHex(io::hashBytes(key.data(), key.size())) + ".txt";
+
+      std::ifstream input(path);
+      std::string name;
+      LaunchSize entry = {};
+      while (input >> name >> entry.local[0] >> entry.local[1]) {
+        entries[name] = entry;
+      }
+    }
+
+    std::vector<LaunchSize> Autotuner::getCandidates(const ComputeKernel* kernel) const
+    {
+      size_t maxWorkGroup = 0, multiple = 1;
+      size_t maxItems[3] = { 1, 1, 1 };
+      ComputeHandler::handleError(clGetKernelWorkGroupInfo(kernel->getKernel(), device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroup, NULL));
+      ComputeHandler::handleError(clGetKernelWorkGroupInfo(kernel->getKernel(), device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &multiple, NULL));
+      ComputeHandler::handleError(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL));
+      multiple = std::max<size_t>(1, multiple);
+
+      std::vector<LaunchSize> candidates = { {} };
+
+      // powers of two whose area fills whole SIMD batches, smaller groups leave lanes idle
+      for (size_t x = 1; x <= maxItems[0]; x *= 2) {
+        for (size_t y = 1; y <= maxItems[1] && x * y <= maxWorkGroup; y *= 2) {
+          if ((x * y) % multiple == 0 || x * y == maxWorkGroup) {
+            LaunchSize candidate = {};
+            candidate.local[0] = x;
+            candidate.local[1] = y;
+            candidates.push_back(candidate);
+          }
+        }
+      }
+      return candidates;
+    }
+
+    LaunchSize Autotuner::tune(const ComputeKernel* kernel, cl_command_queue queue, const size_t* globalSize, 
+      std::function<void(const LaunchSize&)> launch, unsigned int iterations)
+    {
+      std::vector<LaunchSize> candidates = getCandidates(kernel);
+
+      // a stored size is only reused if the kernel can still be launched with it
+      auto stored = entries.find(kernel->getName());
+      if (stored != entries.end()) {
+        for (const LaunchSize& candidate : candidates) {
+          if (candidate.local[0] == stored->second.local[0] && candidate.local[1] == stored->second.local[1]) {
+            return fit(globalSize, stored->second.getLocal());
+          }
+        }
+      }
+
+      LaunchSize best = fit(globalSize, NULL);
+      double bestTime = INFINITY;
+
+      for (const LaunchSize& candidate : candidates) {
+        LaunchSize size = fit(globalSize, candidate.getLocal());
+
+        // the first launch pays for any lazy setup in the driver
+        launch(size);
+        ComputeHandler::handleError(clFinish(queue));
+
+        long long t0 = time::getTimeMicroseconds();
+        for (unsigned int i = 0; i < iterations; i++) {
+          launch(size);
+        }
+        ComputeHandler::handleError(clFinish(queue));
+        double elapsed = (double) (time::getTimeMicroseconds() - t0) / iterations;
+
+        if (elapsed < bestTime) {
+          bestTime = elapsed;
+          best = size;
+        }
+      }
+
+      SSRT_DBG_OUTPUT("Tuned " << kernel->getName() << ": " << best.local[0] << "x" << best.local[1] 
+        << " over " << candidates.size() << " candidates (" << bestTime / 1000.0 << " ms)");
+
+      entries[kernel->getName()] = best;
+
+      // rewritten whole since there is one small file per device
+      std::error_code ec;
+      std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+      std::ofstream output(path);
+      for (const auto& [name, entry] : entries) {
+        output << name << " " << entry.local[0] << " " << entry.local[1] << std::endl;
+      }
+
+      return best;
+    }
+
+    LaunchSize Autotuner::fit(const size_t* globalSize, const size_t* localSize)
+    {
+      LaunchSize size = {};
+      for (int i = 0; i < 2; i++) {
+        size.local[i] = localSize ? localSize[i] : 0;
+        size.global[i] = localSize ? (globalSize[i] + localSize[i] - 1) / localSize[i] * localSize[i] : globalSize[i];
+      }
+      return size;
+    }
+  }
+}
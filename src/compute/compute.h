@@ -1,6 +1,9 @@
 #pragma once
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -27,10 +30,33 @@ namespace sunstorm
      */
     const char* getErrorString(cl_int error);
 
+    /**
+     * @brief Get a string property of a device e.g name or driver version.
+     * 
+     * @param device Device ID
+     * @param param Device info enum
+     * @return std::string 
+     */
+    std::string getDeviceString(cl_device_id device, cl_device_info param);
+
     // forward declaration
     class ComputeProgram;
     class ComputeKernel;
 
+    /**
+     * One device with its own context and queue, contexts cannot span
+     * platforms so each device is given its own.
+     */
+    struct ComputeDevice
+    {
+      cl_platform_id platform;
+      cl_device_id device;
+      cl_context context;
+      cl_command_queue queue;
+      cl_device_type type;
+      std::string name;
+    };
+
     class ComputeHandler
     {
     private:
@@ -40,6 +66,8 @@ namespace sunstorm
 
       std::vector<cl_command_queue> queues;
       std::vector<ComputeProgram*> programs;
+      std::vector<ComputeDevice> devices;
+      std::vector<cl_context> deviceContexts;
 
     public:
       static ComputeHandler* global;
@@ -47,8 +75,11 @@ namespace sunstorm
       /**
        * @brief Construct a new Compute Handler object and retrieves GPU
        *  details and creates compute context.
+       * 
+       * @param interop Share the context with the current OpenGL context, must be
+       *  false when running headless without a window
        */
-      ComputeHandler();
+      ComputeHandler(bool interop = true);
 
       /**
        * @brief Destroy child objects and releases them from GPU memory.
@@ -56,7 +87,8 @@ namespace sunstorm
       ~ComputeHandler();
 
       /**
-       * @brief Create a Queue object and stores it to be released on cleanup.
+       * @brief Create a Queue object and stores it to be released on cleanup,
+       *    profiling is enabled on it while a Profiler exists.
        * 
        * @param props Command queue properties / Can be NULL
        * @return cl_command_queue 
@@ -67,9 +99,11 @@ namespace sunstorm
        * @brief Create a Program object from source file.
        * 
        * @param filepath Path to source file
+       * @param options Compiler options passed to clBuildProgram
+       * @param device Device to build for, the handler's own device if nullptr
        * @return ComputeProgram* 
        */
-      ComputeProgram* createProgram(std::string filepath);
+      ComputeProgram* createProgram(std::string filepath, std::string options = "", const ComputeDevice* device = nullptr);
 
       /**
        * @brief Get a Command Queue by index
@@ -98,6 +132,49 @@ namespace sunstorm
       inline cl_device_id getDevice() const {
         return deviceId;
       }
+
+      /**
+       * @brief Get the Platform id
+       * 
+       * @return cl_platform_id
+       */
+      inline cl_platform_id getPlatform() const {
+        return platformId;
+      }
+
+      /**
+       * @brief Query if the device reports an extension.
+       * 
+       * @param name Extension name, e.g. cl_khr_gl_event
+       * @return true If the extension is supported
+       */
+      bool hasExtension(std::string name) const;
+
+      /**
+       * @brief Get the number of compute units on the device, the most
+       *    work-groups that can make progress side by side.
+       * 
+       * @return cl_uint
+       */
+      cl_uint getComputeUnits() const;
+
+      /**
+       * @brief Enumerates every device of every platform and creates a queue
+       *    on each, the handler's own device reuses its context.
+       * 
+       * @param props Command queue properties / Can be NULL
+       * @return const std::vector<ComputeDevice>& 
+       */
+      const std::vector<ComputeDevice>& createDeviceQueues(cl_command_queue_properties props);
+
+      /**
+       * @brief Get the devices enumerated by createDeviceQueues
+       * 
+       * @return const std::vector<ComputeDevice>& 
+       */
+      inline const std::vector<ComputeDevice>& getDevices() const {
+        return devices;
+      }
       
       /**
        * @brief Decodes OpenCL error code and throws error.
@@ -111,18 +188,42 @@ namespace sunstorm
     {
     private:
       std::string name;
+      std::string options;
       std::vector<ComputeKernel*> kernels;
       cl_program programId;
+      cl_device_id device;
+      cl_context context;
+
+      /**
+       * @brief Loads a previously built binary from the on-disk cache, invalid
+       *  or stale entries are deleted.
+       * 
+       * @param path Cache file path
+       * @param key Full cache key stored in the entry
+       * @return true If the program was created and built from the binary
+       */
+      bool loadBinary(const std::string& path, const std::string& key);
+
+      /**
+       * @brief Writes the built program binary to the on-disk cache.
+       * 
+       * @param path Cache file path
+       * @param key Full cache key stored in the entry
+       */
+      void saveBinary(const std::string& path, const std::string& key) const;
 
     public:
       /**
        * @brief Construct a new Compute Program object to extract kernel
-       *  functions from.
+       *  functions from. Built binaries are cached on disk keyed by source,
+       *  device, driver version and options so later runs skip compilation.
        * 
        * @param name Name of program file
        * @param source Source code for program
+       * @param options Compiler options passed to clBuildProgram
+       * @param target Device to build for, the handler's own device if nullptr
        */
-      ComputeProgram(std::string name, std::string source);
+      ComputeProgram(std::string name, std::string source, std::string options = "", const ComputeDevice* target = nullptr);
 
       /**
        * @brief Destroy the Compute Program object and attached kernels.
@@ -182,9 +283,10 @@ namespace sunstorm
        * @param index Index of parameter to pass buffer
        * @param flags Memory object flags
        * @param size Size of buffer
+       * @param data Initial host data, requires CL_MEM_COPY_HOST_PTR or CL_MEM_USE_HOST_PTR (can be nullptr)
        * @return cl_mem
        */
-      cl_mem createBuffer(cl_uint index, cl_mem_flags flags, size_t size);
+      cl_mem createBuffer(cl_uint index, cl_mem_flags flags, size_t size, void* data = nullptr);
 
       /**
        * @brief Create an OpenCL Buffer object from an OpenGL vertex buffer object and
@@ -232,6 +334,14 @@ namespace sunstorm
        */
       cl_mem createSharedRenderbuffer(cl_uint index, cl_mem_flags flags, GLuint renderBufferId);
 
+      /**
+       * @brief Releases a memory object created through this kernel before the
+       *    kernel itself is destroyed.
+       * 
+       * @param memory Memory object returned by one of the create methods
+       */
+      void releaseMemory(cl_mem memory);
+
       /**
        * @brief Attach OpenCL memory buffer as kernel parameter at index
        * 
@@ -240,6 +350,31 @@ namespace sunstorm
        */
       void setMemoryArg(cl_uint position, cl_mem memory);
 
+      /**
+       * @brief Enqueues the kernel over an NDRange and records its event with
+       *    the profiler if one is active.
+       * 
+       * @param queue Command queue
+       * @param dims Number of work dimensions
+       * @param globalOffset Global work offset (can be NULL)
+       * @param globalSize Global work dimensions
+       * @param localSize Work-group dimensions (can be NULL)
+       * @param waitCount Number of events to wait on
+       * @param waitList Events to wait on (can be NULL)
+       * @param event Returned event of the launch (can be NULL)
+       */
+      void enqueue(cl_command_queue queue, cl_uint dims, const size_t* globalOffset, const size_t* globalSize, const size_t* localSize,
+        cl_uint waitCount = 0, const cl_event* waitList = NULL, cl_event* event = NULL) const;
+
+      /**
+       * @brief Get the Kernel name
+       * 
+       * @return const std::string& 
+       */
+      inline const std::string& getName() const {
+        return name;
+      }
+
       /**
        * @brief Get the Kernel object
        * 
@@ -249,5 +384,159 @@ namespace sunstorm
         return kernelId;
       }
     };
+
+    struct ProfileStats
+    {
+      size_t count;
+      double min;
+      double median;
+      double p99;
+      double max;
+    };
+
+    struct ProfileSamples
+    {
+      // nanosecond intervals between the four event timestamps
+      std::vector<cl_ulong> queued;
+      std::vector<cl_ulong> submitted;
+      std::vector<cl_ulong> executed;
+      std::vector<cl_ulong> total;
+    };
+
+    class Profiler
+    {
+    private:
+      std::vector<std::pair<std::string, cl_event>> pending;
+      std::map<std::string, ProfileSamples> samples;
+
+    public:
+      static Profiler* global;
+
+      /**
+       * @brief Construct a new Profiler object, queues created while it
+       *    exists are created with CL_QUEUE_PROFILING_ENABLE.
+       */
+      Profiler();
+
+      /**
+       * @brief Destroy the Profiler object and release pending events.
+       */
+      ~Profiler();
+
+      /**
+       * @brief Keeps an event to read its timestamps once it has completed.
+       * 
+       * @param name Kernel or command name to aggregate under
+       * @param event Event of a command on a profiling queue
+       */
+      void record(const std::string& name, cl_event event);
+
+      /**
+       * @brief Moves the queued, submit, start and end timestamps of pending
+       *    events into the samples.
+       * 
+       * @param wait Waits for events still running, otherwise they stay pending
+       */
+      void collect(bool wait = true);
+
+      /**
+       * @brief Computes statistics over a list of intervals.
+       * 
+       * @param intervals Intervals in nanoseconds
+       * @return ProfileStats Statistics in microseconds
+       */
+      static ProfileStats computeStats(std::vector<cl_ulong> intervals);
+
+      /**
+       * @brief Prints execution time statistics per name.
+       * 
+       * @param output Output stream
+       */
+      void print(std::ostream& output);
+
+      /**
+       * @brief Writes statistics of every phase per name, as JSON if the path
+       *    ends in .json and as CSV otherwise.
+       * 
+       * @param filepath Output file path
+       * @return true If the file was written
+       */
+      bool save(std::string filepath);
+
+      /**
+       * @brief Get the collected samples per name
+       * 
+       * @return const std::map<std::string, ProfileSamples>& 
+       */
+      inline const std::map<std::string, ProfileSamples>& getSamples() const {
+        return samples;
+      }
+    };
+
+    struct LaunchSize
+    {
+      size_t local[2];
+      size_t global[2];
+
+      /**
+       * @brief Get the work-group dimensions to enqueue with
+       * 
+       * @return const size_t* Local size or NULL to let the driver choose
+       */
+      inline const size_t* getLocal() const {
+        return local[0] ? local : NULL;
+      }
+    };
+
+    class Autotuner
+    {
+    private:
+      cl_device_id device;
+      std::string path;
+      std::map<std::string, LaunchSize> entries;
+
+      /**
+       * @brief Lists the 2D work-group sizes the kernel can be launched with
+       *    on the device, starting with the driver's own choice.
+       * 
+       * @param kernel Kernel to query limits of
+       * @return std::vector<LaunchSize> 
+       */
+      std::vector<LaunchSize> getCandidates(const ComputeKernel* kernel) const;
+
+    public:
+      /**
+       * @brief Construct a new Autotuner object and loads previous results for
+       *    the device from the cache directory.
+       * 
+       * @param device Device to tune for
+       */
+      Autotuner(cl_device_id device);
+
+      /**
+       * @brief Gets the fastest work-group size for a kernel, sweeping every
+       *    valid candidate if there is no stored result. The global size is
+       *    rounded up to a multiple of it so the kernel must discard work
+       *    items outside the image.
+       * 
+       * @param kernel Kernel to tune
+       * @param queue Queue the launches are submitted to
+       * @param globalSize Required global work dimensions
+       * @param launch Runs the kernel once with the given sizes
+       * @param iterations Timed launches per candidate
+       * @return LaunchSize 
+       */
+      LaunchSize tune(const ComputeKernel* kernel, cl_command_queue queue, const size_t* globalSize, 
+        std::function<void(const LaunchSize&)> launch, unsigned int iterations = 5);
+
+      /**
+       * @brief Rounds a global size up to a multiple of a work-group size.
+       * 
+       * @param globalSize Required global work dimensions
+       * @param localSize Work-group dimensions (can be NULL)
+       * @return LaunchSize 
+       */
+      static LaunchSize fit(const size_t* globalSize, const size_t* localSize);
+    };
   }
 }
\ No newline at end of file
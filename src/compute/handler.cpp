@@ -6,26 +6,51 @@ namespace sunstorm
   {
     ComputeHandler* ComputeHandler::global;
 
-    ComputeHandler::ComputeHandler()
+    static std::vector<cl_platform_id> getPlatforms()
+    {
+      cl_uint count = 0;
+      ComputeHandler::handleError(clGetPlatformIDs(0, NULL, &count));
+
+      std::vector<cl_platform_id> platforms(count);
+      ComputeHandler::handleError(clGetPlatformIDs(count, platforms.data(), NULL));
+      return platforms;
+    }
+
+    ComputeHandler::ComputeHandler(bool interop)
     {
       // singleton presence check
       if (global) {
         throw std::runtime_error("Global compute handler instance already exists!");
       }
 
-      handleError(clGetPlatformIDs(1, &platformId, NULL));
-
-      handleError(clGetDeviceIDs(platformId, CL_DEVICE_TYPE_GPU, 1, &deviceId, NULL));
-
-      // creates compute context with GL interoperability 
-      cl_context_properties properties[] = {
-        CL_GL_CONTEXT_KHR,    (cl_context_properties) wglGetCurrentContext(),
-        CL_WGL_HDC_KHR,       (cl_context_properties) wglGetCurrentDC(),
-        CL_CONTEXT_PLATFORM,  (cl_context_properties) platformId, 0
-      };
+      // the first GPU of any platform, headless nodes may not expose one so fall back to any compute device
+      std::vector<cl_platform_id> platforms = getPlatforms();
+      cl_int error = CL_DEVICE_NOT_FOUND;
+      for (size_t i = 0; i < platforms.size() && error == CL_DEVICE_NOT_FOUND; i++) {
+        platformId = platforms[i];
+        error = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_GPU, 1, &deviceId, NULL);
+      }
+      for (size_t i = 0; i < platforms.size() && error == CL_DEVICE_NOT_FOUND && !interop; i++) {
+        platformId = platforms[i];
+        error = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, 1, &deviceId, NULL);
+      }
+      handleError(error);
 
-      cl_int error;
-      context = clCreateContext(properties, 1, &deviceId, NULL, NULL, &error);
+      if (interop) {
+        // creates compute context with GL interoperability 
+        cl_context_properties properties[] = {
+          CL_GL_CONTEXT_KHR,    (cl_context_properties) wglGetCurrentContext(),
+          CL_WGL_HDC_KHR,       (cl_context_properties) wglGetCurrentDC(),
+          CL_CONTEXT_PLATFORM,  (cl_context_properties) platformId, 0
+        };
+        context = clCreateContext(properties, 1, &deviceId, NULL, NULL, &error);
+      } else {
+        // creates plain compute context for offscreen rendering
+        cl_context_properties properties[] = {
+          CL_CONTEXT_PLATFORM,  (cl_context_properties) platformId, 0
+        };
+        context = clCreateContext(properties, 1, &deviceId, NULL, NULL, &error);
+      }
       handleError(error);
 
       global = this;
@@ -34,6 +59,11 @@ namespace sunstorm
     
     ComputeHandler::~ComputeHandler()
     {
+      // timestamps are read while the queues that own the events still exist
+      if (Profiler::global) {
+        Profiler::global->collect();
+      }
+
       for (size_t i = 0; i < programs.size(); i++) {
         delete programs[i];
       }
@@ -43,7 +73,10 @@ namespace sunstorm
         handleError(clReleaseCommandQueue(queues[i]));
       }
       
-      // releases context from memory
+      // releases contexts from memory
+      for (size_t i = 0; i < deviceContexts.size(); i++) {
+        handleError(clReleaseContext(deviceContexts[i]));
+      }
       handleError(clReleaseContext(context));
 
       SSRT_DBG_OUTPUT("Destroyed Compute Handler");
@@ -51,6 +84,10 @@ namespace sunstorm
     
     cl_command_queue ComputeHandler::createQueue(cl_command_queue_properties props)
     {
+      if (Profiler::global) {
+        props |= CL_QUEUE_PROFILING_ENABLE;
+      }
+
       cl_int error;
       cl_command_queue queue = clCreateCommandQueue(context, deviceId, props, &error);
       handleError(error);
@@ -58,13 +95,74 @@ namespace sunstorm
       return queue;
     }
     
-    ComputeProgram* ComputeHandler::createProgram(std::string filepath)
+    const std::vector<ComputeDevice>& ComputeHandler::createDeviceQueues(cl_command_queue_properties props)
     {
-      ComputeProgram* program = new ComputeProgram(filepath, io::readFile(filepath));
+      if (!devices.empty()) {
+        return devices;
+      }
+
+      if (Profiler::global) {
+        props |= CL_QUEUE_PROFILING_ENABLE;
+      }
+
+      for (cl_platform_id platform : getPlatforms()) {
+        cl_uint count = 0;
+        if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &count) != CL_SUCCESS) {
+          continue;
+        }
+        std::vector<cl_device_id> ids(count);
+        handleError(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, count, ids.data(), NULL));
+
+        for (cl_device_id id : ids) {
+          ComputeDevice device = {};
+          device.platform = platform;
+          device.device = id;
+          device.name = getDeviceString(id, CL_DEVICE_NAME);
+          handleError(clGetDeviceInfo(id, CL_DEVICE_TYPE, sizeof(cl_device_type), &device.type, NULL));
+
+          cl_int error;
+          if (id == deviceId) {
+            device.context = context;
+          } else {
+            cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) platform, 0 };
+            device.context = clCreateContext(properties, 1, &id, NULL, NULL, &error);
+            handleError(error);
+            deviceContexts.push_back(device.context);
+          }
+
+          device.queue = clCreateCommandQueue(device.context, id, props, &error);
+          handleError(error);
+          queues.push_back(device.queue);
+
+          devices.push_back(device);
+          SSRT_DBG_OUTPUT("Found compute device: " << device.name);
+        }
+      }
+
+      return devices;
+    }
+
+    ComputeProgram* ComputeHandler::createProgram(std::string filepath, std::string options, const ComputeDevice* device)
+    {
+      ComputeProgram* program = new ComputeProgram(filepath, io::readFile(filepath), options, device);
       programs.push_back(program);
       return program;
     }
     
+    bool ComputeHandler::hasExtension(std::string name) const
+    {
+      // padded so a name cannot match as a prefix of a longer extension
+      std::string extensions = " " + getDeviceString(deviceId, CL_DEVICE_EXTENSIONS) + " ";
+      return extensions.find(" " + name + " ") != std::string::npos;
+    }
+
+    cl_uint ComputeHandler::getComputeUnits() const
+    {
+      cl_uint units = 0;
+      handleError(clGetDeviceInfo(deviceId, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &units, NULL));
+      return std::max(1u, units);
+    }
+
     void ComputeHandler::handleError(cl_int errorId)
     {
       if (errorId != CL_SUCCESS) {
@@ -72,6 +170,21 @@ namespace sunstorm
       }
     }
 
+    std::string getDeviceString(cl_device_id device, cl_device_info param)
+    {
+      size_t size = 0;
+      ComputeHandler::handleError(clGetDeviceInfo(device, param, 0, NULL, &size));
+
+      std::string value(size, '\0');
+      ComputeHandler::handleError(clGetDeviceInfo(device, param, size, value.data(), NULL));
+
+      // drops the null terminator included in the reported size
+      while (!value.empty() && value.back() == '\0') {
+        value.pop_back();
+      }
+      return value;
+    }
+
     const char* getErrorString(cl_int error) 
     {
       switch(error)
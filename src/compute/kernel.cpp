@@ -1,6 +1,8 @@
 
 #include "compute.h"
 
+#include <algorithm>
+
 namespace sunstorm
 {
   namespace cmp
@@ -24,10 +26,10 @@ namespace sunstorm
       SSRT_DBG_OUTPUT("Destroyed Compute Kernel: " << name);
     }
     
-    cl_mem ComputeKernel::createBuffer(cl_uint index, cl_mem_flags flags, size_t size)
+    cl_mem ComputeKernel::createBuffer(cl_uint index, cl_mem_flags flags, size_t size, void* data)
     {
       cl_int error;
-      cl_mem memory = clCreateBuffer(ComputeHandler::global->getContext(), flags, size, nullptr, &error);
+      cl_mem memory = clCreateBuffer(ComputeHandler::global->getContext(), flags, size, data, &error);
       ComputeHandler::handleError(error);
       setMemoryArg(index, memory);
       memoryObjects.push_back(memory);
@@ -74,10 +76,39 @@ namespace sunstorm
       return buf;
     }
     
+    void ComputeKernel::releaseMemory(cl_mem memory)
+    {
+      std::vector<cl_mem>::iterator it = std::find(memoryObjects.begin(), memoryObjects.end(), memory);
+      if (it != memoryObjects.end()) {
+        memoryObjects.erase(it);
+        ComputeHandler::handleError(clReleaseMemObject(memory));
+      }
+    }
+    
     void ComputeKernel::setMemoryArg(cl_uint position, cl_mem memory)
     {
       cl_int error = clSetKernelArg(kernelId, position, sizeof(cl_mem), &memory);
       ComputeHandler::handleError(error);
     }
+
+    void ComputeKernel::enqueue(cl_command_queue queue, cl_uint dims, const size_t* globalOffset, const size_t* globalSize, const size_t* localSize,
+      cl_uint waitCount, const cl_event* waitList, cl_event* event) const
+    {
+      // an event is only created when someone needs it
+      cl_event launch = NULL;
+      bool profiled = Profiler::global != nullptr;
+      cl_int error = clEnqueueNDRangeKernel(queue, kernelId, dims, globalOffset, globalSize, localSize, waitCount, waitList, (event || profiled) ? &launch : NULL);
+      ComputeHandler::handleError(error);
+
+      if (profiled) {
+        Profiler::global->record(name, launch);
+      }
+
+      if (event) {
+        *event = launch;
+      } else if (launch) {
+        clReleaseEvent(launch);
+      }
+    }
   }
 }
\ No newline at end of file
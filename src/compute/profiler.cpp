@@ -0,0 +1,182 @@
+#include "compute.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace sunstorm
+{
+  namespace cmp
+  {
+    // bounds the number of retained events in long interactive runs
+    static const size_t PROFILER_MAX_PENDING = 1024;
+
+    static const char* PROFILE_PHASES[] = { "queued", "submitted", "executed", "total" };
+
+    static const std::vector<cl_ulong>& getPhase(const ProfileSamples& samples, int phase)
+    {
+      switch (phase) {
+        case 0: return samples.queued;
+        case 1: return samples.submitted;
+        case 2: return samples.executed;
+        default: return samples.total;
+      }
+    }
+
+    Profiler* Profiler::global;
+
+    Profiler::Profiler()
+    {
+      // singleton presence check
+      if (global) {
+        throw std::runtime_error("Global profiler instance already exists!");
+      }
+
+      global = this;
+      SSRT_DBG_OUTPUT("Created Profiler");
+    }
+
+    Profiler::~Profiler()
+    {
+      for (size_t i = 0; i < pending.size(); i++) {
+        clReleaseEvent(pending[i].second);
+      }
+
+      global = nullptr;
+      SSRT_DBG_OUTPUT("Destroyed Profiler");
+    }
+
+    void Profiler::record(const std::string& name, cl_event event)
+    {
+      ComputeHandler::handleError(clRetainEvent(event));
+      pending.push_back({ name, event });
+
+      // never waits here, that would stall the frame being measured
+      if (pending.size() >= PROFILER_MAX_PENDING) {
+        collect(false);
+      }
+    }
+
+    void Profiler::collect(bool wait)
+    {
+      size_t kept = 0;
+      for (size_t i = 0; i < pending.size(); i++) {
+        cl_event event = pending[i].second;
+        cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+
+        // failed commands report a negative status, they are released below like finished ones
+        cl_int status = CL_COMPLETE;
+        cl_int error = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+        if (!wait && error == CL_SUCCESS && status > CL_COMPLETE) {
+          pending[kept++] = pending[i];
+          continue;
+        }
+
+        // events from queues without profiling report CL_PROFILING_INFO_NOT_AVAILABLE and are skipped
+        if (error == CL_SUCCESS) error = clWaitForEvents(1, &event);
+        if (error == CL_SUCCESS) error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+        if (error == CL_SUCCESS) error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL);
+        if (error == CL_SUCCESS) error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+        if (error == CL_SUCCESS) error = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+        clReleaseEvent(event);
+
+        if (error != CL_SUCCESS) {
+          continue;
+        }
+
+        // some drivers report equal or slightly out of order timestamps for short commands
+        submit = std::max(submit, queued);
+        start = std::max(start, submit);
+        end = std::max(end, start);
+
+        ProfileSamples& s = samples[pending[i].first];
+        s.queued.push_back(submit - queued);
+        s.submitted.push_back(start - submit);
+        s.executed.push_back(end - start);
+        s.total.push_back(end - queued);
+      }
+      pending.resize(kept);
+    }
+
+    ProfileStats Profiler::computeStats(std::vector<cl_ulong> intervals)
+    {
+      ProfileStats stats = {};
+      stats.count = intervals.size();
+      if (intervals.empty()) {
+        return stats;
+      }
+
+      std::sort(intervals.begin(), intervals.end());
+      size_t n = intervals.size();
+
+      // nearest-rank percentiles
+      stats.min = intervals.front() / 1000.0;
+      stats.median = intervals[(n - 1) / 2] / 1000.0;
+      stats.p99 = intervals[std::min(n - 1, (n * 99 + 99) / 100 - 1)] / 1000.0;
+      stats.max = intervals.back() / 1000.0;
+      return stats;
+    }
+
+    void Profiler::print(std::ostream& output)
+    {
+      collect();
+
+      output << "Kernel profile (execution time in us):" << std::endl;
+      for (const auto& [name, s] : samples) {
+        ProfileStats executed = computeStats(s.executed);
+        ProfileStats queued = computeStats(s.queued);
+        output << "  " << name << ": " << executed.count << " launches, min " << executed.min << ", median " << executed.median
+               << ", p99 " << executed.p99 << ", max " << executed.max << " (median queued " << queued.median << ")" << std::endl;
+      }
+    }
+
+    bool Profiler::save(std::string filepath)
+    {
+      collect();
+
+      std::ofstream output(filepath);
+      if (!output.is_open()) {
+        std::cerr << "[Error] Failed to write profile: " << filepath << "!" << std::endl;
+        return false;
+      }
+
+      output << std::fixed << std::setprecision(3);
+      bool json = std::filesystem::path(filepath).extension() == ".json";
+
+      if (json) {
+        output << "{" << std::endl << "  \"unit\": \"us\"," << std::endl << "  \"kernels\": [";
+      } else {
+        output << "name,phase,count,min_us,median_us,p99_us,max_us" << std::endl;
+      }
+
+      bool first = true;
+      for (const auto& [name, s] : samples) {
+        if (json) {
+          output << (first ? "" : ",") << std::endl << "    { \"name\": \"" << name << "\", \"count\": " << s.total.size();
+        }
+
+        for (int phase = 0; phase < 4; phase++) {
+          ProfileStats stats = computeStats(getPhase(s, phase));
+          if (json) {
+            output << ", \"" << PROFILE_PHASES[phase] << "\": { \"min\": " << stats.min << ", \"median\": " << stats.median
+                   << ", \"p99\": " << stats.p99 << ", \"max\": " << stats.max << " }";
+          } else {
+            output << name << "," << PROFILE_PHASES[phase] << "," << stats.count << "," << stats.min << ","
+                   << stats.median << "," << stats.p99 << "," << stats.max << std::endl;
+          }
+        }
+
+        if (json) {
+          output << " }";
+        }
+        first = false;
+      }
+
+      if (json) {
+        output << std::endl << "  ]" << std::endl << "}" << std::endl;
+      }
+
+      SSRT_DBG_OUTPUT("Wrote profile to: " << filepath);
+      return output.good();
+    }
+  }
+}
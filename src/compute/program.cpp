@@ -5,24 +5,168 @@ namespace sunstorm
 {
   namespace cmp
   {
-    ComputeProgram::ComputeProgram(std::string name, std::string source) : name(name)
+    static const char CACHE_MAGIC[8] = { 'S', 'S', 'C', 'L', 'B', 'I', 'N', '1' };
+
+    ComputeProgram::ComputeProgram(std::string name, std::string source, std::string options, const ComputeDevice* target) 
+      : name(name), options(options)
     {
+      device = target ? target->device : ComputeHandler::global->getDevice();
+      context = target ? target->context : ComputeHandler::global->getContext();
+
+      // any change to the inputs of the compiler produces a different key
+      std::string key = "source=" + io::toHex(io::hashBytes(source.data(), source.size()))
+        + "\ndevice=" + getDeviceString(device, CL_DEVICE_NAME)
+        + "\nversion=" + getDeviceString(device, CL_DEVICE_VERSION)
+        + "\ndriver=" + getDeviceString(device, CL_DRIVER_VERSION)
+        + "\noptions=" + options;
+
+      std::string stem = std::filesystem::path(name).filename().string();
+      std::string variant = io::toHex(io::hashBytes(options.data(), options.size())).substr(0, 8);
+      // the device is part of the name so each device's entries are pruned apart from the others'
+      std::string deviceId = getDeviceString(device, CL_DEVICE_NAME) + "\n" + getDeviceString(device, CL_DRIVER_VERSION);
+      std::string deviceHash = io::toHex(io::hashBytes(deviceId.data(), deviceId.size())).substr(0, 8);
+      std::string path = CACHE_DIR + "cl/" + stem + "-" + variant + "-" + deviceHash + "-" + io::toHex(io::hashBytes(key.data(), key.size())) + ".bin";
+
+      if (loadBinary(path, key)) {
+        SSRT_DBG_OUTPUT("Loaded Compute Program from cache: " << name);
+        return;
+      }
+
       cl_int error;
       const char* cSource = source.c_str();
-      programId = clCreateProgramWithSource(ComputeHandler::global->getContext(), 1, &cSource, NULL, &error);
+      programId = clCreateProgramWithSource(context, 1, &cSource, NULL, &error);
       ComputeHandler::handleError(error);
       build();
+      saveBinary(path, key);
       SSRT_DBG_OUTPUT("Created Compute Program: " << name);
     }
 
+    bool ComputeProgram::loadBinary(const std::string& path, const std::string& key)
+    {
+      std::ifstream input(path, std::ios::binary);
+      if (!input.is_open()) {
+        return false;
+      }
+
+      std::error_code ec;
+      unsigned long long fileSize = std::filesystem::file_size(path, ec);
+
+      char magic[sizeof(CACHE_MAGIC)];
+      unsigned int keySize = 0;
+      unsigned long long binarySize = 0;
+
+      // sizes are checked against the file so a truncated entry cannot cause a huge allocation
+      input.read(magic, sizeof(magic));
+      input.read((char*) &keySize, sizeof(keySize));
+      std::string storedKey(input && keySize <= fileSize ? keySize : 0, '\0');
+      input.read(storedKey.data(), storedKey.size());
+      input.read((char*) &binarySize, sizeof(binarySize));
+      std::vector<unsigned char> binary(input && binarySize <= fileSize ? binarySize : 0);
+      input.read((char*) binary.data(), binary.size());
+
+      bool valid = input && std::equal(magic, magic + sizeof(magic), CACHE_MAGIC) && storedKey == key && !binary.empty();
+      input.close();
+
+      const unsigned char* data = binary.data();
+      size_t size = binary.size();
+      cl_int status = CL_SUCCESS;
+      cl_int error = CL_INVALID_BINARY;
+
+      if (valid) {
+        programId = clCreateProgramWithBinary(context, 1, &device, &size, &data, &status, &error);
+
+        // drivers may still reject a binary they produced, e.g. after a silent update
+        if (error == CL_SUCCESS && status == CL_SUCCESS) {
+          error = clBuildProgram(programId, 1, &device, options.c_str(), NULL, NULL);
+          if (error != CL_SUCCESS) {
+            clReleaseProgram(programId);
+          }
+        } else if (error == CL_SUCCESS) {
+          clReleaseProgram(programId);
+          error = status;
+        }
+      }
+
+      if (!valid || error != CL_SUCCESS) {
+        SSRT_DBG_OUTPUT("Discarding stale program cache: " << path);
+        std::filesystem::remove(path, ec);
+        return false;
+      }
+
+      return true;
+    }
+
+    void ComputeProgram::saveBinary(const std::string& path, const std::string& key) const
+    {
+      size_t binarySize = 0;
+      cl_int error = clGetProgramInfo(programId, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, NULL);
+      if (error != CL_SUCCESS || binarySize == 0) {
+        return;
+      }
+
+      std::vector<unsigned char> binary(binarySize);
+      unsigned char* data = binary.data();
+      if (clGetProgramInfo(programId, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &data, NULL) != CL_SUCCESS) {
+        return;
+      }
+
+      // entries for older versions of the same program, options and device can never be hit again, nor can
+      // temporary files left by a crashed write, which are given a minute so live writes are not cut short
+      std::filesystem::path file = std::filesystem::path(path);
+      std::string prefix = file.filename().string().substr(0, file.filename().string().rfind('-') + 1);
+      std::filesystem::file_time_type now = std::filesystem::file_time_type::clock::now();
+      std::error_code ec;
+      std::filesystem::create_directories(file.parent_path(), ec);
+      for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(file.parent_path(), ec)) {
+        std::string filename = entry.path().filename().string();
+        if (!filename.starts_with(prefix)) {
+          continue;
+        }
+
+        bool orphan = false;
+        if (filename.find(".bin.tmp") != std::string::npos) {
+          std::filesystem::file_time_type written = entry.last_write_time(ec);
+          orphan = !ec && now - written > std::chrono::minutes(1);
+        }
+
+        if (entry.path().extension() == ".bin" || orphan) {
+          std::filesystem::remove(entry.path(), ec);
+        }
+      }
+
+      // written to a temporary file first so concurrent workers never read a partial entry, unique per thread
+      // as well as per call since several workers may build the same program at once
+      std::string temp = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+        + "-" + std::to_string(time::getTimeMicroseconds());
+      std::ofstream output(temp, std::ios::binary);
+      if (!output.is_open()) {
+        std::cerr << "[Error] Failed to write program cache: " << path << "!" << std::endl;
+        return;
+      }
+
+      unsigned int keySize = (unsigned int) key.size();
+      unsigned long long size = binarySize;
+      output.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+      output.write((const char*) &keySize, sizeof(keySize));
+      output.write(key.data(), key.size());
+      output.write((const char*) &size, sizeof(size));
+      output.write((const char*) binary.data(), binary.size());
+      output.close();
+
+      std::filesystem::rename(temp, path, ec);
+      if (ec) {
+        std::filesystem::remove(temp, ec);
+      }
+    }
+
     void ComputeProgram::build() const 
     {
-      cl_int error = clBuildProgram(programId, 0, NULL, NULL, NULL, NULL);
+      cl_int error = clBuildProgram(programId, 0, NULL, options.c_str(), NULL, NULL);
 
       // prints build info log on failure.
       if (error != CL_SUCCESS) {
         char log[10000];
-        clGetProgramBuildInfo(programId, ComputeHandler::global->getDevice(), CL_PROGRAM_BUILD_LOG, 10000 * sizeof(char), log, NULL);
+        clGetProgramBuildInfo(programId, device, CL_PROGRAM_BUILD_LOG, 10000 * sizeof(char), log, NULL);
         std::cerr << "Failed to compile compute program (" << std::string(name) <<")" << std::endl << std::string(log) << std::endl;
       }
       
@@ -0,0 +1,92 @@
+#include "graphics.h"
+
+namespace sunstorm
+{
+  namespace gfx
+  {
+    void bindInstanceTransforms(GLuint bufferId, size_t first)
+    {
+      // a mat4 attribute is four vec4 columns, each advancing once per instance
+      glBindBuffer(GL_ARRAY_BUFFER, bufferId);
+      for (GLuint column = 0; column < 4; column++) {
+        GLuint location = INSTANCE_TRANSFORM_LOCATION + column;
+        size_t offset = first * sizeof(glm::mat4) + column * sizeof(glm::vec4);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (const void*) offset);
+        glVertexAttribDivisor(location, 1);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    BatchRenderer::BatchRenderer() : instanceCapacity(0), batchCount(0), drawCalls(0), instanceCount(0)
+    {
+      glGenBuffers(1, &instanceBufferId);
+      SSRT_DBG_OUTPUT("Created Batch Renderer");
+    }
+
+    BatchRenderer::~BatchRenderer()
+    {
+      glDeleteBuffers(1, &instanceBufferId);
+      SSRT_DBG_OUTPUT("Destroyed Batch Renderer");
+    }
+
+    void BatchRenderer::submit(const Mesh* mesh, const glm::mat4& transformation)
+    {
+      auto it = batchIndices.find(mesh);
+      if (it == batchIndices.end()) {
+        // slots of earlier frames are reused so their transform storage is too
+        if (batchCount == batches.size()) {
+          batches.push_back({ nullptr, {} });
+        }
+        batches[batchCount].mesh = mesh;
+        it = batchIndices.emplace(mesh, batchCount++).first;
+      }
+      batches[it->second].transforms.push_back(transformation);
+    }
+
+    void BatchRenderer::flush()
+    {
+      drawCalls = 0;
+      instanceCount = 0;
+
+      // groups are laid out back to back so each draw reads one contiguous range
+      instances.clear();
+      for (size_t i = 0; i < batchCount; i++) {
+        const Batch& batch = batches[i];
+        instances.insert(instances.end(), batch.transforms.begin(), batch.transforms.end());
+      }
+
+      if (instances.empty()) {
+        return;
+      }
+
+      // orphaning lets the driver hand out fresh storage while last frame's draws still read the old
+      size_t bytes = instances.size() * sizeof(glm::mat4);
+      glBindBuffer(GL_ARRAY_BUFFER, instanceBufferId);
+      if (instances.size() > instanceCapacity) {
+        instanceCapacity = instances.size() + instances.size() / 2;
+      }
+      glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (instanceCapacity * sizeof(glm::mat4)), nullptr, GL_STREAM_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr) bytes, instances.data());
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      size_t first = 0;
+      for (size_t i = 0; i < batchCount; i++) {
+        Batch& batch = batches[i];
+        batch.mesh->bindMesh();
+        bindInstanceTransforms(instanceBufferId, first);
+        glDrawElementsInstanced(GL_TRIANGLES, batch.mesh->getVertexCount(), batch.mesh->getIndexType(), 0, (GLsizei) batch.transforms.size());
+        batch.mesh->unbindMesh();
+
+        first += batch.transforms.size();
+        drawCalls++;
+        batch.transforms.clear();
+      }
+      instanceCount = first;
+
+      // meshes may be deleted between frames, so the grouping only lives for one flush
+      batchCount = 0;
+      batchIndices.clear();
+    }
+  }
+}
@@ -0,0 +1,171 @@
+#include "graphics.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sunstorm
+{
+  namespace gfx
+  {
+    // ----- Frustum ----- //
+
+    Frustum::Frustum(const glm::mat4& clip)
+    {
+      // Gribb-Hartmann, each plane is the w row plus or minus an x, y or z row of the matrix
+      for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+          float sign = side == 0 ? 1.0f : -1.0f;
+          float* plane = planes[axis * 2 + side];
+
+          for (int column = 0; column < 4; column++) {
+            plane[column] = clip[column][3] + sign * clip[column][axis];
+          }
+
+          // normalized so the box test compares true distances
+          float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+          for (int i = 0; i < 4; i++) {
+            plane[i] /= length;
+          }
+        }
+      }
+    }
+
+    Containment Frustum::classify(const glm::vec3& min, const glm::vec3& max) const
+    {
+      glm::vec3 center = (min + max) * 0.5f;
+      glm::vec3 extent = (max - min) * 0.5f;
+      Containment result = Containment::Inside;
+
+      for (int p = 0; p < 6; p++) {
+        const float* plane = planes[p];
+        float distance = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3];
+        float radius = std::fabs(plane[0]) * extent.x + std::fabs(plane[1]) * extent.y + std::fabs(plane[2]) * extent.z;
+
+        if (distance + radius < 0.0f) {
+          return Containment::Outside;
+        }
+        if (distance - radius < 0.0f) {
+          result = Containment::Intersecting;
+        }
+      }
+      return result;
+    }
+
+    // ----- Scene BVH ----- //
+
+    SceneBVH::SceneBVH(unsigned int leafSize) : leafSize(std::max(leafSize, 1u)), testedBoxes(0)
+    {
+    }
+
+    unsigned int SceneBVH::buildNode(unsigned int first, unsigned int count, const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs)
+    {
+      unsigned int index = (unsigned int) nodes.size();
+      nodes.push_back({});
+
+      Node node = {};
+      node.min = glm::vec3(INFINITY);
+      node.max = glm::vec3(-INFINITY);
+      node.first = first;
+      node.count = count;
+
+      glm::vec3 centroidMin = glm::vec3(INFINITY);
+      glm::vec3 centroidMax = glm::vec3(-INFINITY);
+      for (unsigned int i = first; i < first + count; i++) {
+        unsigned int id = objects[i];
+        node.min = glm::min(node.min, mins[id]);
+        node.max = glm::max(node.max, maxs[id]);
+        centroidMin = glm::min(centroidMin, (mins[id] + maxs[id]) * 0.5f);
+        centroidMax = glm::max(centroidMax, (mins[id] + maxs[id]) * 0.5f);
+      }
+
+      if (count > leafSize) {
+        // median split keeps the tree balanced, which is what a traversal that mostly rejects whole subtrees wants
+        glm::vec3 spread = centroidMax - centroidMin;
+        int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+        unsigned int half = count / 2;
+
+        std::nth_element(objects.begin() + first, objects.begin() + first + half, objects.begin() + first + count, 
+          [&](unsigned int a, unsigned int b) { return mins[a][axis] + maxs[a][axis] < mins[b][axis] + maxs[b][axis]; });
+
+        buildNode(first, half, mins, maxs);
+        node.right = buildNode(first + half, count - half, mins, maxs);
+      }
+
+      nodes[index] = node;
+      return index;
+    }
+
+    void SceneBVH::build(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs)
+    {
+      nodes.clear();
+      objects.resize(mins.size());
+      for (unsigned int i = 0; i < objects.size(); i++) {
+        objects[i] = i;
+      }
+
+      if (!objects.empty()) {
+        buildNode(0, (unsigned int) objects.size(), mins, maxs);
+      }
+
+      // bounds are stored in leaf order so each leaf is one contiguous packet run
+      boxes = simd::Boxes();
+      for (unsigned int id : objects) {
+        boxes.add(&mins[id][0], &maxs[id][0]);
+      }
+      flags.resize(objects.size());
+
+      SSRT_DBG_OUTPUT("Built scene BVH: " << objects.size() << " objects, " << nodes.size() << " nodes");
+    }
+
+    void SceneBVH::cull(const Frustum& frustum, std::vector<unsigned int>& visible)
+    {
+      visible.clear();
+      testedBoxes = 0;
+      if (nodes.empty()) {
+        return;
+      }
+
+      simd::PrimitiveArrays arrays = boxes.getArrays();
+      stack.clear();
+      stack.push_back(0);
+
+      while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        unsigned int index = stack.back();
+        stack.pop_back();
+
+        Containment containment = frustum.classify(node.min, node.max);
+        if (containment == Containment::Outside) {
+          continue;
+        }
+
+        if (containment == Containment::Inside) {
+          visible.insert(visible.end(), objects.begin() + node.first, objects.begin() + node.first + node.count);
+          continue;
+        }
+
+        if (node.right) {
+          stack.push_back(node.right);
+          stack.push_back(index + 1);
+          continue;
+        }
+
+        // a straddling leaf tests its objects in packets
+        simd::PrimitiveArrays leaf = arrays;
+        for (int k = 0; k < 6; k++) {
+          leaf.data[k] = arrays.data[k] + node.first;
+        }
+        leaf.count = node.count;
+
+        intersector.cull(leaf, frustum.getPlanes(), 6, flags.data() + node.first);
+        testedBoxes += node.count;
+
+        for (unsigned int i = node.first; i < node.first + node.count; i++) {
+          if (flags[i]) {
+            visible.push_back(objects[i]);
+          }
+        }
+      }
+    }
+  }
+}
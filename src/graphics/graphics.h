@@ -12,9 +12,11 @@
 #include <map>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "../common.h"
+#include "../simd/simd.h"
 
 namespace sunstorm
 {
@@ -120,21 +122,36 @@ namespace sunstorm
       static void resizeCallback(GLFWwindow* window, int width, int height);
     };
     
+    /**
+     * Location of a uniform resolved when the program was linked, setting a
+     * uniform through a handle does no lookup.
+     */
+    struct UniformHandle
+    {
+      GLint location;
+    };
+
     class Shader
     {
     private:
       GLuint programId;
       std::string name;
       std::vector<GLuint> shaders;
-      std::map<std::string, GLuint> uniformLocations;
+      std::map<std::string, GLint> uniformLocations;
 
       /**
        * @brief Get the Uniform location of uniform from map.
        * 
        * @param name Name of uniform
-       * @return GLuint 
+       * @return GLint 
+       */
+      GLint getUniformLocation(const std::string& name) const;
+
+      /**
+       * @brief Stores the location of every active uniform outside a uniform
+       *    block, called once the program links.
        */
-      GLuint getUniformLocation(std::string name);
+      void cacheUniforms();
 
     public:
       /**
@@ -149,9 +166,9 @@ namespace sunstorm
 
       /**
        * @brief Builds program by linking subshaders and validating
-       *  the shader program.
+       *  the shader program, then caches the active uniform locations.
        */
-      void buildProgram() const;
+      void buildProgram();
 
       /**
        * @brief Create, compile and attache sub-shader to shader program.
@@ -172,19 +189,39 @@ namespace sunstorm
       void unbindProgram() const;
 
       /**
-       * @brief Get the location of uniform by name and store it in map.
+       * @brief Get the location of uniform by name and store it in map, only
+       *    needed for uniforms the linker did not report as active.
        * 
        * @param name Uniform name
        */
       void getUniform(std::string name);
 
+      /**
+       * @brief Get the handle of a uniform, resolve handles once after
+       *    building and keep them for the per-frame setters.
+       * 
+       * @param name Uniform name
+       * @return UniformHandle 
+       */
+      UniformHandle getUniformHandle(const std::string& name) const;
+
+      /**
+       * @brief Connects a uniform block to a uniform buffer binding point,
+       *    buffers bound to that point by range then feed the block.
+       * 
+       * @param block Uniform block name
+       * @param binding Binding point index
+       */
+      void bindUniformBlock(const std::string& block, GLuint binding) const;
+
       /**
        * @brief Set the value of a Uniform Int.
        * 
        * @param name 
        * @param i Int
        */
-      void setUniformInt(std::string name, int i);
+      void setUniformInt(const std::string& name, int i);
+      void setUniformInt(UniformHandle handle, int i) const;
 
       /**
        * @brief Set the value of a Uniform Float.
@@ -192,7 +229,8 @@ namespace sunstorm
        * @param name 
        * @param f Float
        */
-      void setUniformFloat(std::string name, float f);
+      void setUniformFloat(const std::string& name, float f);
+      void setUniformFloat(UniformHandle handle, float f) const;
       
       /**
        * @brief Set the value of a Uniform Vector2.
@@ -200,7 +238,8 @@ namespace sunstorm
        * @param name 
        * @param v GLM vector 2
        */
-      void setUniformVector2(std::string name, glm::vec2 v);
+      void setUniformVector2(const std::string& name, const glm::vec2& v);
+      void setUniformVector2(UniformHandle handle, const glm::vec2& v) const;
       
       /**
        * @brief Set the value of a Uniform Vector3.
@@ -208,7 +247,8 @@ namespace sunstorm
        * @param name 
        * @param v GLM vector 3
        */
-      void setUniformVector3(std::string name, glm::vec3 v);
+      void setUniformVector3(const std::string& name, const glm::vec3& v);
+      void setUniformVector3(UniformHandle handle, const glm::vec3& v) const;
       
       /**
        * @brief Set the value of a Uniform Vector4.
@@ -216,7 +256,8 @@ namespace sunstorm
        * @param name 
        * @param v GLM vector 4
        */
-      void setUniformVector4(std::string name, glm::vec4 v);
+      void setUniformVector4(const std::string& name, const glm::vec4& v);
+      void setUniformVector4(UniformHandle handle, const glm::vec4& v) const;
       
       /**
        * @brief Set the value of a Uniform Matrix4x4.
@@ -224,7 +265,8 @@ namespace sunstorm
        * @param name 
        * @param m GLM matrix 4x4
        */
-      void setUniformMatrix4x4(std::string name, glm::mat4 m);
+      void setUniformMatrix4x4(const std::string& name, const glm::mat4& m);
+      void setUniformMatrix4x4(UniformHandle handle, const glm::mat4& m) const;
       
       /**
        * @brief Set the Uniform Texture sampler to active texture location.
@@ -232,7 +274,116 @@ namespace sunstorm
        * @param name
        * @param textureLocation Index of active texture bound
        */
-      void setUniformTexture(std::string name, int textureLocation);
+      void setUniformTexture(const std::string& name, int textureLocation);
+      void setUniformTexture(UniformHandle handle, int textureLocation) const;
+    };
+
+    /**
+     * std140 layout of the Camera block in res/glsl/instanced_vert.glsl.
+     */
+    struct CameraUniforms
+    {
+      glm::mat4 projection;
+      glm::mat4 view;
+    };
+
+    class UniformRing
+    {
+    private:
+      GLuint bufferId;
+      unsigned char* mapped;
+      size_t alignment;
+      size_t frameSize;
+      size_t head;
+      unsigned int frames;
+      unsigned long long frame;
+      std::vector<GLsync> fences;
+
+    public:
+      /**
+       * @brief Construct a new Uniform Ring buffer, a uniform buffer split
+       *    into one region per frame in flight that per-draw blocks are
+       *    appended to and bound by range.
+       * 
+       * @param frameSize Bytes available to each frame
+       * @param frames Number of frames the GPU may lag behind
+       */
+      UniformRing(size_t frameSize = 1 << 16, unsigned int frames = 3);
+
+      /**
+       * @brief Destroy the Uniform Ring buffer and its fences.
+       */
+      ~UniformRing();
+
+      UniformRing(const UniformRing&) = delete;
+      UniformRing& operator=(const UniformRing&) = delete;
+
+      /**
+       * @brief Moves to the next frame region, waiting only if the GPU is
+       *    still reading it from frames ago.
+       */
+      void beginFrame();
+
+      /**
+       * @brief Fences the current frame region once its draws are submitted.
+       */
+      void endFrame();
+
+      /**
+       * @brief Appends a block to the current frame region.
+       * 
+       * @param data Block data in std140 layout
+       * @param size Size of the block in bytes
+       * @return size_t Offset of the block in the buffer
+       */
+      size_t write(const void* data, size_t size);
+
+      /**
+       * @brief Appends a block to the current frame region.
+       * 
+       * @param block Block in std140 layout
+       * @return size_t Offset of the block in the buffer
+       */
+      template <typename T>
+      inline size_t write(const T& block) {
+        return write(&block, sizeof(T));
+      }
+
+      /**
+       * @brief Binds a range of the buffer to a uniform buffer binding point.
+       * 
+       * @param binding Binding point index
+       * @param offset Offset returned by write
+       * @param size Size of the block in bytes
+       */
+      void bindRange(GLuint binding, size_t offset, size_t size) const;
+
+      /**
+       * @brief Get the Buffer Id
+       * 
+       * @return GLuint 
+       */
+      inline GLuint getBufferId() const {
+        return bufferId;
+      }
+
+      /**
+       * @brief Get the bytes written in the current frame
+       * 
+       * @return size_t 
+       */
+      inline size_t getUsedBytes() const {
+        return head;
+      }
+    };
+
+    struct VertexAttribute
+    {
+      GLuint pos;
+      GLint dim;
+      GLenum type;
+      GLboolean normalized;
+      size_t offset;
     };
 
     class Mesh
@@ -240,9 +391,12 @@ namespace sunstorm
     private:
       GLuint vaoId;
       GLuint elementBufferId;
+      GLenum indexType;
       int vertexCount;
       std::string name;
       std::vector<GLuint> vbos;
+      glm::vec3 boundsMin;
+      glm::vec3 boundsMax;
 
     public:
       /**
@@ -281,12 +435,32 @@ namespace sunstorm
        */
       void createVertexBuffer(int pos, int dim, GLfloat* data, GLsizeiptr size);
 
+      /**
+       * @brief Create a single Vertex Buffer object holding interleaved
+       *    vertices and binds each attribute to its offset in the stride.
+       * 
+       * @param data Vertex data, can point into a memory mapped file
+       * @param size Size of the vertex data in bytes
+       * @param stride Bytes between consecutive vertices
+       * @param attributes Attribute layout of one vertex
+       */
+      void createInterleavedBuffer(const void* data, GLsizeiptr size, GLsizei stride, const std::vector<VertexAttribute>& attributes);
+
       /**
        * @brief Create an Element Buffer object.
        * 
        * @param data Element indices
        */
-      void createElementBuffer(GLuint* data);
+      void createElementBuffer(const GLuint* data);
+
+      /**
+       * @brief Create an Element Buffer object with indices of any width, 16-bit
+       *    indices halve the index fetch of meshes under 65536 vertices.
+       * 
+       * @param data Element indices (can be nullptr)
+       * @param type GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+       */
+      void createElementBuffer(const void* data, GLenum type);
 
       /**
        * @brief Get the Element Buffer Id
@@ -296,6 +470,25 @@ namespace sunstorm
       inline GLuint getElementBufferId() const {
         return elementBufferId;
       }
+
+      /**
+       * @brief Get the Index Type to pass to the draw calls
+       * 
+       * @return GLenum 
+       */
+      inline GLenum getIndexType() const {
+        return indexType;
+      }
+
+      /**
+       * @brief Get a Vertex Buffer Id by creation order
+       * 
+       * @param i Index in vertex buffers
+       * @return GLuint 
+       */
+      inline GLuint getVertexBufferId(size_t i) const {
+        return vbos[i];
+      }
     
       /**
        * @brief Set the Vertex Count
@@ -314,6 +507,35 @@ namespace sunstorm
       inline int getVertexCount() const {
         return vertexCount;
       }
+
+      /**
+       * @brief Set the object space bounds, computed when the mesh is loaded
+       * 
+       * @param min Minimum corner
+       * @param max Maximum corner
+       */
+      inline void setBounds(const glm::vec3& min, const glm::vec3& max) {
+        boundsMin = min;
+        boundsMax = max;
+      }
+
+      /**
+       * @brief Get the minimum corner of the object space bounds
+       * 
+       * @return const glm::vec3& 
+       */
+      inline const glm::vec3& getBoundsMin() const {
+        return boundsMin;
+      }
+
+      /**
+       * @brief Get the maximum corner of the object space bounds
+       * 
+       * @return const glm::vec3& 
+       */
+      inline const glm::vec3& getBoundsMax() const {
+        return boundsMax;
+      }
     };
 
     class Texture
@@ -561,5 +783,209 @@ namespace sunstorm
         return height;
       }
     };
+
+    // first of the four consecutive vec4 locations an instance transform occupies
+    static const GLuint INSTANCE_TRANSFORM_LOCATION = 3;
+
+    /**
+     * @brief Points the instance transform attributes of the bound vertex
+     *    array at a buffer of tightly packed model matrices.
+     * 
+     * @param bufferId Buffer holding one mat4 per instance
+     * @param first Index of the first instance to read
+     */
+    void bindInstanceTransforms(GLuint bufferId, size_t first);
+
+    class BatchRenderer
+    {
+    private:
+      struct Batch
+      {
+        const Mesh* mesh;
+        std::vector<glm::mat4> transforms;
+      };
+
+      GLuint instanceBufferId;
+      size_t instanceCapacity;
+      std::vector<Batch> batches;
+      size_t batchCount;
+      std::unordered_map<const Mesh*, size_t> batchIndices;
+      std::vector<glm::mat4> instances;
+      size_t drawCalls;
+      size_t instanceCount;
+
+    public:
+      /**
+       * @brief Construct a new Batch Renderer object which collects the
+       *    meshes submitted in a frame and draws each distinct mesh once,
+       *    instanced over all of its transforms.
+       */
+      BatchRenderer();
+
+      /**
+       * @brief Destroy the Batch Renderer and its instance buffer.
+       */
+      ~BatchRenderer();
+
+      BatchRenderer(const BatchRenderer&) = delete;
+      BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+      /**
+       * @brief Queues a mesh to be drawn with a transformation this frame.
+       * 
+       * @param mesh Mesh, must outlive the next flush
+       * @param transformation Model matrix
+       */
+      void submit(const Mesh* mesh, const glm::mat4& transformation);
+
+      /**
+       * @brief Uploads every queued transform in one buffer update and issues
+       *    one instanced draw per distinct mesh, the shader must already be
+       *    bound and read its model matrix from INSTANCE_TRANSFORM_LOCATION.
+       */
+      void flush();
+
+      /**
+       * @brief Get the number of draw calls issued by the last flush
+       * 
+       * @return size_t 
+       */
+      inline size_t getDrawCalls() const {
+        return drawCalls;
+      }
+
+      /**
+       * @brief Get the number of meshes drawn by the last flush
+       * 
+       * @return size_t 
+       */
+      inline size_t getInstanceCount() const {
+        return instanceCount;
+      }
+    };
+
+    enum class Containment
+    {
+      Outside,
+      Intersecting,
+      Inside
+    };
+
+    class Frustum
+    {
+    private:
+      // nx, ny, nz, d per plane, points inside satisfy dot(n, p) + d >= 0
+      float planes[6][4];
+
+    public:
+      /**
+       * @brief Construct a new Frustum object from the planes of a clip
+       *    matrix, a projection gives view space planes and projection * view
+       *    gives world space planes.
+       * 
+       * @param clip Clip matrix
+       */
+      Frustum(const glm::mat4& clip);
+
+      /**
+       * @brief Classifies an axis aligned box against every plane.
+       * 
+       * @param min Minimum corner
+       * @param max Maximum corner
+       * @return Containment 
+       */
+      Containment classify(const glm::vec3& min, const glm::vec3& max) const;
+
+      /**
+       * @brief Get the plane equations as 6 packed nx, ny, nz, d groups
+       * 
+       * @return const float* 
+       */
+      inline const float* getPlanes() const {
+        return &planes[0][0];
+      }
+    };
+
+    class SceneBVH
+    {
+    private:
+      /**
+       * Interior nodes keep their left child next in the array, leaves have
+       * no right child. Every node covers a contiguous range of objects.
+       */
+      struct Node
+      {
+        glm::vec3 min;
+        glm::vec3 max;
+        unsigned int first;
+        unsigned int count;
+        unsigned int right;
+      };
+
+      std::vector<Node> nodes;
+      std::vector<unsigned int> objects;
+      simd::Boxes boxes;
+      simd::Intersector intersector;
+      unsigned int leafSize;
+      std::vector<int> flags;
+      std::vector<unsigned int> stack;
+      size_t testedBoxes;
+
+      /**
+       * @brief Splits a range of objects at the median of its longest axis
+       *    until ranges fit in a leaf.
+       * 
+       * @param first First object of the range
+       * @param count Number of objects in the range
+       * @param mins Minimum corners by object id
+       * @param maxs Maximum corners by object id
+       * @return unsigned int Index of the node
+       */
+      unsigned int buildNode(unsigned int first, unsigned int count, const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs);
+
+    public:
+      /**
+       * @brief Construct a new empty Scene BVH object over world space object
+       *    bounds, leaves are tested against the frustum with packet kernels.
+       * 
+       * @param leafSize Most objects in a leaf
+       */
+      SceneBVH(unsigned int leafSize = 16);
+
+      /**
+       * @brief Builds the hierarchy, object ids are indices into the bounds.
+       * 
+       * @param mins Minimum corners of the objects
+       * @param maxs Maximum corners of the objects
+       */
+      void build(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs);
+
+      /**
+       * @brief Finds the objects whose bounds intersect a frustum, subtrees
+       *    wholly inside are accepted without testing their objects.
+       * 
+       * @param frustum World space frustum
+       * @param visible Output object ids, cleared first
+       */
+      void cull(const Frustum& frustum, std::vector<unsigned int>& visible);
+
+      /**
+       * @brief Get the number of nodes
+       * 
+       * @return size_t 
+       */
+      inline size_t getNodeCount() const {
+        return nodes.size();
+      }
+
+      /**
+       * @brief Get the number of object bounds tested by the last cull
+       * 
+       * @return size_t 
+       */
+      inline size_t getTestedBoxes() const {
+        return testedBoxes;
+      }
+    };
   }
 }
\ No newline at end of file
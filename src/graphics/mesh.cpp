@@ -8,6 +8,9 @@ namespace sunstorm
     Mesh::Mesh(std::string name) : name(name)
     {
       this->elementBufferId = 0;
+      this->indexType = GL_UNSIGNED_INT;
+      this->boundsMin = glm::vec3(0.0f);
+      this->boundsMax = glm::vec3(0.0f);
       glGenVertexArrays(1, &vaoId);
       SSRT_DBG_OUTPUT("Created Mesh: " << name);
     }
@@ -46,12 +49,36 @@ namespace sunstorm
       unbindMesh();
     }
 
-    void Mesh::createElementBuffer(GLuint* data)
+    void Mesh::createInterleavedBuffer(const void* data, GLsizeiptr size, GLsizei stride, const std::vector<VertexAttribute>& attributes)
     {
+      bindMesh();
+      GLuint bufferId;
+      glGenBuffers(1, &bufferId);
+      glBindBuffer(GL_ARRAY_BUFFER, bufferId);
+      glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+      for (const VertexAttribute& attribute : attributes) {
+        glEnableVertexAttribArray(attribute.pos);
+        glVertexAttribPointer(attribute.pos, attribute.dim, attribute.type, attribute.normalized, stride, (const void*) attribute.offset);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      vbos.push_back(bufferId);
+      unbindMesh();
+    }
+
+    void Mesh::createElementBuffer(const GLuint* data)
+    {
+      createElementBuffer(data, GL_UNSIGNED_INT);
+    }
+
+    void Mesh::createElementBuffer(const void* data, GLenum type)
+    {
+      indexType = type;
+      size_t indexSize = type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
       bindMesh();
       glGenBuffers(1, &elementBufferId);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferId);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, vertexCount * sizeof(GLuint), data, GL_STATIC_DRAW);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, vertexCount * indexSize, data, GL_STATIC_DRAW);
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
       unbindMesh();
     }
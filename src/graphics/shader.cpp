@@ -48,7 +48,7 @@ namespace sunstorm
       shaders.push_back(shaderId);
     }
 
-    void Shader::buildProgram() const
+    void Shader::buildProgram()
     {
       glLinkProgram(programId);
 
@@ -57,8 +57,8 @@ namespace sunstorm
       glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
       if (linkStatus == GL_FALSE) {
         GLint length = 0;
-	      glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &linkStatus);
-	      std::vector<char> errorLog(length);
+	      glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &length);
+	      std::vector<char> errorLog(length + 1);
 	      glGetProgramInfoLog(programId, length, &length, &errorLog[0]);
         
         throw std::runtime_error("Failed to link shader program:" + name + "\n" + &errorLog[0]);
@@ -71,12 +71,41 @@ namespace sunstorm
       glGetProgramiv(programId, GL_VALIDATE_STATUS, &validateStatus);
       if (validateStatus == GL_FALSE) {
         GLint length = 0;
-	      glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &validateStatus);
-	      std::vector<char> errorLog(length);
+	      glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &length);
+	      std::vector<char> errorLog(length + 1);
 	      glGetProgramInfoLog(programId, length, &length, &errorLog[0]);
         
         throw std::runtime_error("Failed to validate shader program:" + name + "\n" + &errorLog[0]);
       }
+
+      cacheUniforms();
+    }
+
+    void Shader::cacheUniforms()
+    {
+      GLint count = 0, maxLength = 0;
+      glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+      glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+      std::vector<char> buffer(maxLength + 1);
+
+      for (GLint i = 0; i < count; i++) {
+        GLsizei length = 0;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(programId, (GLuint) i, (GLsizei) buffer.size(), &length, &size, &type, buffer.data());
+
+        // arrays are reported as name[0], both spellings address the first element
+        std::string uniform = std::string(buffer.data(), length);
+        if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+          uniform.resize(uniform.size() - 3);
+        }
+
+        // members of uniform blocks have no location and are fed by buffers instead
+        GLint location = glGetUniformLocation(programId, uniform.c_str());
+        if (location >= 0) {
+          uniformLocations[uniform] = location;
+        }
+      }
     }
     
     void Shader::bindProgram() const
@@ -91,7 +120,7 @@ namespace sunstorm
     
     void Shader::getUniform(std::string name)
     {
-      GLuint location = glGetUniformLocation(programId, name.c_str());
+      GLint location = glGetUniformLocation(programId, name.c_str());
       if (location >= 0) {
         uniformLocations[name] = location;
       } else {
@@ -99,48 +128,98 @@ namespace sunstorm
       }
     }
 
-    GLuint Shader::getUniformLocation(std::string name)
+    GLint Shader::getUniformLocation(const std::string& name) const
     {
-      if (uniformLocations.contains(name)) {
-        return uniformLocations[name];
+      auto it = uniformLocations.find(name);
+      if (it != uniformLocations.end()) {
+        return it->second;
       } else {
         throw std::runtime_error("Uniform not loaded: " + name + "!");
       }
     }
+
+    UniformHandle Shader::getUniformHandle(const std::string& name) const
+    {
+      return { getUniformLocation(name) };
+    }
+
+    void Shader::bindUniformBlock(const std::string& block, GLuint binding) const
+    {
+      GLuint index = glGetUniformBlockIndex(programId, block.c_str());
+      if (index == GL_INVALID_INDEX) {
+        throw std::runtime_error("Failed to find uniform block: " + block + "!");
+      }
+      glUniformBlockBinding(programId, index, binding);
+    }
     
-    void Shader::setUniformInt(std::string name, int i)
+    void Shader::setUniformInt(const std::string& name, int i)
     {
-      glUniform1i(getUniformLocation(name), i);
+      setUniformInt(getUniformHandle(name), i);
+    }
+
+    void Shader::setUniformInt(UniformHandle handle, int i) const
+    {
+      glUniform1i(handle.location, i);
     }
     
-    void Shader::setUniformFloat(std::string name, float f)
+    void Shader::setUniformFloat(const std::string& name, float f)
     {
-      glUniform1f(getUniformLocation(name), f);
+      setUniformFloat(getUniformHandle(name), f);
+    }
+
+    void Shader::setUniformFloat(UniformHandle handle, float f) const
+    {
+      glUniform1f(handle.location, f);
     }
     
-    void Shader::setUniformVector2(std::string name, glm::vec2 v)
+    void Shader::setUniformVector2(const std::string& name, const glm::vec2& v)
+    {
+      setUniformVector2(getUniformHandle(name), v);
+    }
+
+    void Shader::setUniformVector2(UniformHandle handle, const glm::vec2& v) const
     {
-      glUniform2f(getUniformLocation(name), v.x, v.y);
+      glUniform2f(handle.location, v.x, v.y);
     }
 
-    void Shader::setUniformVector3(std::string name, glm::vec3 v)
+    void Shader::setUniformVector3(const std::string& name, const glm::vec3& v)
     {
-      glUniform3f(getUniformLocation(name), v.x, v.y, v.z);
+      setUniformVector3(getUniformHandle(name), v);
     }
 
-    void Shader::setUniformVector4(std::string name, glm::vec4 v)
+    void Shader::setUniformVector3(UniformHandle handle, const glm::vec3& v) const
     {
-      glUniform4f(getUniformLocation(name), v.x, v.y, v.z, v.w);
+      glUniform3f(handle.location, v.x, v.y, v.z);
+    }
+
+    void Shader::setUniformVector4(const std::string& name, const glm::vec4& v)
+    {
+      setUniformVector4(getUniformHandle(name), v);
+    }
+
+    void Shader::setUniformVector4(UniformHandle handle, const glm::vec4& v) const
+    {
+      glUniform4f(handle.location, v.x, v.y, v.z, v.w);
     }
     
-    void Shader::setUniformMatrix4x4(std::string name, glm::mat4 m)
+    void Shader::setUniformMatrix4x4(const std::string& name, const glm::mat4& m)
+    {
+      setUniformMatrix4x4(getUniformHandle(name), m);
+    }
+
+    void Shader::setUniformMatrix4x4(UniformHandle handle, const glm::mat4& m) const
     {
-      glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &m[0][0]);
+      glUniformMatrix4fv(handle.location, 1, GL_FALSE, &m[0][0]);
     }
 
-    void Shader::setUniformTexture(std::string name, int textureLocation)
+    void Shader::setUniformTexture(const std::string& name, int textureLocation)
     {
       setUniformInt(name, textureLocation);
     }
+
+    void Shader::setUniformTexture(UniformHandle handle, int textureLocation) const
+    {
+      setUniformInt(handle, textureLocation);
+    }
   }
 }
@@ -0,0 +1,96 @@
+#include "graphics.h"
+
+#include <cstring>
+
+namespace sunstorm
+{
+  namespace gfx
+  {
+    UniformRing::UniformRing(size_t frameSize, unsigned int frames) 
+      : mapped(nullptr), head(0), frames(std::max(frames, 1u)), frame(0), fences(std::max(frames, 1u), nullptr)
+    {
+      // every range bound must start on this alignment, commonly 256 bytes
+      GLint offsetAlignment = 256;
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+      alignment = (size_t) std::max(offsetAlignment, 1);
+      this->frameSize = (frameSize + alignment - 1) / alignment * alignment;
+
+      size_t size = this->frameSize * this->frames;
+      glGenBuffers(1, &bufferId);
+      glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+      if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, (GLsizeiptr) size, nullptr, flags);
+        mapped = (unsigned char*) glMapBufferRange(GL_UNIFORM_BUFFER, 0, (GLsizeiptr) size, flags);
+      } else {
+        glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_DRAW);
+      }
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+      SSRT_DBG_OUTPUT("Created Uniform Ring: " << this->frames << " x " << this->frameSize << " bytes");
+    }
+
+    UniformRing::~UniformRing()
+    {
+      for (GLsync fence : fences) {
+        if (fence) {
+          glDeleteSync(fence);
+        }
+      }
+
+      if (mapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      }
+      glDeleteBuffers(1, &bufferId);
+      SSRT_DBG_OUTPUT("Destroyed Uniform Ring");
+    }
+
+    void UniformRing::beginFrame()
+    {
+      head = 0;
+      GLsync& fence = fences[frame % frames];
+
+      // only blocks when the GPU is a whole ring of frames behind
+      if (fence) {
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (status == GL_TIMEOUT_EXPIRED) {
+          status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+      }
+    }
+
+    void UniformRing::endFrame()
+    {
+      fences[frame % frames] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      frame++;
+    }
+
+    size_t UniformRing::write(const void* data, size_t size)
+    {
+      if (head + size > frameSize) {
+        throw std::runtime_error("Uniform ring frame region is full, " + std::to_string(frameSize) + " bytes!");
+      }
+
+      size_t offset = (frame % frames) * frameSize + head;
+      if (mapped) {
+        std::memcpy(mapped + offset, data, size);
+      } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+        glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr) offset, (GLsizeiptr) size, data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      }
+
+      head += (size + alignment - 1) / alignment * alignment;
+      return offset;
+    }
+
+    void UniformRing::bindRange(GLuint binding, size_t offset, size_t size) const
+    {
+      glBindBufferRange(GL_UNIFORM_BUFFER, binding, bufferId, (GLintptr) offset, (GLsizeiptr) size);
+    }
+  }
+}
@@ -1,10 +1,14 @@
 
 #include <iostream>
 #include <chrono>
+#include <climits>
+#include <cmath>
+#include <memory>
 
 #include "common.h"
 #include "compute/compute.h"
 #include "graphics/graphics.h"
+#include "render/render.h"
 
 #include <glm/glm.hpp>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -12,40 +16,50 @@
 
 using namespace sunstorm;
 
-class RayTracer
+/**
+ * Builds a BVH over a model which is scaled and moved to sit in front of the
+ * fixed trace camera.
+ */
+rt::BVH buildModelBVH(std::string model)
 {
-private:
-  cmp::ComputeKernel* k;
-  unsigned int width;
-  unsigned int height;
-  cl_mem display;
-
-public:
-  RayTracer(cmp::ComputeKernel* kernel, const gfx::Texture& image, unsigned int width, unsigned int height)
-    : k(kernel), width(width), height(height)
-  {
-    display = k->createSharedImage(0, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, image.getTextureId());
-    clSetKernelArg(k->getKernel(), 1, sizeof(unsigned int), &width);
-    clSetKernelArg(k->getKernel(), 2, sizeof(unsigned int), &height);
+  jobs::ThreadPool pool = jobs::ThreadPool();
+  io::MeshData fallback;
+  io::MeshFile* file = io::importMeshFile(model, &pool, &fallback);
+  if (!file && fallback.indices.empty()) {
+    throw std::runtime_error("Failed to load model: " + model);
   }
 
-  // wrapper method
-  static void handleErr(cl_int err) 
-  {
-    cmp::ComputeHandler::handleError(err);
+  // the cache may not be writable, in which case the optimized arrays the import left are traced instead
+  glm::vec3 bmin, bmax;
+  std::vector<io::MeshVertex> vertices;
+  if (file) {
+    bmin = file->getBoundsMin();
+    bmax = file->getBoundsMax();
+  } else {
+    io::interleaveMesh(fallback, vertices);
+    io::computeBounds(vertices.data(), vertices.size(), bmin, bmax);
   }
 
-  void execute(size_t* localSize, size_t* globalSize) const
-  {
-    cl_command_queue queue = cmp::ComputeHandler::global->getQueue(0);
-    handleErr(clEnqueueAcquireGLObjects(queue, 1, &display, 0, NULL, NULL));
-    handleErr(clEnqueueNDRangeKernel(queue, k->getKernel(), 2, NULL, globalSize, localSize, 0, NULL, NULL));
-    handleErr(clFinish(queue));
-    handleErr(clEnqueueReleaseGLObjects(queue, 1, &display, 0, NULL, NULL));
+  glm::vec3 extent = bmax - bmin;
+  float scale = 2.0f / std::max(extent.x, std::max(extent.y, extent.z));
+
+  glm::mat4 transform = glm::mat4(1.0f);
+  transform = glm::translate(transform, glm::vec3(0.0f, 0.0f, -3.0f));
+  transform = glm::rotate(transform, glm::radians(30.0f), glm::vec3(1.0f, 1.0f, 0.0f));
+  transform = glm::scale(transform, glm::vec3(scale));
+  transform = glm::translate(transform, -(bmin + bmax) * 0.5f);
+
+  if (!file) {
+    return rt::BVH(fallback.positions.data(), 3, fallback.indices.data(), fallback.indices.size(), transform);
   }
-};
 
-void run()
+  const float* positions = file->getVertices()->position;
+  rt::BVH bvh = rt::BVH(positions, sizeof(io::MeshVertex) / sizeof(float), file->getIndices(), file->getIndexCount(), transform);
+  delete file;
+  return bvh;
+}
+
+void run(std::string model)
 {
   unsigned int w = 512, h = 512;
 
@@ -53,42 +67,519 @@ void run()
 
   gfx::Window window = gfx::Window("Ray Tracer | v0.0.1", w, h);
 
-  gfx::Texture colour = gfx::Texture("Colour Buffer", GL_TEXTURE_2D);
-  colour.bind(0);
-  colour.storeTexture2D(w, h, 0, nullptr);
-  colour.genMipmaps();
-  colour.unbind(0);
-
-  gfx::Framebuffer framebuffer = gfx::Framebuffer(w, h);
-  framebuffer.bindFramebuffer();
-  framebuffer.attachTexture(colour, GL_COLOR_ATTACHMENT0);
-  framebuffer.unbindFramebuffer();
-  framebuffer.complete();
-
   /* --- Compute set up --- */
   
   cmp::ComputeHandler handler = cmp::ComputeHandler();
-  handler.createQueue(NULL);
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* kernel = program->createKernel(model.empty() ? "trace" : "traceMesh");
+  rt::RayTracer tracer(kernel, w, h);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+
+  if (model.empty()) {
+    scene.bind(kernel, 3);
+    scene.upload(queue);
+  } else {
+    buildModelBVH(model).upload(kernel, 3, 4);
+  }
+
+  // rounds the image up to whole work-groups of the fastest size for this device
+  size_t globalSize[] = { w, h };
+  cmp::Autotuner tuner = cmp::Autotuner(handler.getDevice());
+  cmp::LaunchSize launch = tuner.tune(kernel, queue, globalSize, [&](const cmp::LaunchSize& size) {
+    tracer.execute(size.getLocal(), size.global);
+  });
+
+  /* --- Main Game loop --- */
+
+  double t0 = glfwGetTime();
+  unsigned int frames = 0;
+
+  while (!window.isClosed())
+  {
+    window.update();
+
+    // only the moved sphere is written to the device
+    if (model.empty()) {
+      scene.setSphere(0, glm::vec3(0.0f, 0.5f * std::sin((float) glfwGetTime()), -3.0f), 1.0f);
+      scene.upload(queue);
+    }
+
+    // frame N traces while frame N-1 is blitted and swapped
+    tracer.execute(launch.getLocal(), launch.global);
+    tracer.present(window.getWidth(), window.getHeight());
+
+    frames++;
+    if (glfwGetTime() - t0 >= 1.0) {
+      SSRT_DBG_OUTPUT("Frame time: " << (glfwGetTime() - t0) * 1000 / frames << " ms");
+      t0 = glfwGetTime();
+      frames = 0;
+    }
+  }
+}
+
+void runHeadless(unsigned int w, unsigned int h, unsigned int frames, std::string output, std::string model)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* kernel = program->createKernel(model.empty() ? "trace" : "traceMesh");
+  rt::OffscreenRayTracer tracer = rt::OffscreenRayTracer(kernel, w, h);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+
+  if (model.empty()) {
+    scene.bind(kernel, 3);
+    scene.upload(queue);
+  } else {
+    buildModelBVH(model).upload(kernel, 3, 4);
+  }
+
+  // arbitrary resolutions are allowed, the global size is padded to whole work-groups
+  size_t globalSize[] = { w, h };
+  cmp::Autotuner tuner = cmp::Autotuner(handler.getDevice());
+  cmp::LaunchSize launch = tuner.tune(kernel, queue, globalSize, [&](const cmp::LaunchSize& size) {
+    tracer.execute(size.getLocal(), size.global);
+  });
+
+  // first frame includes driver warm-up so is excluded from timings
+  tracer.execute(launch.getLocal(), launch.global);
+
+  /* --- Offscreen render loop --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    tracer.execute(launch.getLocal(), launch.global);
+  }
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  double raysPerSecond = tracer.getRaysPerFrame() * frames / seconds;
+  std::cout << "Rendered " << frames << " frames at " << w << "x" << h << " in " << seconds * 1000 << " ms" << std::endl;
+  std::cout << "  " << seconds * 1000 / frames << " ms/frame, " << raysPerSecond / 1e6 << " Mrays/s, work-group "
+            << launch.local[0] << "x" << launch.local[1] << std::endl;
+
+  if (!output.empty()) {
+    std::vector<unsigned char> pixels((size_t) w * h * 4);
+    tracer.readFrame(pixels.data());
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runTiled(unsigned int w, unsigned int h, unsigned int tileWidth, unsigned int tileHeight, std::string output, std::string model)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* kernel = program->createKernel(model.empty() ? "traceTile" : "traceMeshTile");
+  rt::TiledRenderer renderer = rt::TiledRenderer(kernel, w, h, tileWidth, tileHeight);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+
+  if (model.empty()) {
+    scene.bind(kernel, 3);
+    scene.upload(queue);
+  } else {
+    buildModelBVH(model).upload(kernel, 3, 4);
+  }
+
+  // tuned on one tile, every tile is launched the same way
+  size_t tileSize[] = { renderer.getTileWidth(), renderer.getTileHeight() };
+  cmp::Autotuner tuner = cmp::Autotuner(handler.getDevice());
+  cmp::LaunchSize launch = tuner.tune(kernel, queue, tileSize, [&](const cmp::LaunchSize& size) {
+    renderer.traceTile(0, size.getLocal());
+  });
+
+  /* --- Tiled render, the frame only ever exists in the file --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  io::PNGStreamWriter writer = io::PNGStreamWriter(output, w, h);
+  renderer.render(launch.getLocal(), writer);
+  bool written = writer.finish();
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  std::cout << "Rendered " << w << "x" << h << " in " << renderer.getTileCount() << " tiles in " << seconds * 1000 << " ms" << std::endl;
+  std::cout << "  " << renderer.getRaysPerFrame() / seconds / 1e6 << " Mrays/s including encoding, work-group "
+            << launch.local[0] << "x" << launch.local[1] << std::endl;
+
+  if (written) {
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runPersistent(unsigned int w, unsigned int h, unsigned int frames, unsigned int spheres, std::string output)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  cl_command_queue queue = handler.createQueue(0);
   cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
   cmp::ComputeKernel* kernel = program->createKernel("trace");
-  RayTracer rt = RayTracer(kernel, colour, w, h);
+  cmp::ComputeKernel* persistentKernel = program->createKernel("tracePersistent");
+  rt::OffscreenRayTracer tracer = rt::OffscreenRayTracer(kernel, w, h);
+  rt::OffscreenRayTracer persistentTracer = rt::OffscreenRayTracer(persistentKernel, w, h);
+  rt::PersistentScheduler scheduler(persistentKernel, w, h);
+
+  // shadow rays make per pixel cost uneven, which is what leaves static launches idle at the tail
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createSphereField(scene, spheres);
+  scene.bind(kernel, 3);
+  scene.bind(persistentKernel, 3);
+  scene.upload(queue);
+
+  size_t globalSize[] = { w, h };
+  cmp::Autotuner tuner = cmp::Autotuner(handler.getDevice());
+  cmp::LaunchSize launch = tuner.tune(kernel, queue, globalSize, [&](const cmp::LaunchSize& size) {
+    tracer.execute(size.getLocal(), size.global);
+  });
+  const cmp::LaunchSize& persistentLaunch = scheduler.getLaunchSize();
+
+  /* --- Static and persistent render loops --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    tracer.execute(launch.getLocal(), launch.global);
+  }
+  double staticSeconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    scheduler.prepare(queue);
+    persistentTracer.execute(persistentLaunch.getLocal(), persistentLaunch.global);
+  }
+  double persistentSeconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  std::cout << "Rendered " << frames << " frames at " << w << "x" << h << " with " << scene.getSphereGeometry().size() << " spheres" << std::endl;
+  std::cout << "  static:     " << staticSeconds * 1000 / frames << " ms/frame, " << tracer.getRaysPerFrame() * frames / staticSeconds / 1e6 
+            << " Mrays/s, work-group " << launch.local[0] << "x" << launch.local[1] << std::endl;
+  std::cout << "  persistent: " << persistentSeconds * 1000 / frames << " ms/frame, " << tracer.getRaysPerFrame() * frames / persistentSeconds / 1e6 
+            << " Mrays/s, " << scheduler.getGroupCount() << " groups on " << handler.getComputeUnits() << " compute units" << std::endl;
+
+  if (!output.empty()) {
+    std::vector<unsigned char> pixels((size_t) w * h * 4);
+    persistentTracer.readFrame(pixels.data());
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runMultiDevice(unsigned int w, unsigned int h, unsigned int frames, unsigned int spheres, std::string output)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  const std::vector<cmp::ComputeDevice>& devices = handler.createDeviceQueues(CL_QUEUE_PROFILING_ENABLE);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createSphereField(scene, spheres);
+  rt::SplitFrameRenderer renderer = rt::SplitFrameRenderer(devices, "cl/ray_trace.cl", &scene, w, h);
+  std::vector<unsigned char> pixels((size_t) w * h * 4);
+
+  /* --- Split frame render loop --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    renderer.execute(pixels.data());
+  }
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  double raysPerSecond = renderer.getRaysPerFrame() * frames / seconds;
+  std::cout << "Rendered " << frames << " frames at " << w << "x" << h << " on " << renderer.getShares().size() << " devices in " << seconds * 1000 << " ms" << std::endl;
+  std::cout << "  " << seconds * 1000 / frames << " ms/frame, " << raysPerSecond / 1e6 << " Mrays/s" << std::endl;
+
+  // the bands of the last frame show where the balance settled
+  for (const rt::DeviceShare& share : renderer.getShares()) {
+    std::cout << "  " << share.name << ": rows " << share.firstRow << "-" << share.firstRow + share.rowCount << " (" << 100.0 * share.share 
+              << "%), " << share.milliseconds << " ms" << std::endl;
+  }
+
+  if (!output.empty()) {
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runPath(unsigned int samplesPerPixel)
+{
+  unsigned int w = 512, h = 512;
+
+  /* --- Graphics setup --- */
+
+  gfx::Window window = gfx::Window("Path Tracer | v0.0.1", w, h);
+
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler();
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* kernel = program->createKernel("pathTrace");
+  rt::RayTracer tracer(kernel, w, h);
+  rt::Accumulator accumulator(kernel, w, h, samplesPerPixel);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+  scene.bind(kernel, 3);
+  scene.upload(queue);
 
   size_t globalSize[] = { w, h };
-  size_t localSize[] = { globalSize[0] / 64, globalSize[1] / 64 };
+  cmp::Autotuner tuner = cmp::Autotuner(handler.getDevice());
+  cmp::LaunchSize launch = tuner.tune(kernel, queue, globalSize, [&](const cmp::LaunchSize& size) {
+    accumulator.nextFrame(scene);
+    tracer.execute(size.getLocal(), size.global);
+  });
 
   /* --- Main Game loop --- */
 
+  double t0 = glfwGetTime();
+  unsigned int frames = 0;
+
+  // the scene is static so the image keeps converging until it is edited
   while (!window.isClosed())
   {
     window.update();
-    // double t0 = glfwGetTime();
-    rt.execute(localSize, globalSize);
-    framebuffer.draw(window.getWidth(), window.getHeight());
-    // SSRT_DBG_OUTPUT("Took: " << (glfwGetTime() - t0) * 1000 << " ms");
+    scene.upload(queue);
+
+    accumulator.nextFrame(scene);
+    tracer.execute(launch.getLocal(), launch.global);
+    tracer.present(window.getWidth(), window.getHeight());
+
+    frames++;
+    if (glfwGetTime() - t0 >= 1.0) {
+      SSRT_DBG_OUTPUT("Frame time: " << (glfwGetTime() - t0) * 1000 / frames << " ms, " << accumulator.getSampleCount() << " samples per pixel");
+      t0 = glfwGetTime();
+      frames = 0;
+    }
+  }
+}
+
+void runPathHeadless(unsigned int w, unsigned int h, unsigned int frames, unsigned int samplesPerPixel, std::string output)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* kernel = program->createKernel("pathTrace");
+  rt::OffscreenRayTracer tracer = rt::OffscreenRayTracer(kernel, w, h);
+  rt::Accumulator accumulator(kernel, w, h, samplesPerPixel);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+  scene.bind(kernel, 3);
+  scene.upload(queue);
+
+  size_t globalSize[] = { w, h };
+  cmp::Autotuner tuner = cmp::Autotuner(handler.getDevice());
+  cmp::LaunchSize launch = tuner.tune(kernel, queue, globalSize, [&](const cmp::LaunchSize& size) {
+    accumulator.nextFrame(scene);
+    tracer.execute(size.getLocal(), size.global);
+  });
+
+  // tuning launches are discarded so the image holds exactly the requested samples
+  accumulator.reset();
+
+  /* --- Offscreen render loop --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    accumulator.nextFrame(scene);
+    tracer.execute(launch.getLocal(), launch.global);
+  }
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  double samplesPerSecond = (double) tracer.getRaysPerFrame() * accumulator.getSampleCount() / seconds;
+  std::cout << "Rendered " << accumulator.getSampleCount() << " samples per pixel at " << w << "x" << h << " in " << seconds * 1000 << " ms" << std::endl;
+  std::cout << "  " << seconds * 1000 / frames << " ms/frame, " << samplesPerSecond / 1e6 << " Msamples/s" << std::endl;
+
+  if (!output.empty()) {
+    std::vector<unsigned char> pixels((size_t) w * h * 4);
+    tracer.readFrame(pixels.data());
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runAdaptive(unsigned int w, unsigned int h, float threshold, std::string output)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* kernel = program->createKernel("pathTraceAdaptive");
+  cmp::ComputeKernel* resolve = program->createKernel("resolveTiles");
+  rt::OffscreenRayTracer tracer = rt::OffscreenRayTracer(resolve, w, h);
+  rt::AdaptiveSampler sampler(kernel, resolve, w, h, 16, 4, threshold);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+  scene.bind(kernel, 3);
+  scene.upload(queue);
+
+  /* --- Adaptive render loop --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  unsigned int passes = 0;
+  while (sampler.pass(queue, scene)) {
+    passes++;
+    SSRT_DBG_OUTPUT("Pass " << passes << ": " << sampler.getActiveTileCount() << "/" << sampler.getTileCount() << " tiles active");
+  }
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  // a uniform sampler reaches the same worst tile quality only by giving every tile the highest count
+  const std::vector<cl_uint>& tileSamples = sampler.getTileSamples();
+  cl_uint maxSamples = *std::max_element(tileSamples.begin(), tileSamples.end());
+  unsigned long long uniform = (unsigned long long) w * h * maxSamples;
+
+  std::cout << "Converged in " << passes << " passes, " << seconds * 1000 << " ms" << std::endl;
+  std::cout << "  " << sampler.getSamplesTraced() / 1e6 << " M samples traced, " << uniform / 1e6 << " M for uniform sampling at "
+            << maxSamples << " spp (" << 100.0 * sampler.getSamplesTraced() / uniform << "%)" << std::endl;
+
+  if (!output.empty()) {
+    size_t globalSize[] = { w, h };
+    tracer.execute(NULL, globalSize);
+
+    std::vector<unsigned char> pixels((size_t) w * h * 4);
+    tracer.readFrame(pixels.data());
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runWavefront(unsigned int w, unsigned int h, unsigned int frames, unsigned int samplesPerFrame, std::string output)
+{
+  /* --- Compute set up --- */
+
+  cmp::ComputeHandler handler = cmp::ComputeHandler(false);
+  cl_command_queue queue = handler.createQueue(0);
+  cmp::ComputeProgram* program = handler.createProgram("cl/ray_trace.cl");
+  cmp::ComputeKernel* resolve = program->createKernel("resolveAccumulation");
+  rt::OffscreenRayTracer tracer = rt::OffscreenRayTracer(resolve, w, h);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+  rt::WavefrontTracer wavefront(program, scene, resolve, w, h, samplesPerFrame);
+  scene.upload(queue);
+
+  /* --- Wavefront render loop --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    wavefront.render(queue, scene);
+  }
+  clFinish(queue);
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  double samplesPerSecond = (double) w * h * wavefront.getSampleCount() / seconds;
+  std::cout << "Rendered " << wavefront.getSampleCount() << " samples per pixel at " << w << "x" << h << " in " << seconds * 1000 << " ms" << std::endl;
+  std::cout << "  " << seconds * 1000 / frames << " ms/frame, " << samplesPerSecond / 1e6 << " Msamples/s" << std::endl;
+
+  // shows how many paths were still live at each bounce after dead ones were compacted out
+  const std::vector<unsigned long long>& bounceRays = wavefront.getBounceRays();
+  for (size_t i = 0; i < bounceRays.size(); i++) {
+    std::cout << "  bounce " << i << ": " << bounceRays[i] / 1e6 << " M paths (" << 100.0 * bounceRays[i] / bounceRays[0] << "%)" << std::endl;
+  }
+  std::cout << "  shadow: " << wavefront.getShadowRays() / 1e6 << " M rays" << std::endl;
+
+  if (!output.empty()) {
+    size_t globalSize[] = { w, h };
+    tracer.execute(NULL, globalSize);
+
+    std::vector<unsigned char> pixels((size_t) w * h * 4);
+    tracer.readFrame(pixels.data());
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runCPU(unsigned int w, unsigned int h, unsigned int frames, unsigned int threads, std::string output)
+{
+  jobs::ThreadPool pool = jobs::ThreadPool(threads);
+
+  rt::Scene scene = rt::Scene();
+  rt::Scene::createDefault(scene);
+  rt::CPURayTracer tracer = rt::CPURayTracer(&pool, &scene, w, h);
+  std::vector<unsigned char> pixels((size_t) w * h * 4);
+
+  // first frame warms caches and wakes the workers so is excluded from timings
+  tracer.execute(pixels.data());
+  tracer.resetStats();
+
+  /* --- CPU render loop --- */
+
+  long long t0 = time::getTimeMicroseconds();
+  for (unsigned int i = 0; i < frames; i++) {
+    tracer.execute(pixels.data());
+  }
+  double seconds = (time::getTimeMicroseconds() - t0) / 1e6;
+
+  const std::vector<rt::ThreadStats>& stats = tracer.getThreadStats();
+  std::cout << "Rendered " << frames << " frames at " << w << "x" << h << " on " << stats.size() << " threads in " << seconds * 1000 << " ms" 
+            << " (" << simd::getISAName(tracer.getISA()) << " packets)" << std::endl;
+
+  for (size_t i = 0; i < stats.size(); i++) {
+    std::cout << "  thread " << i << ": " << stats[i].tiles << " tiles, " << stats[i].rays / seconds / 1e6 << " Mrays/s, "
+              << 100.0 * stats[i].busyMicroseconds / (seconds * 1e6) << "% busy" << std::endl;
+  }
+
+  double raysPerSecond = tracer.getRaysPerFrame() * frames / seconds;
+  std::cout << "  total: " << seconds * 1000 / frames << " ms/frame, " << raysPerSecond / 1e6 << " Mrays/s" << std::endl;
+
+  if (!output.empty()) {
+    io::writeImageFile(output, w, h, pixels.data());
+    SSRT_DBG_OUTPUT("Wrote frame to: " << output);
+  }
+}
+
+void runOBJ(std::string model, unsigned int repeats, unsigned int threads)
+{
+  repeats = std::max(1u, repeats);
+  jobs::ThreadPool pool = jobs::ThreadPool(threads);
+  io::MappedFile file = io::MappedFile(RES_DIR + model);
+  if (!file.isOpen()) {
+    throw std::runtime_error("Failed to load model: " + model);
   }
+  double megabytes = file.getSize() / 1e6;
+
+  // serial pass also warms the page cache so both variants read from memory
+  for (jobs::ThreadPool* p : { (jobs::ThreadPool*) nullptr, &pool }) {
+    long long best = LLONG_MAX;
+    io::MeshData data;
+
+    for (unsigned int i = 0; i < repeats; i++) {
+      data = io::MeshData();
+      long long t0 = time::getTimeMicroseconds();
+      if (!io::parseOBJFile(model, data, p)) {
+        throw std::runtime_error("Failed to load model: " + model);
+      }
+      best = std::min(best, time::getTimeMicroseconds() - t0);
+    }
+
+    std::cout << (p ? "parallel (" + std::to_string(pool.getThreadCount()) + " threads)" : std::string("serial")) << ": "
+              << data.getVertexCount() << " vertices, " << data.indices.size() / 3 << " triangles, "
+              << best / 1000.0 << " ms, " << megabytes / (best / 1e6) << " MB/s" << std::endl;
+  }
+
+  // the import stage every cached mesh goes through, measured on the parser's raw order
+  io::MeshData data;
+  io::parseOBJFile(model, data, &pool);
+  long long t0 = time::getTimeMicroseconds();
+  io::MeshOptimizeStats stats = io::optimizeMesh(data);
+  long long t1 = time::getTimeMicroseconds();
+
+  std::cout << "optimize: ACMR " << stats.acmrBefore << " -> " << stats.acmrCache << " (vertex cache) -> " << stats.acmrAfter
+            << " (overdraw, " << stats.clusters << " clusters), " << (t1 - t0) / 1000.0 << " ms" << std::endl;
 }
 
-void run2()
+void run2(unsigned int objects, bool gpuCulling)
 {
   unsigned int w = 812, h = 612;
 
@@ -97,35 +588,118 @@ void run2()
   gfx::Window window = gfx::Window("Graphics Test | v0.0.1", w, h);
 
   gfx::Shader shader = gfx::Shader("diffuse");
-  shader.createShader(GL_VERTEX_SHADER, io::readFile("glsl/base_vert.glsl"));
+  shader.createShader(GL_VERTEX_SHADER, io::readFile("glsl/instanced_vert.glsl"));
   shader.createShader(GL_FRAGMENT_SHADER, io::readFile("glsl/base_frag.glsl"));
   shader.buildProgram();
   shader.unbindProgram();
-  shader.getUniform("projection");
-  shader.getUniform("transformation");
-  shader.getUniform("view");
+  shader.bindUniformBlock("Camera", 0);
 
-  SSRT_DBG_OUTPUT("A");
-  gfx::Mesh mesh = *io::readOBJFile("models/cube.obj");
-  SSRT_DBG_OUTPUT("B");
+  // per-frame blocks are appended to the ring and bound by range, no uniform lookups in the loop
+  gfx::UniformRing uniforms = gfx::UniformRing();
+  gfx::BatchRenderer batches = gfx::BatchRenderer();
+  gfx::SceneBVH scene = gfx::SceneBVH();
+  std::vector<unsigned int> visible;
+
+  // culling on the device needs a context shared with the window's
+  std::unique_ptr<cmp::ComputeHandler> handler = gpuCulling ? std::make_unique<cmp::ComputeHandler>() : nullptr;
+  cl_command_queue queue = handler ? handler->createQueue(0) : NULL;
+  cmp::ComputeKernel* cullKernel = handler ? handler->createProgram("cl/cull.cl")->createKernel("cullInstances") : nullptr;
+
+  // decoded off the main thread, the window keeps drawing while it streams in
+  io::AssetLoader loader = io::AssetLoader();
+  std::shared_future<gfx::Mesh*> pendingMesh = loader.loadMesh("models/cube.obj");
+
+  // declared last so even on an error the culler's shared buffers go before the mesh it draws and the context
+  std::unique_ptr<gfx::Mesh> mesh;
+  std::unique_ptr<rt::GPUCuller> culler;
+
+  // objects are laid out on a square grid stretching away from the camera
+  unsigned int side = (unsigned int) std::ceil(std::sqrt((float) std::max(objects, 1u)));
+  std::vector<glm::vec3> positions;
+  for (unsigned int i = 0; i < objects; i++) {
+    positions.push_back(glm::vec3(((float) (i % side) - (side - 1) * 0.5f) * 3.0f, -5.0f, -15.0f - (float) (i / side) * 3.0f));
+  }
 
   glm::mat4 projection = glm::perspective(glm::radians(65.0f), window.getAspectRatio(), 0.001f, 1000.0f);
-  glm::mat4 transformation = glm::mat4(1.0f);
-  transformation = glm::translate(transformation, glm::vec3(0.0f, -5.0f, -15.0f));
   glm::mat4 view = glm::mat4(1.0f);
+  float angle = 0.0f;
+  float heading = 0.0f;
+
+  unsigned int frames = 0;
+  long long t0 = time::getTimeMicroseconds();
 
   while (!window.isClosed()) {
-    transformation = glm::rotate(transformation, glm::radians(1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    angle += glm::radians(1.0f);
+    heading += glm::radians(0.1f);
+    view = glm::rotate(glm::mat4(1.0f), heading, glm::vec3(0.0f, 1.0f, 0.0f));
     
     window.update();
+    loader.update();
+
+    if (!mesh && pendingMesh.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      mesh.reset(pendingMesh.get());
+      if (!mesh) {
+        throw std::runtime_error("Failed to load model: models/cube.obj");
+      }
+
+      // objects spin about their own y axis, so bounds cover the mesh at any angle and are built once
+      glm::vec3 bmin = mesh->getBoundsMin(), bmax = mesh->getBoundsMax();
+      float radius = std::sqrt(std::max(bmin.x * bmin.x, bmax.x * bmax.x) + std::max(bmin.z * bmin.z, bmax.z * bmax.z));
+      std::vector<glm::vec3> mins, maxs;
+      for (const glm::vec3& position : positions) {
+        mins.push_back(position + glm::vec3(-radius, bmin.y, -radius));
+        maxs.push_back(position + glm::vec3(radius, bmax.y, radius));
+      }
+      if (gpuCulling) {
+        // device culled objects are static, each keeps a fixed turn so the grid is not uniform
+        std::vector<glm::mat4> transformations;
+        for (size_t i = 0; i < positions.size(); i++) {
+          transformations.push_back(glm::rotate(glm::translate(glm::mat4(1.0f), positions[i]), (float) i, glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+        culler = std::make_unique<rt::GPUCuller>(cullKernel, mesh.get(), transformations, mins, maxs);
+      } else {
+        scene.build(mins, maxs);
+      }
+    }
+    if (!mesh) {
+      continue;
+    }
+
+    uniforms.beginFrame();
+    gfx::CameraUniforms camera = { projection, view };
+    uniforms.bindRange(0, uniforms.write(camera), sizeof(camera));
+
+    gfx::Frustum frustum = gfx::Frustum(projection * view);
     shader.bindProgram();
-    shader.setUniformMatrix4x4("projection", projection);
-    shader.setUniformMatrix4x4("transformation", transformation);
-    shader.setUniformMatrix4x4("view", view);
-    mesh.bindMesh();
-    glDrawElements(GL_TRIANGLES, mesh.getVertexCount(), GL_UNSIGNED_INT, 0);
-    mesh.unbindMesh();
+
+    if (culler) {
+      // the device writes the visible transforms and the draw's instance count, the host touches no object
+      culler->cull(queue, frustum);
+      culler->draw();
+    } else {
+      // only objects the camera can see are submitted
+      scene.cull(frustum, visible);
+      for (unsigned int i : visible) {
+        glm::mat4 transformation = glm::rotate(glm::translate(glm::mat4(1.0f), positions[i]), angle, glm::vec3(0.0f, 1.0f, 0.0f));
+        batches.submit(mesh.get(), transformation);
+      }
+      batches.flush();
+    }
+
     shader.unbindProgram();
+    uniforms.endFrame();
+
+    if (++frames == 120) {
+      long long t1 = time::getTimeMicroseconds();
+      if (culler) {
+        SSRT_DBG_OUTPUT((t1 - t0) / 1000.0 / frames << " ms/frame, 1 indirect draw for " << culler->readVisibleCount() << " of " << objects << " objects");
+      } else {
+        SSRT_DBG_OUTPUT((t1 - t0) / 1000.0 / frames << " ms/frame, " << batches.getDrawCalls() << " draw calls for " 
+                        << batches.getInstanceCount() << " of " << objects << " objects, " << scene.getTestedBoxes() << " boxes tested");
+      }
+      frames = 0;
+      t0 = t1;
+    }
   }
 }
 
@@ -137,14 +711,105 @@ int main(int argc, char const *argv[])
   SSRT_DBG_OUTPUT("Program has been initialized successfully!");
   bool success = true;
 
+  // app <mode> ... --profile=<file.csv|file.json> records every kernel launch and transfer
+  std::vector<const char*> args;
+  std::string profileOutput;
+  for (int i = 0; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--profile=", 0) == 0) {
+      profileOutput = arg.substr(10);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  size_t count = args.size();
+  std::string mode = count > 1 ? args[1] : "raster";
+  cmp::Profiler* profiler = profileOutput.empty() ? nullptr : new cmp::Profiler();
+
   try {
-    run2();
+    if (mode == "trace") {
+      // app trace [model.obj]
+      run(count > 2 ? args[2] : "");
+    } else if (mode == "headless") {
+      // app headless [width] [height] [frames] [output.png] [model.obj]
+      unsigned int w      = count > 2 ? std::stoi(args[2]) : 512;
+      unsigned int h      = count > 3 ? std::stoi(args[3]) : 512;
+      unsigned int frames = count > 4 ? std::stoi(args[4]) : 100;
+      runHeadless(w, h, frames, count > 5 ? args[5] : "frame.png", count > 6 ? args[6] : "");
+    } else if (mode == "tiled") {
+      // app tiled [width] [height] [tile width] [tile height] [output.png] [model.obj]
+      unsigned int w          = count > 2 ? std::stoi(args[2]) : 16384;
+      unsigned int h          = count > 3 ? std::stoi(args[3]) : 16384;
+      unsigned int tileWidth  = count > 4 ? std::stoi(args[4]) : 1024;
+      unsigned int tileHeight = count > 5 ? std::stoi(args[5]) : 256;
+      runTiled(w, h, tileWidth, tileHeight, count > 6 ? args[6] : "frame_tiled.png", count > 7 ? args[7] : "");
+    } else if (mode == "persistent") {
+      // app persistent [width] [height] [frames] [spheres] [output.png]
+      unsigned int w       = count > 2 ? std::stoi(args[2]) : 1280;
+      unsigned int h       = count > 3 ? std::stoi(args[3]) : 720;
+      unsigned int frames  = count > 4 ? std::stoi(args[4]) : 100;
+      unsigned int spheres = count > 5 ? std::stoi(args[5]) : 64;
+      runPersistent(w, h, frames, spheres, count > 6 ? args[6] : "frame_persistent.png");
+    } else if (mode == "multi") {
+      // app multi [width] [height] [frames] [spheres] [output.png]
+      unsigned int w       = count > 2 ? std::stoi(args[2]) : 1920;
+      unsigned int h       = count > 3 ? std::stoi(args[3]) : 1080;
+      unsigned int frames  = count > 4 ? std::stoi(args[4]) : 100;
+      unsigned int spheres = count > 5 ? std::stoi(args[5]) : 64;
+      runMultiDevice(w, h, frames, spheres, count > 6 ? args[6] : "frame_multi.png");
+    } else if (mode == "path") {
+      // app path [samples per frame]
+      runPath(count > 2 ? std::stoi(args[2]) : 1);
+    } else if (mode == "path-headless") {
+      // app path-headless [width] [height] [frames] [samples per frame] [output.png]
+      unsigned int w       = count > 2 ? std::stoi(args[2]) : 512;
+      unsigned int h       = count > 3 ? std::stoi(args[3]) : 512;
+      unsigned int frames  = count > 4 ? std::stoi(args[4]) : 64;
+      unsigned int samples = count > 5 ? std::stoi(args[5]) : 4;
+      runPathHeadless(w, h, frames, samples, count > 6 ? args[6] : "frame_path.png");
+    } else if (mode == "adaptive") {
+      // app adaptive [width] [height] [threshold] [output.png]
+      unsigned int w  = count > 2 ? std::stoi(args[2]) : 512;
+      unsigned int h  = count > 3 ? std::stoi(args[3]) : 512;
+      float threshold = count > 4 ? std::stof(args[4]) : 0.01f;
+      runAdaptive(w, h, threshold, count > 5 ? args[5] : "frame_adaptive.png");
+    } else if (mode == "wavefront") {
+      // app wavefront [width] [height] [frames] [samples per frame] [output.png]
+      unsigned int w       = count > 2 ? std::stoi(args[2]) : 512;
+      unsigned int h       = count > 3 ? std::stoi(args[3]) : 512;
+      unsigned int frames  = count > 4 ? std::stoi(args[4]) : 64;
+      unsigned int samples = count > 5 ? std::stoi(args[5]) : 4;
+      runWavefront(w, h, frames, samples, count > 6 ? args[6] : "frame_wavefront.png");
+    } else if (mode == "cpu") {
+      // app cpu [width] [height] [frames] [threads] [output.png]
+      unsigned int w       = count > 2 ? std::stoi(args[2]) : 512;
+      unsigned int h       = count > 3 ? std::stoi(args[3]) : 512;
+      unsigned int frames  = count > 4 ? std::stoi(args[4]) : 20;
+      unsigned int threads = count > 5 ? std::stoi(args[5]) : 0;
+      runCPU(w, h, frames, threads, count > 6 ? args[6] : "frame_cpu.png");
+    } else if (mode == "obj") {
+      // app obj <model.obj> [repeats] [threads]
+      unsigned int repeats = count > 3 ? std::stoi(args[3]) : 5;
+      unsigned int threads = count > 4 ? std::stoi(args[4]) : 0;
+      runOBJ(count > 2 ? args[2] : "models/cube.obj", repeats, threads);
+    } else {
+      // app [raster | gpu-cull] [objects]
+      unsigned int objects = (mode == "raster" || mode == "gpu-cull") && count > 2 ? std::stoi(args[2]) : 1;
+      run2(objects, mode == "gpu-cull");
+    }
   } 
   catch(const std::exception& e) {
     std::cerr << "[Error] " << e.what() << std::endl;
     success = false;
   }
 
+  if (profiler) {
+    profiler->print(std::cout);
+    profiler->save(profileOutput);
+    delete profiler;
+  }
+
   if (success) {
     SSRT_DBG_OUTPUT("Program has ended successfully!");
   } else {
@@ -0,0 +1,35 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    Accumulator::Accumulator(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int samplesPerPixel, cl_uint firstIndex)
+      : k(kernel), firstIndex(firstIndex), samplesPerPixel(std::max(1u, samplesPerPixel)), sampleCount(0), sceneVersion(0), resetPending(true)
+    {
+      // never read before the first frame overwrites it, so it is left uninitialised
+      cl_int error;
+      buffer = clCreateBuffer(cmp::ComputeHandler::global->getContext(), CL_MEM_READ_WRITE, (size_t) width * height * sizeof(cl_float4), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+      k->setMemoryArg(firstIndex, buffer);
+    }
+
+    Accumulator::~Accumulator()
+    {
+      clReleaseMemObject(buffer);
+    }
+
+    void Accumulator::nextFrame(const Scene& scene)
+    {
+      if (resetPending || scene.getVersion() != sceneVersion) {
+        sceneVersion = scene.getVersion();
+        sampleCount = 0;
+        resetPending = false;
+      }
+
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), firstIndex + 1, sizeof(unsigned int), &sampleCount));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), firstIndex + 2, sizeof(unsigned int), &samplesPerPixel));
+      sampleCount += samplesPerPixel;
+    }
+  }
+}
@@ -0,0 +1,125 @@
+#include "render.h"
+
+#include <cstring>
+#include <numeric>
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    // kernel parameters after the scene arguments
+    static const cl_uint ADAPTIVE_TILE_SAMPLES = 13;
+    static const cl_uint ADAPTIVE_ACTIVE_TILES = 14;
+    static const cl_uint ADAPTIVE_TILE_ERRORS = 15;
+    static const cl_uint ADAPTIVE_TILE_SIZE = 16;
+    static const cl_uint ADAPTIVE_SAMPLES_PER_PASS = 17;
+
+    // resolve kernel parameters after the image and its size
+    static const cl_uint RESOLVE_ACCUMULATION = 3;
+    static const cl_uint RESOLVE_TILE_SAMPLES = 4;
+    static const cl_uint RESOLVE_TILE_SIZE = 5;
+
+    // work-group edge, tiles are a multiple of it so groups never straddle tiles
+    static const unsigned int ADAPTIVE_GROUP_SIZE = 8;
+
+    AdaptiveSampler::AdaptiveSampler(cmp::ComputeKernel* kernel, cmp::ComputeKernel* resolve, unsigned int width, unsigned int height, 
+      unsigned int tileSize, unsigned int samplesPerPass, float threshold)
+      : k(kernel), resolveKernel(resolve), width(width), height(height), samplesPerPass(std::max(1u, samplesPerPass)), 
+        minSamples(16), maxSamples(4096), threshold(threshold), sceneVersion(0), samplesTraced(0), resetPending(true)
+    {
+      this->tileSize = std::max(1u, (tileSize + ADAPTIVE_GROUP_SIZE - 1) / ADAPTIVE_GROUP_SIZE) * ADAPTIVE_GROUP_SIZE;
+      tilesX = (width + this->tileSize - 1) / this->tileSize;
+      tilesY = (height + this->tileSize - 1) / this->tileSize;
+      errors.resize((size_t) tilesX * tilesY);
+
+      cl_int error;
+      cl_context context = cmp::ComputeHandler::global->getContext();
+      accumulation = clCreateBuffer(context, CL_MEM_READ_WRITE, (size_t) width * height * sizeof(cl_float4), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+      tileErrors = clCreateBuffer(context, CL_MEM_READ_WRITE, errors.size() * sizeof(cl_int), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+
+      k->setMemoryArg(0, accumulation);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 1, sizeof(unsigned int), &width));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 2, sizeof(unsigned int), &height));
+      k->setMemoryArg(ADAPTIVE_TILE_ERRORS, tileErrors);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), ADAPTIVE_TILE_SIZE, sizeof(unsigned int), &this->tileSize));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), ADAPTIVE_SAMPLES_PER_PASS, sizeof(unsigned int), &this->samplesPerPass));
+
+      resolveKernel->setMemoryArg(RESOLVE_ACCUMULATION, accumulation);
+      cmp::ComputeHandler::handleError(clSetKernelArg(resolveKernel->getKernel(), RESOLVE_TILE_SIZE, sizeof(unsigned int), &this->tileSize));
+    }
+
+    AdaptiveSampler::~AdaptiveSampler()
+    {
+      clReleaseMemObject(accumulation);
+      clReleaseMemObject(tileErrors);
+    }
+
+    void AdaptiveSampler::upload(cl_command_queue queue)
+    {
+      size_t uploaded = 0;
+      if (tileSamples.upload(queue, uploaded)) {
+        k->setMemoryArg(ADAPTIVE_TILE_SAMPLES, tileSamples.getBuffer());
+        resolveKernel->setMemoryArg(RESOLVE_TILE_SAMPLES, tileSamples.getBuffer());
+      }
+      if (activeTiles.upload(queue, uploaded)) {
+        k->setMemoryArg(ADAPTIVE_ACTIVE_TILES, activeTiles.getBuffer());
+      }
+    }
+
+    bool AdaptiveSampler::pass(cl_command_queue queue, const Scene& scene)
+    {
+      size_t tileCount = getTileCount();
+
+      if (resetPending || scene.getVersion() != sceneVersion) {
+        sceneVersion = scene.getVersion();
+        resetPending = false;
+        samplesTraced = 0;
+
+        std::vector<cl_uint> tiles(tileCount);
+        std::iota(tiles.begin(), tiles.end(), 0);
+        tileSamples.assign(std::vector<cl_uint>(tileCount, 0));
+        activeTiles.assign(tiles);
+      }
+
+      if (activeTiles.size() == 0) {
+        return false;
+      }
+
+      upload(queue);
+
+      // errors are combined with atomic_max on their bit patterns, which order like the floats since they are positive
+      cl_int zero = 0;
+      cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, tileErrors, &zero, sizeof(zero), 0, tileCount * sizeof(cl_int), 0, NULL, NULL));
+
+      size_t globalSize[] = { tileSize, tileSize, activeTiles.size() };
+      size_t localSize[] = { ADAPTIVE_GROUP_SIZE, ADAPTIVE_GROUP_SIZE, 1 };
+      k->enqueue(queue, 3, NULL, globalSize, localSize);
+
+      // a few kilobytes, the only host sync of a pass
+      cmp::ComputeHandler::handleError(clEnqueueReadBuffer(queue, tileErrors, CL_TRUE, 0, tileCount * sizeof(cl_int), errors.data(), 0, NULL, NULL));
+
+      std::vector<cl_uint> remaining;
+      for (cl_uint tile : activeTiles.getHost()) {
+        cl_uint samples = tileSamples.getHost()[tile] + samplesPerPass;
+        tileSamples.set(tile, samples);
+
+        unsigned int tileWidth = std::min(tileSize, width - (tile % tilesX) * tileSize);
+        unsigned int tileHeight = std::min(tileSize, height - (tile / tilesX) * tileSize);
+        samplesTraced += (unsigned long long) tileWidth * tileHeight * samplesPerPass;
+
+        float error;
+        std::memcpy(&error, &errors[tile], sizeof(float));
+        if (samples < maxSamples && (samples < minSamples || error > threshold)) {
+          remaining.push_back(tile);
+        }
+      }
+      activeTiles.assign(remaining);
+
+      // the device counts then include this pass, which is what both the next pass and the resolve expect
+      upload(queue);
+      return true;
+    }
+  }
+}
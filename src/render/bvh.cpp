@@ -0,0 +1,228 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    static const int BVH_BINS = 16;
+    static const int BVH_MAX_LEAF_SIZE = 4;
+
+    // must match BVH_STACK_SIZE in res/cl/ray_trace.cl
+    static const unsigned int BVH_MAX_DEPTH = 64;
+
+    struct BVHBin
+    {
+      glm::vec3 bmin = glm::vec3(INFINITY);
+      glm::vec3 bmax = glm::vec3(-INFINITY);
+      unsigned int count = 0;
+
+      inline void grow(glm::vec3 lo, glm::vec3 hi) {
+        bmin = glm::min(bmin, lo);
+        bmax = glm::max(bmax, hi);
+      }
+    };
+
+    static float surfaceArea(glm::vec3 bmin, glm::vec3 bmax)
+    {
+      glm::vec3 e = bmax - bmin;
+      return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    static cl_float4 toFloat4(glm::vec3 v)
+    {
+      cl_float4 f;
+      f.s[0] = v.x;
+      f.s[1] = v.y;
+      f.s[2] = v.z;
+      f.s[3] = 0.0f;
+      return f;
+    }
+
+    BVH::BVH(const io::MeshData& mesh, glm::mat4 transform)
+      : BVH(mesh.positions.data(), 3, mesh.indices.data(), mesh.indices.size(), transform)
+    {
+    }
+
+    BVH::BVH(const float* positions, size_t stride, const unsigned int* indices, size_t indexCount, glm::mat4 transform) : depth(0)
+    {
+      long long t0 = time::getTimeMicroseconds();
+      size_t count = indexCount / 3;
+
+      std::vector<glm::vec3> vertices(count * 3);
+      std::vector<glm::vec3> centroids(count);
+      std::vector<glm::vec3> bounds(count * 2);
+      std::vector<unsigned int> order(count);
+
+      for (size_t i = 0; i < count * 3; i++) {
+        const float* p = positions + (size_t) indices[i] * stride;
+        vertices[i] = glm::vec3(transform * glm::vec4(p[0], p[1], p[2], 1.0f));
+      }
+
+      for (size_t i = 0; i < count; i++) {
+        glm::vec3 a = vertices[i * 3], b = vertices[i * 3 + 1], c = vertices[i * 3 + 2];
+        centroids[i] = (a + b + c) / 3.0f;
+        bounds[i * 2] = glm::min(a, glm::min(b, c));
+        bounds[i * 2 + 1] = glm::max(a, glm::max(b, c));
+        order[i] = (unsigned int) i;
+      }
+
+      // worst case of one triangle per leaf
+      nodes.reserve(count * 2);
+
+      BVHNode root = {};
+      root.leftFirst = 0;
+      root.count = (cl_int) count;
+      nodes.push_back(root);
+      updateBounds(0, order, bounds);
+
+      // depth-first build keeps the node stack bounded by the tree depth
+      std::vector<std::pair<unsigned int, unsigned int>> stack = { { 0, 1 } };
+      while (!stack.empty()) {
+        auto [nodeIndex, level] = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, level);
+
+        if (level < BVH_MAX_DEPTH && subdivide(nodeIndex, order, centroids, bounds)) {
+          unsigned int left = nodes[nodeIndex].leftFirst;
+          stack.push_back({ left + 1, level + 1 });
+          stack.push_back({ left, level + 1 });
+        }
+      }
+
+      // stores triangles in leaf order so leaves address contiguous ranges
+      triangles.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        unsigned int t = order[i];
+        glm::vec3 a = vertices[t * 3], b = vertices[t * 3 + 1], c = vertices[t * 3 + 2];
+        triangles[i].v0 = toFloat4(a);
+        triangles[i].e1 = toFloat4(b - a);
+        triangles[i].e2 = toFloat4(c - a);
+        triangles[i].normal = toFloat4(glm::normalize(glm::cross(b - a, c - a)));
+      }
+
+      SSRT_DBG_OUTPUT("Built BVH: " << count << " triangles, " << nodes.size() << " nodes, depth " << depth
+        << " in " << (time::getTimeMicroseconds() - t0) / 1000.0 << " ms");
+    }
+
+    void BVH::updateBounds(unsigned int nodeIndex, const std::vector<unsigned int>& order, const std::vector<glm::vec3>& bounds)
+    {
+      BVHNode& node = nodes[nodeIndex];
+      glm::vec3 bmin = glm::vec3(INFINITY);
+      glm::vec3 bmax = glm::vec3(-INFINITY);
+
+      for (cl_int i = 0; i < node.count; i++) {
+        unsigned int t = order[node.leftFirst + i];
+        bmin = glm::min(bmin, bounds[t * 2]);
+        bmax = glm::max(bmax, bounds[t * 2 + 1]);
+      }
+
+      for (int a = 0; a < 3; a++) {
+        node.bmin[a] = bmin[a];
+        node.bmax[a] = bmax[a];
+      }
+    }
+
+    bool BVH::subdivide(unsigned int nodeIndex, std::vector<unsigned int>& order, const std::vector<glm::vec3>& centroids, const std::vector<glm::vec3>& bounds)
+    {
+      BVHNode node = nodes[nodeIndex];
+      if (node.count <= BVH_MAX_LEAF_SIZE) {
+        return false;
+      }
+
+      // bins are placed over the centroid bounds rather than the node bounds
+      glm::vec3 cmin = glm::vec3(INFINITY);
+      glm::vec3 cmax = glm::vec3(-INFINITY);
+      for (cl_int i = 0; i < node.count; i++) {
+        glm::vec3 c = centroids[order[node.leftFirst + i]];
+        cmin = glm::min(cmin, c);
+        cmax = glm::max(cmax, c);
+      }
+
+      int bestAxis = -1;
+      int bestSplit = 0;
+      float bestCost = INFINITY;
+
+      for (int axis = 0; axis < 3; axis++) {
+        float extent = cmax[axis] - cmin[axis];
+        if (extent <= 0.0f) {
+          continue;
+        }
+
+        BVHBin bins[BVH_BINS];
+        float scale = BVH_BINS / extent;
+        for (cl_int i = 0; i < node.count; i++) {
+          unsigned int t = order[node.leftFirst + i];
+          int b = std::min(BVH_BINS - 1, (int) ((centroids[t][axis] - cmin[axis]) * scale));
+          bins[b].count++;
+          bins[b].grow(bounds[t * 2], bounds[t * 2 + 1]);
+        }
+
+        // sweeps from both sides to evaluate every split plane in linear time
+        float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+        unsigned int leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+        BVHBin left, right;
+        unsigned int leftSum = 0, rightSum = 0;
+
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+          leftSum += bins[i].count;
+          leftCount[i] = leftSum;
+          left.grow(bins[i].bmin, bins[i].bmax);
+          leftArea[i] = leftSum ? surfaceArea(left.bmin, left.bmax) : 0.0f;
+
+          rightSum += bins[BVH_BINS - 1 - i].count;
+          rightCount[BVH_BINS - 2 - i] = rightSum;
+          right.grow(bins[BVH_BINS - 1 - i].bmin, bins[BVH_BINS - 1 - i].bmax);
+          rightArea[BVH_BINS - 2 - i] = rightSum ? surfaceArea(right.bmin, right.bmax) : 0.0f;
+        }
+
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+          float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+          if (leftCount[i] > 0 && rightCount[i] > 0 && cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestSplit = i;
+          }
+        }
+      }
+
+      glm::vec3 bmin = glm::vec3(node.bmin[0], node.bmin[1], node.bmin[2]);
+      glm::vec3 bmax = glm::vec3(node.bmax[0], node.bmax[1], node.bmax[2]);
+      float leafCost = node.count * surfaceArea(bmin, bmax);
+      if (bestAxis < 0 || bestCost >= leafCost) {
+        return false;
+      }
+
+      // partitions triangle indices around the chosen bin boundary
+      float scale = BVH_BINS / (cmax[bestAxis] - cmin[bestAxis]);
+      auto first = order.begin() + node.leftFirst;
+      auto mid = std::partition(first, first + node.count, [&](unsigned int t) {
+        int b = std::min(BVH_BINS - 1, (int) ((centroids[t][bestAxis] - cmin[bestAxis]) * scale));
+        return b <= bestSplit;
+      });
+      cl_int leftCount = (cl_int) (mid - first);
+
+      unsigned int leftIndex = (unsigned int) nodes.size();
+      BVHNode child = {};
+      child.leftFirst = node.leftFirst;
+      child.count = leftCount;
+      nodes.push_back(child);
+      child.leftFirst = node.leftFirst + leftCount;
+      child.count = node.count - leftCount;
+      nodes.push_back(child);
+
+      updateBounds(leftIndex, order, bounds);
+      updateBounds(leftIndex + 1, order, bounds);
+
+      nodes[nodeIndex].leftFirst = (cl_int) leftIndex;
+      nodes[nodeIndex].count = 0;
+      return true;
+    }
+
+    void BVH::upload(cmp::ComputeKernel* kernel, cl_uint nodeIndex, cl_uint triangleIndex)
+    {
+      cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+      kernel->createBuffer(nodeIndex, flags, nodes.size() * sizeof(BVHNode), nodes.data());
+      kernel->createBuffer(triangleIndex, flags, triangles.size() * sizeof(BVHTriangle), triangles.data());
+    }
+  }
+}
@@ -0,0 +1,279 @@
+#include "render.h"
+
+#include <limits>
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    /* Host port of the scene logic in res/cl/ray_trace.cl, keep in sync with the kernel. */
+
+    static const float EPSILON = 0.00001f;
+    static const float AMBIENT = 0.05f;
+    static const float SHADOW_BIAS = 0.0001f;
+
+    struct Ray
+    {
+      glm::vec3 pos;
+      glm::vec3 dir;
+    };
+
+    struct RayHit
+    {
+      float dist;
+      glm::vec3 pos;
+      glm::vec3 normal;
+    };
+
+    struct Sphere
+    {
+      glm::vec3 center;
+      float radius;
+    };
+
+    struct Plane
+    {
+      glm::vec3 normal;
+      float d;
+    };
+
+    static Ray createCameraRay(glm::vec2 coord, glm::vec2 dim)
+    {
+      float ux = coord.x / dim.x;
+      float uy = coord.y / dim.y;
+      float aspect = dim.x / dim.y;
+
+      float wx = (ux - 0.5f) * aspect;
+      float wy = (uy - 0.5f);
+
+      // rows are bottom-up to match OpenGL textures
+      glm::vec3 px = glm::vec3(wx, wy, 0.0f);
+
+      Ray r;
+      r.pos = glm::vec3(0.0f, 0.0f, 1.0f);
+      r.dir = glm::normalize(px - r.pos);
+      return r;
+    }
+
+    static RayHit raySphereIntersect(const Ray& ray, const Sphere& sphere)
+    {
+      glm::vec3 ray2center = sphere.center - ray.pos;
+
+      float b = -2.0f * glm::dot(ray2center, ray.dir);
+      float c = glm::dot(ray2center, ray2center) - sphere.radius * sphere.radius;
+
+      float discriminant = b * b - 4 * c;
+
+      RayHit hit = { 0.0f, glm::vec3(0.0f), glm::vec3(0.0f) };
+
+      if (discriminant < 0.0f) {
+        return hit;
+      }
+
+      discriminant = std::sqrt(discriminant);
+      float lambda = std::min((-b + discriminant) / 2, (-b - discriminant) / 2);
+
+      if (lambda > EPSILON) {
+        hit.dist = lambda;
+        hit.pos = lambda * ray.dir + ray.pos;
+        hit.normal = glm::normalize(hit.pos - sphere.center);
+      }
+
+      return hit;
+    }
+
+    static RayHit rayPlaneIntersect(const Ray& ray, const Plane& plane)
+    {
+      float a = plane.d + glm::dot(plane.normal, ray.pos);
+      float b = glm::dot(plane.normal, ray.dir);
+
+      RayHit hit = { 0.0f, glm::vec3(0.0f), glm::vec3(0.0f) };
+
+      // points on the plane satisfy dot(normal, p) + d = 0
+      if (b != 0.0f) {
+        hit.dist = -a / b;
+        hit.pos = hit.dist * ray.dir + ray.pos;
+        hit.normal = plane.normal;
+      }
+
+      return hit;
+    }
+
+    static glm::vec3 toVec3(const cl_float4& f)
+    {
+      return glm::vec3(f.s[0], f.s[1], f.s[2]);
+    }
+
+    static bool sceneOccluded(const Ray& ray, const Scene& scene, float maxDist)
+    {
+      const std::vector<cl_float4>& spheres = scene.getSphereGeometry();
+      const std::vector<cl_float4>& planes = scene.getPlaneGeometry();
+
+      for (size_t i = 0; i < spheres.size(); i++) {
+        Sphere sphere = { toVec3(spheres[i]), spheres[i].s[3] };
+
+        RayHit hit = raySphereIntersect(ray, sphere);
+        if (hit.dist > 0.0f && hit.dist < maxDist) {
+          return true;
+        }
+      }
+
+      for (size_t i = 0; i < planes.size(); i++) {
+        Plane plane = { toVec3(planes[i]), planes[i].s[3] };
+
+        RayHit hit = rayPlaneIntersect(ray, plane);
+        if (hit.dist > EPSILON && hit.dist < maxDist) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    static glm::vec4 shadeHit(const Ray& ray, const RayHit& hit, int material, const Scene& scene)
+    {
+      // planes are two sided so face the normal towards the viewer
+      glm::vec3 normal = glm::dot(hit.normal, ray.dir) > 0.0f ? -hit.normal : hit.normal;
+      glm::vec3 albedo = toVec3(scene.getMaterialColours()[material]);
+      glm::vec3 colour = albedo * AMBIENT;
+
+      const std::vector<cl_float4>& lights = scene.getLightPositions();
+      for (size_t i = 0; i < lights.size(); i++) {
+        glm::vec3 toLight = toVec3(lights[i]) - hit.pos;
+        float dist = glm::length(toLight);
+        glm::vec3 dir = toLight / dist;
+
+        float lambert = glm::dot(normal, dir);
+        if (lambert <= 0.0f) {
+          continue;
+        }
+
+        Ray shadow = { hit.pos + normal * SHADOW_BIAS, dir };
+
+        if (!sceneOccluded(shadow, scene, dist)) {
+          colour += albedo * toVec3(scene.getLightColours()[i]) * lambert;
+        }
+      }
+
+      return glm::vec4(colour, 1.0f);
+    }
+
+    // matches write_imagef conversion to CL_UNORM_INT8 (saturate, round to nearest)
+    static unsigned char toUnorm8(float f)
+    {
+      return (unsigned char) std::lround(std::clamp(f, 0.0f, 1.0f) * 255.0f);
+    }
+
+    // ----- CPU Ray Tracer ----- //
+
+    CPURayTracer::CPURayTracer(jobs::ThreadPool* pool, const Scene* scene, unsigned int width, unsigned int height, unsigned int tileSize)
+      : pool(pool), scene(scene), width(width), height(height), tileSize(tileSize)
+    {
+      resetStats();
+    }
+
+    void CPURayTracer::resetStats()
+    {
+      stats.assign(pool->getThreadCount(), ThreadStats{ 0, 0, 0 });
+    }
+
+    void CPURayTracer::execute(unsigned char* pixels)
+    {
+      // the scene may have changed since the last frame, its SoA copy is cheap to rebuild
+      spheres = simd::Spheres();
+      for (const cl_float4& s : scene->getSphereGeometry()) {
+        spheres.add(s.s[0], s.s[1], s.s[2], s.s[3]);
+      }
+      planes = simd::Planes();
+      for (const cl_float4& p : scene->getPlaneGeometry()) {
+        planes.add(p.s[0], p.s[1], p.s[2], p.s[3]);
+      }
+
+      size_t tilesX = (width + tileSize - 1) / tileSize;
+      size_t tilesY = (height + tileSize - 1) / tileSize;
+
+      pool->parallelFor(tilesX * tilesY, [this, pixels](size_t tile, unsigned int thread) {
+        long long t0 = time::getTimeMicroseconds();
+        unsigned long long rays = traceTile(tile, pixels);
+
+        // each worker only touches its own entry
+        ThreadStats& s = stats[thread];
+        s.busyMicroseconds += time::getTimeMicroseconds() - t0;
+        s.rays += rays;
+        s.tiles++;
+      });
+    }
+
+    unsigned long long CPURayTracer::traceTile(size_t tile, unsigned char* pixels) const
+    {
+      size_t tilesX = (width + tileSize - 1) / tileSize;
+      unsigned int x0 = (unsigned int) (tile % tilesX) * tileSize;
+      unsigned int y0 = (unsigned int) (tile / tilesX) * tileSize;
+      unsigned int x1 = std::min(x0 + tileSize, width);
+      unsigned int y1 = std::min(y0 + tileSize, height);
+
+      // primary rays of the tile are intersected as packets, shading and shadow rays stay scalar
+      size_t count = (size_t) (x1 - x0) * (y1 - y0);
+      std::vector<float> origins[3], directions[3];
+      for (int axis = 0; axis < 3; axis++) {
+        origins[axis].resize(count);
+        directions[axis].resize(count);
+      }
+      std::vector<float> dists(count, std::numeric_limits<float>::infinity());
+      std::vector<int> primitives(count, -1);
+      std::vector<Ray> rays(count);
+
+      for (unsigned int y = y0, i = 0; y < y1; y++) {
+        for (unsigned int x = x0; x < x1; x++, i++) {
+          rays[i] = createCameraRay(glm::vec2((float) x, (float) y), glm::vec2((float) width, (float) height));
+          for (int axis = 0; axis < 3; axis++) {
+            origins[axis][i] = rays[i].pos[axis];
+            directions[axis][i] = rays[i].dir[axis];
+          }
+        }
+      }
+
+      simd::RayStream stream = { 
+        origins[0].data(), origins[1].data(), origins[2].data(), 
+        directions[0].data(), directions[1].data(), directions[2].data(), 
+        dists.data(), primitives.data(), count 
+      };
+      int sphereCount = (int) spheres.size();
+      intersector.intersect(stream, spheres);
+      intersector.intersect(stream, planes, sphereCount);
+
+      for (unsigned int y = y0, i = 0; y < y1; y++) {
+        unsigned char* row = pixels + ((size_t) y * width) * 4;
+
+        for (unsigned int x = x0; x < x1; x++, i++) {
+          glm::vec4 color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+          int primitive = primitives[i];
+          if (primitive >= 0) {
+            RayHit hit;
+            hit.dist = dists[i];
+            hit.pos = rays[i].pos + rays[i].dir * hit.dist;
+
+            int material;
+            if (primitive < sphereCount) {
+              glm::vec3 center = toVec3(scene->getSphereGeometry()[primitive]);
+              hit.normal = glm::normalize(hit.pos - center);
+              material = scene->getSphereMaterials()[primitive];
+            } else {
+              hit.normal = toVec3(scene->getPlaneGeometry()[primitive - sphereCount]);
+              material = scene->getPlaneMaterials()[primitive - sphereCount];
+            }
+            color = shadeHit(rays[i], hit, material, *scene);
+          }
+
+          row[x * 4]     = toUnorm8(color.x);
+          row[x * 4 + 1] = toUnorm8(color.y);
+          row[x * 4 + 2] = toUnorm8(color.z);
+          row[x * 4 + 3] = toUnorm8(color.w);
+        }
+      }
+
+      return (unsigned long long) (x1 - x0) * (y1 - y0);
+    }
+  }
+}
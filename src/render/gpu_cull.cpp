@@ -0,0 +1,173 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    GPUCuller::GPUCuller(cmp::ComputeKernel* kernel, const gfx::Mesh* mesh, const std::vector<glm::mat4>& instanceTransforms, 
+      const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, unsigned int frameCount)
+      : k(kernel), mesh(mesh), instanceCount((unsigned int) instanceTransforms.size()), groupSize(64), frame(0)
+    {
+      frameCount = std::max(2u, frameCount);
+      cl_context context = cmp::ComputeHandler::global->getContext();
+      cl_int error;
+
+      // static per-instance data lives on the device only, 16 floats per matrix and two float4 per box
+      std::vector<float> boxData(std::max<size_t>(instanceCount, 1) * 8, 0.0f);
+      for (unsigned int i = 0; i < instanceCount; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+          boxData[i * 8 + axis] = mins[i][axis];
+          boxData[i * 8 + 4 + axis] = maxs[i][axis];
+        }
+      }
+
+      size_t transformBytes = std::max<size_t>(instanceCount, 1) * sizeof(glm::mat4);
+      transforms = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, transformBytes, 
+        instanceCount ? (void*) instanceTransforms.data() : boxData.data(), &error);
+      cmp::ComputeHandler::handleError(error);
+      bounds = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, boxData.size() * sizeof(float), boxData.data(), &error);
+      cmp::ComputeHandler::handleError(error);
+      planes = clCreateBuffer(context, CL_MEM_READ_ONLY, 6 * 4 * sizeof(float), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+
+      DrawCommand command = { (GLuint) mesh->getVertexCount(), 0, 0, 0, 0 };
+
+      for (unsigned int i = 0; i < frameCount; i++) {
+        GLuint buffers[2];
+        glGenBuffers(2, buffers);
+
+        // sized for every instance being visible, the kernel never writes past the count it appends
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) transformBytes, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[1]);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand), &command, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        instanceBuffers.push_back(buffers[0]);
+        commandBuffers.push_back(buffers[1]);
+
+        // owned here rather than by the kernel so they are released before their GL buffers
+        sharedInstances.push_back(clCreateFromGLBuffer(context, CL_MEM_WRITE_ONLY, buffers[0], &error));
+        cmp::ComputeHandler::handleError(error);
+        sharedCommands.push_back(clCreateFromGLBuffer(context, CL_MEM_READ_WRITE, buffers[1], &error));
+        cmp::ComputeHandler::handleError(error);
+      }
+
+      culled.resize(frameCount, NULL);
+      drawn.resize(frameCount, NULL);
+      planeData.resize(frameCount * 6 * 4);
+      glEvents = GLEW_ARB_cl_event;
+
+      // the buffers must be complete before OpenCL first acquires them
+      glFinish();
+
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 0, sizeof(cl_mem), &transforms));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 1, sizeof(cl_mem), &bounds));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 2, sizeof(cl_mem), &planes));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 3, sizeof(unsigned int), &instanceCount));
+      SSRT_DBG_OUTPUT("Created GPU Culler: " << instanceCount << " instances, " << frameCount << " frames in flight, " 
+                      << (glEvents ? "shared events" : "host synchronisation"));
+    }
+
+    GPUCuller::~GPUCuller()
+    {
+      clFinish(cmp::ComputeHandler::global->getQueue(0));
+      glFinish();
+
+      for (size_t i = 0; i < instanceBuffers.size(); i++) {
+        if (culled[i]) clReleaseEvent(culled[i]);
+        if (drawn[i]) glDeleteSync(drawn[i]);
+        clReleaseMemObject(sharedInstances[i]);
+        clReleaseMemObject(sharedCommands[i]);
+      }
+
+      glDeleteBuffers((GLsizei) instanceBuffers.size(), instanceBuffers.data());
+      glDeleteBuffers((GLsizei) commandBuffers.size(), commandBuffers.data());
+      clReleaseMemObject(transforms);
+      clReleaseMemObject(bounds);
+      clReleaseMemObject(planes);
+    }
+
+    void GPUCuller::cull(cl_command_queue queue, const gfx::Frustum& frustum)
+    {
+      size_t slot = frame % instanceBuffers.size();
+
+      // the set is rewritten only once the draw that last read it is done, normally long ago
+      if (drawn[slot]) {
+        glClientWaitSync(drawn[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(drawn[slot]);
+        drawn[slot] = NULL;
+      }
+
+      if (culled[slot]) {
+        clReleaseEvent(culled[slot]);
+        culled[slot] = NULL;
+      }
+
+      // each slot keeps its own copy since the write is not waited on
+      float* slotPlanes = &planeData[slot * 6 * 4];
+      std::copy(frustum.getPlanes(), frustum.getPlanes() + 6 * 4, slotPlanes);
+
+      cl_mem shared[] = { sharedInstances[slot], sharedCommands[slot] };
+      cl_uint zero = 0;
+      size_t globalSize = (instanceCount + groupSize - 1) / groupSize * groupSize;
+
+      cmp::ComputeHandler::handleError(clEnqueueAcquireGLObjects(queue, 2, shared, 0, NULL, NULL));
+      cmp::ComputeHandler::handleError(clEnqueueWriteBuffer(queue, planes, CL_FALSE, 0, 6 * 4 * sizeof(float), slotPlanes, 0, NULL, NULL));
+      cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, sharedCommands[slot], &zero, sizeof(zero), 
+        offsetof(DrawCommand, instanceCount), sizeof(zero), 0, NULL, NULL));
+
+      k->setMemoryArg(4, sharedInstances[slot]);
+      k->setMemoryArg(5, sharedCommands[slot]);
+      if (globalSize > 0) {
+        k->enqueue(queue, 1, NULL, &globalSize, &groupSize);
+      }
+
+      cmp::ComputeHandler::handleError(clEnqueueReleaseGLObjects(queue, 2, shared, 0, NULL, &culled[slot]));
+      cmp::ComputeHandler::handleError(clFlush(queue));
+    }
+
+    void GPUCuller::draw()
+    {
+      size_t slot = frame % instanceBuffers.size();
+      if (!culled[slot]) {
+        return;
+      }
+
+      if (glEvents) {
+        // the GL server waits for the cull, deleting the sync only flags it until the wait is done
+        GLsync sync = glCreateSyncFromCLeventARB(cmp::ComputeHandler::global->getContext(), culled[slot], 0);
+        glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(sync);
+      } else {
+        cmp::ComputeHandler::handleError(clWaitForEvents(1, &culled[slot]));
+      }
+
+      mesh->bindMesh();
+      gfx::bindInstanceTransforms(instanceBuffers[slot], 0);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffers[slot]);
+      glDrawElementsIndirect(GL_TRIANGLES, mesh->getIndexType(), 0);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      mesh->unbindMesh();
+
+      drawn[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      frame++;
+    }
+
+    unsigned int GPUCuller::readVisibleCount() const
+    {
+      if (frame == 0) {
+        return 0;
+      }
+
+      DrawCommand command = {};
+      size_t slot = (frame - 1) % instanceBuffers.size();
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffers[slot]);
+      glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawCommand), &command);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      return command.instanceCount;
+    }
+  }
+}
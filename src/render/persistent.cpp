@@ -0,0 +1,45 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    PersistentScheduler::PersistentScheduler(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int tileSize, 
+      size_t groupSize, unsigned int groupsPerUnit, cl_uint firstIndex)
+      : k(kernel), firstIndex(firstIndex), tileSize(std::max(1u, tileSize))
+    {
+      tileCount = ((width + this->tileSize - 1) / this->tileSize) * ((height + this->tileSize - 1) / this->tileSize);
+
+      size_t maxGroupSize = 0;
+      cmp::ComputeHandler* handler = cmp::ComputeHandler::global;
+      cmp::ComputeHandler::handleError(clGetKernelWorkGroupInfo(k->getKernel(), handler->getDevice(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxGroupSize, NULL));
+      groupSize = std::max<size_t>(1, std::min(groupSize, maxGroupSize));
+
+      // enough groups to keep every unit busy, but never more than there are tiles to share
+      size_t groups = std::min<size_t>((size_t) handler->getComputeUnits() * std::max(1u, groupsPerUnit), tileCount);
+      launch.local[0] = groupSize;
+      launch.local[1] = 1;
+      launch.global[0] = groups * groupSize;
+      launch.global[1] = 1;
+
+      cl_int error;
+      tileCounter = clCreateBuffer(handler->getContext(), CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+      k->setMemoryArg(firstIndex, tileCounter);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), firstIndex + 1, sizeof(unsigned int), &this->tileSize));
+
+      SSRT_DBG_OUTPUT("Persistent launch: " << groups << " groups of " << groupSize << " sharing " << tileCount << " tiles");
+    }
+
+    PersistentScheduler::~PersistentScheduler()
+    {
+      clReleaseMemObject(tileCounter);
+    }
+
+    void PersistentScheduler::prepare(cl_command_queue queue)
+    {
+      cl_uint zero = 0;
+      cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, tileCounter, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL));
+    }
+  }
+}
@@ -0,0 +1,187 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    // ----- Ray Tracer ----- //
+
+    RayTracer::RayTracer(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int frameCount)
+      : k(kernel), width(width), height(height), submitted(0), displayed(0), createEventFromGLsync(nullptr)
+    {
+      frameCount = std::max(2u, frameCount);
+
+      for (unsigned int i = 0; i < frameCount; i++) {
+        gfx::Texture* texture = new gfx::Texture("Colour Buffer " + std::to_string(i), GL_TEXTURE_2D);
+        texture->bind(0);
+        texture->storeTexture2D(width, height, 0, nullptr);
+        texture->genMipmaps();
+        texture->unbind(0);
+
+        gfx::Framebuffer* framebuffer = new gfx::Framebuffer(width, height);
+        framebuffer->bindFramebuffer();
+        framebuffer->attachTexture(*texture, GL_COLOR_ATTACHMENT0);
+        framebuffer->unbindFramebuffer();
+        framebuffer->complete();
+
+        textures.push_back(texture);
+        framebuffers.push_back(framebuffer);
+
+        // owned here rather than by the kernel so they are released before their textures
+        cl_int error;
+        images.push_back(clCreateFromGLTexture(cmp::ComputeHandler::global->getContext(), CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, texture->getTextureId(), &error));
+        cmp::ComputeHandler::handleError(error);
+      }
+
+      traced.resize(frameCount, NULL);
+      presented.resize(frameCount, NULL);
+      acquireWaits.resize(frameCount, NULL);
+      acquireSyncs.resize(frameCount, NULL);
+
+      // both directions are needed to keep every wait off the host
+      cmp::ComputeHandler* handler = cmp::ComputeHandler::global;
+      if (handler->hasExtension("cl_khr_gl_event") && GLEW_ARB_cl_event) {
+        createEventFromGLsync = (CreateEventFromGLsyncFn) clGetExtensionFunctionAddressForPlatform(handler->getPlatform(), "clCreateEventFromGLsyncKHR");
+      }
+      glEvents = createEventFromGLsync != nullptr;
+
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 1, sizeof(unsigned int), &width));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 2, sizeof(unsigned int), &height));
+      SSRT_DBG_OUTPUT("Created Ray Tracer: " << frameCount << " frames in flight, " << (glEvents ? "shared events" : "host synchronisation"));
+    }
+
+    RayTracer::~RayTracer()
+    {
+      clFinish(cmp::ComputeHandler::global->getQueue(0));
+
+      for (size_t i = 0; i < images.size(); i++) {
+        clReleaseMemObject(images[i]);
+        if (traced[i]) clReleaseEvent(traced[i]);
+        if (acquireWaits[i]) clReleaseEvent(acquireWaits[i]);
+        if (acquireSyncs[i]) glDeleteSync(acquireSyncs[i]);
+        if (presented[i]) glDeleteSync(presented[i]);
+        delete framebuffers[i];
+        delete textures[i];
+      }
+    }
+
+    void RayTracer::execute(const size_t* localSize, const size_t* globalSize)
+    {
+      cl_command_queue queue = cmp::ComputeHandler::global->getQueue(0);
+      size_t slot = submitted % images.size();
+
+      // the fence the previous acquire of this slot waited on can only be deleted once that wait is over
+      if (acquireWaits[slot]) {
+        cmp::ComputeHandler::handleError(clWaitForEvents(1, &acquireWaits[slot]));
+        clReleaseEvent(acquireWaits[slot]);
+        glDeleteSync(acquireSyncs[slot]);
+        acquireWaits[slot] = NULL;
+        acquireSyncs[slot] = NULL;
+      }
+
+      if (traced[slot]) {
+        clReleaseEvent(traced[slot]);
+        traced[slot] = NULL;
+      }
+
+      // the texture must not be written while the blit of its last frame is still reading it
+      if (presented[slot]) {
+        if (glEvents) {
+          cl_int error;
+          acquireWaits[slot] = createEventFromGLsync(cmp::ComputeHandler::global->getContext(), (cl_GLsync) presented[slot], &error);
+          cmp::ComputeHandler::handleError(error);
+          acquireSyncs[slot] = presented[slot];
+        } else {
+          glClientWaitSync(presented[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+          glDeleteSync(presented[slot]);
+        }
+        presented[slot] = NULL;
+      }
+
+      cl_uint waitCount = acquireWaits[slot] ? 1 : 0;
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 0, sizeof(cl_mem), &images[slot]));
+      cmp::ComputeHandler::handleError(clEnqueueAcquireGLObjects(queue, 1, &images[slot], waitCount, waitCount ? &acquireWaits[slot] : NULL, NULL));
+      k->enqueue(queue, 2, NULL, globalSize, localSize);
+      cmp::ComputeHandler::handleError(clEnqueueReleaseGLObjects(queue, 1, &images[slot], 0, NULL, &traced[slot]));
+
+      // submits the work without waiting so the device starts while the host presents
+      cmp::ComputeHandler::handleError(clFlush(queue));
+      submitted++;
+    }
+
+    bool RayTracer::present(int width, int height)
+    {
+      // shows the frame before the newest so that the newest keeps tracing meanwhile
+      if (submitted < 2 || submitted - 2 < displayed) {
+        return false;
+      }
+
+      unsigned long long frame = submitted - 2;
+      size_t slot = frame % images.size();
+
+      if (glEvents) {
+        // the GL server waits for the trace, deleting the sync only flags it until the wait is done
+        GLsync sync = glCreateSyncFromCLeventARB(cmp::ComputeHandler::global->getContext(), traced[slot], 0);
+        glWaitSync(sync, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(sync);
+      } else {
+        cmp::ComputeHandler::handleError(clWaitForEvents(1, &traced[slot]));
+      }
+
+      framebuffers[slot]->draw(width, height);
+      presented[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      displayed = frame + 1;
+      return true;
+    }
+
+    void RayTracer::finish() const
+    {
+      cmp::ComputeHandler::handleError(clFinish(cmp::ComputeHandler::global->getQueue(0)));
+    }
+
+    // ----- Offscreen Ray Tracer ----- //
+
+    OffscreenRayTracer::OffscreenRayTracer(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height)
+      : k(kernel), width(width), height(height)
+    {
+      cl_image_format format = {};
+      format.image_channel_order = CL_RGBA;
+      format.image_channel_data_type = CL_UNORM_INT8;
+
+      cl_image_desc descriptor = {};
+      descriptor.image_type = CL_MEM_OBJECT_IMAGE2D;
+      descriptor.image_width = width;
+      descriptor.image_height = height;
+
+      display = k->createImage(0, CL_MEM_WRITE_ONLY, format, descriptor);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 1, sizeof(unsigned int), &width));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 2, sizeof(unsigned int), &height));
+    }
+
+    OffscreenRayTracer::~OffscreenRayTracer()
+    {
+      k->releaseMemory(display);
+    }
+
+    void OffscreenRayTracer::execute(const size_t* localSize, const size_t* globalSize) const
+    {
+      cl_command_queue queue = cmp::ComputeHandler::global->getQueue(0);
+      k->enqueue(queue, 2, NULL, globalSize, localSize);
+      cmp::ComputeHandler::handleError(clFinish(queue));
+    }
+
+    void OffscreenRayTracer::readFrame(unsigned char* pixels) const
+    {
+      size_t origin[] = { 0, 0, 0 };
+      size_t region[] = { width, height, 1 };
+      cl_command_queue queue = cmp::ComputeHandler::global->getQueue(0);
+      cl_event event = NULL;
+      cmp::ComputeHandler::handleError(clEnqueueReadImage(queue, display, CL_TRUE, origin, region, 0, 0, pixels, 0, NULL, cmp::Profiler::global ? &event : NULL));
+
+      if (event) {
+        cmp::Profiler::global->record("readImage", event);
+        clReleaseEvent(event);
+      }
+    }
+  }
+}
@@ -0,0 +1,1436 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../common.h"
+#include "../compute/compute.h"
+#include "../graphics/graphics.h"
+#include "../simd/simd.h"
+#include "../utils/utils.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    // cl_khr_gl_event entry point, loaded at runtime since it is an extension
+    typedef cl_event (CL_API_CALL *CreateEventFromGLsyncFn)(cl_context context, cl_GLsync sync, cl_int* error);
+
+    class RayTracer
+    {
+    private:
+      cmp::ComputeKernel* k;
+      unsigned int width;
+      unsigned int height;
+
+      std::vector<gfx::Texture*> textures;
+      std::vector<gfx::Framebuffer*> framebuffers;
+      std::vector<cl_mem> images;
+
+      // per frame slot, released when the slot is next reused
+      std::vector<cl_event> traced;
+      std::vector<GLsync> presented;
+      std::vector<cl_event> acquireWaits;
+      std::vector<GLsync> acquireSyncs;
+
+      unsigned long long submitted;
+      unsigned long long displayed;
+      CreateEventFromGLsyncFn createEventFromGLsync;
+      bool glEvents;
+
+    public:
+      /**
+       * @brief Construct a new Ray Tracer object which renders into a ring of
+       *    shared OpenGL textures, so that tracing a frame overlaps with
+       *    presenting the previous one.
+       * 
+       * @param kernel Trace kernel
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param frameCount Number of textures in rotation (2 or 3)
+       */
+      RayTracer(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int frameCount = 3);
+
+      /**
+       * @brief Waits for outstanding frames and destroys the textures.
+       */
+      ~RayTracer();
+
+      RayTracer(const RayTracer&) = delete;
+      RayTracer& operator=(const RayTracer&) = delete;
+
+      /**
+       * @brief Enqueues the trace kernel into the next free texture without
+       *    waiting for it, the host only blocks if every texture is in flight.
+       * 
+       * @param localSize Work-group dimensions
+       * @param globalSize Global work dimensions
+       */
+      void execute(const size_t* localSize, const size_t* globalSize);
+
+      /**
+       * @brief Blits the newest traced frame which has not been shown yet to
+       *    the screen framebuffer. The wait for the trace happens on the GPU
+       *    when GL_ARB_cl_event is available.
+       * 
+       * @param width Width of viewport buffer
+       * @param height Height of viewport buffer
+       * @return true If a frame was drawn
+       */
+      bool present(int width, int height);
+
+      /**
+       * @brief Blocks until every submitted frame has finished tracing.
+       */
+      void finish() const;
+
+      /**
+       * @brief Query if frames are synchronised through shared events rather
+       *    than waits on the host.
+       * 
+       * @return true If cl_khr_gl_event and GL_ARB_cl_event are used
+       */
+      inline bool usesGLEvents() const {
+        return glEvents;
+      }
+    };
+
+    class OffscreenRayTracer
+    {
+    private:
+      cmp::ComputeKernel* k;
+      unsigned int width;
+      unsigned int height;
+      cl_mem display;
+
+    public:
+      /**
+       * @brief Construct a new Offscreen Ray Tracer object which renders into a
+       *    device-only RGBA8 image, no OpenGL context is required.
+       * 
+       * @param kernel Trace kernel
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       */
+      OffscreenRayTracer(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height);
+
+      /**
+       * @brief Releases the image, so tracers made one after another on the
+       *    same kernel do not pile up in device memory.
+       */
+      ~OffscreenRayTracer();
+
+      OffscreenRayTracer(const OffscreenRayTracer&) = delete;
+      OffscreenRayTracer& operator=(const OffscreenRayTracer&) = delete;
+
+      /**
+       * @brief Runs the trace kernel and waits for the frame to complete.
+       * 
+       * @param localSize Work-group dimensions
+       * @param globalSize Global work dimensions
+       */
+      void execute(const size_t* localSize, const size_t* globalSize) const;
+
+      /**
+       * @brief Copies the last rendered frame from the device into host memory.
+       * 
+       * @param pixels Destination of width * height RGBA8 pixels
+       */
+      void readFrame(unsigned char* pixels) const;
+
+      /**
+       * @brief Get the number of primary rays cast per frame.
+       * 
+       * @return unsigned long long 
+       */
+      inline unsigned long long getRaysPerFrame() const {
+        return (unsigned long long) width * height;
+      }
+
+      /**
+       * @brief Get the Width of the image
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getWidth() const {
+        return width;
+      }
+
+      /**
+       * @brief Get the Height of the image
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getHeight() const {
+        return height;
+      }
+    };
+
+    class TiledRenderer
+    {
+    private:
+      struct TileSlot
+      {
+        cl_mem image;
+        std::vector<unsigned char> pixels;
+        cl_event read;
+
+        // region of the frame the slot last traced
+        unsigned int x;
+        unsigned int y;
+        unsigned int width;
+        unsigned int height;
+      };
+
+      cmp::ComputeKernel* k;
+      unsigned int width;
+      unsigned int height;
+      unsigned int tileWidth;
+      unsigned int tileHeight;
+      std::vector<TileSlot> slots;
+
+      /**
+       * @brief Enqueues the trace of a tile into a slot and the read back of
+       *    its pixels, neither is waited on.
+       *
+       * @param slot Slot whose previous read has completed
+       * @param tile Tile index, row by row from the top of the frame
+       * @param localSize Work-group dimensions
+       */
+      void submit(TileSlot& slot, unsigned int tile, const size_t* localSize);
+
+      /**
+       * @brief Waits for a slot's read back and releases its event.
+       *
+       * @param slot Slot in flight
+       */
+      void wait(TileSlot& slot);
+
+    public:
+      /**
+       * @brief Construct a new Tiled Renderer object which traces a frame
+       *    larger than device memory one tile at a time. Only the tiles in
+       *    flight are held on the device and the host.
+       *
+       * @param kernel Tile trace kernel, which writes pixels relative to the global offset
+       * @param width Width of frame in pixels
+       * @param height Height of frame in pixels
+       * @param tileWidth Width of a tile, clamped to the device's image limits
+       * @param tileHeight Height of a tile, clamped to the device's image limits
+       * @param slotCount Number of tiles in flight (2 or more)
+       */
+      TiledRenderer(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int tileWidth = 1024,
+        unsigned int tileHeight = 256, unsigned int slotCount = 2);
+
+      /**
+       * @brief Waits for reads still in flight.
+       */
+      ~TiledRenderer();
+
+      TiledRenderer(const TiledRenderer&) = delete;
+      TiledRenderer& operator=(const TiledRenderer&) = delete;
+
+      /**
+       * @brief Traces a single tile and waits for it, used to tune the launch size.
+       *
+       * @param tile Tile index
+       * @param localSize Work-group dimensions
+       */
+      void traceTile(unsigned int tile, const size_t* localSize);
+
+      /**
+       * @brief Traces the frame and streams it to the writer a row of tiles at
+       *    a time. Tracing the next tile overlaps the read back of the last
+       *    and the writer encodes on its own thread.
+       *
+       * @param localSize Work-group dimensions
+       * @param writer Image stream of the same size as the frame
+       */
+      void render(const size_t* localSize, io::PNGStreamWriter& writer);
+
+      /**
+       * @brief Get the number of tiles in the frame
+       *
+       * @return unsigned int
+       */
+      inline unsigned int getTileCount() const {
+        return ((width + tileWidth - 1) / tileWidth) * ((height + tileHeight - 1) / tileHeight);
+      }
+
+      /**
+       * @brief Get the Width of a tile
+       *
+       * @return unsigned int
+       */
+      inline unsigned int getTileWidth() const {
+        return tileWidth;
+      }
+
+      /**
+       * @brief Get the Height of a tile
+       *
+       * @return unsigned int
+       */
+      inline unsigned int getTileHeight() const {
+        return tileHeight;
+      }
+
+      /**
+       * @brief Get the number of primary rays cast per frame.
+       *
+       * @return unsigned long long
+       */
+      inline unsigned long long getRaysPerFrame() const {
+        return (unsigned long long) width * height;
+      }
+    };
+
+    template <typename T>
+    class DeviceArray
+    {
+    private:
+      std::vector<T> host;
+      std::vector<std::pair<size_t, size_t>> dirty;
+      cl_mem buffer;
+      size_t capacity;
+
+    public:
+      /**
+       * @brief Construct a new empty Device Array, the buffer is created on the
+       *    first upload.
+       */
+      DeviceArray() : buffer(nullptr), capacity(0) {}
+
+      /**
+       * @brief Destroy the Device Array and release its buffer.
+       */
+      ~DeviceArray()
+      {
+        if (buffer) {
+          clReleaseMemObject(buffer);
+        }
+      }
+
+      DeviceArray(const DeviceArray&) = delete;
+      DeviceArray& operator=(const DeviceArray&) = delete;
+
+      /**
+       * @brief Appends an element, it is copied to the device on the next upload.
+       * 
+       * @param value Element
+       * @return unsigned int Index of the element
+       */
+      unsigned int push(const T& value)
+      {
+        host.push_back(value);
+        markDirty(host.size() - 1);
+        return (unsigned int) host.size() - 1;
+      }
+
+      /**
+       * @brief Overwrites an element and marks only that element for upload.
+       * 
+       * @param i Element index
+       * @param value Element
+       */
+      void set(size_t i, const T& value)
+      {
+        host[i] = value;
+        markDirty(i);
+      }
+
+      /**
+       * @brief Replaces every element, the whole array is uploaded next time.
+       * 
+       * @param values Elements
+       */
+      void assign(const std::vector<T>& values)
+      {
+        host = values;
+        dirty.clear();
+        if (!host.empty()) {
+          dirty.push_back({ 0, host.size() });
+        }
+      }
+
+      /**
+       * @brief Records a changed element, extending the last range when the
+       *    change is adjacent to it.
+       * 
+       * @param i Element index
+       */
+      void markDirty(size_t i)
+      {
+        if (!dirty.empty() && i + 1 >= dirty.back().first && i <= dirty.back().second) {
+          dirty.back().first = std::min(dirty.back().first, i);
+          dirty.back().second = std::max(dirty.back().second, i + 1);
+        } else {
+          dirty.push_back({ i, i + 1 });
+        }
+      }
+
+      /**
+       * @brief Writes changed ranges to the device, the buffer is reallocated
+       *    and fully rewritten when the array outgrows it.
+       * 
+       * @param queue Command queue to write with
+       * @param uploaded Incremented by the number of bytes written
+       * @return true If the buffer was reallocated and must be rebound
+       */
+      bool upload(cl_command_queue queue, size_t& uploaded)
+      {
+        bool reallocated = false;
+        cl_int error;
+
+        if (!buffer || host.size() > capacity) {
+          if (buffer) {
+            cmp::ComputeHandler::handleError(clReleaseMemObject(buffer));
+          }
+
+          // empty arrays still need a valid buffer to bind
+          capacity = std::max<size_t>(std::max(host.size(), capacity * 2), 1);
+          buffer = clCreateBuffer(cmp::ComputeHandler::global->getContext(), CL_MEM_READ_ONLY, capacity * sizeof(T), nullptr, &error);
+          cmp::ComputeHandler::handleError(error);
+
+          dirty.clear();
+          if (!host.empty()) {
+            dirty.push_back({ 0, host.size() });
+          }
+          reallocated = true;
+        }
+
+        // merges nearby ranges so many small edits do not become many small writes
+        std::sort(dirty.begin(), dirty.end());
+        std::vector<std::pair<size_t, size_t>> merged;
+        for (const std::pair<size_t, size_t>& range : dirty) {
+          if (!merged.empty() && range.first <= merged.back().second + 16) {
+            merged.back().second = std::max(merged.back().second, range.second);
+          } else {
+            merged.push_back(range);
+          }
+        }
+
+        for (const std::pair<size_t, size_t>& range : merged) {
+          size_t bytes = (range.second - range.first) * sizeof(T);
+          cl_event event = NULL;
+          error = clEnqueueWriteBuffer(queue, buffer, CL_TRUE, range.first * sizeof(T), bytes, &host[range.first], 0, NULL, cmp::Profiler::global ? &event : NULL);
+          cmp::ComputeHandler::handleError(error);
+          uploaded += bytes;
+
+          if (event) {
+            cmp::Profiler::global->record("writeBuffer", event);
+            clReleaseEvent(event);
+          }
+        }
+
+        dirty.clear();
+        return reallocated;
+      }
+
+      /**
+       * @brief Get the host copy of the elements
+       * 
+       * @return const std::vector<T>& 
+       */
+      inline const std::vector<T>& getHost() const {
+        return host;
+      }
+
+      /**
+       * @brief Get the device buffer, nullptr before the first upload
+       * 
+       * @return cl_mem 
+       */
+      inline cl_mem getBuffer() const {
+        return buffer;
+      }
+
+      /**
+       * @brief Get the number of elements
+       * 
+       * @return size_t 
+       */
+      inline size_t size() const {
+        return host.size();
+      }
+    };
+
+    class Scene
+    {
+    private:
+      DeviceArray<cl_float4> sphereGeometry;
+      DeviceArray<cl_int> sphereMaterials;
+      DeviceArray<cl_float4> planeGeometry;
+      DeviceArray<cl_int> planeMaterials;
+      DeviceArray<cl_float4> lightPositions;
+      DeviceArray<cl_float4> lightColours;
+      DeviceArray<cl_float4> materialColours;
+
+      std::vector<std::pair<cmp::ComputeKernel*, cl_uint>> bindings;
+      unsigned long long version;
+      size_t uploadedBytes;
+      bool countsChanged;
+
+      /**
+       * @brief Sets every scene parameter of a kernel starting at an index.
+       * 
+       * @param kernel Kernel to bind to
+       * @param firstIndex Index of the first scene parameter
+       */
+      void setArgs(cmp::ComputeKernel* kernel, cl_uint firstIndex) const;
+
+    public:
+      /**
+       * @brief Construct a new empty Scene object stored as one array per
+       *    primitive attribute.
+       */
+      Scene();
+
+      /**
+       * @brief Adds a diffuse material.
+       * 
+       * @param colour Albedo
+       * @return unsigned int Material index
+       */
+      unsigned int addMaterial(glm::vec3 colour);
+
+      /**
+       * @brief Adds a sphere primitive.
+       * 
+       * @param center Center of sphere
+       * @param radius Radius of sphere
+       * @param material Material index
+       * @return unsigned int Sphere index
+       */
+      unsigned int addSphere(glm::vec3 center, float radius, unsigned int material);
+
+      /**
+       * @brief Moves or resizes an existing sphere.
+       * 
+       * @param i Sphere index
+       * @param center Center of sphere
+       * @param radius Radius of sphere
+       */
+      void setSphere(unsigned int i, glm::vec3 center, float radius);
+
+      /**
+       * @brief Adds an infinite plane with points p satisfying dot(normal, p) + d = 0.
+       * 
+       * @param normal Unit plane normal
+       * @param d Plane offset
+       * @param material Material index
+       * @return unsigned int Plane index
+       */
+      unsigned int addPlane(glm::vec3 normal, float d, unsigned int material);
+
+      /**
+       * @brief Adds a point light.
+       * 
+       * @param position Light position
+       * @param colour Light colour and intensity
+       * @return unsigned int Light index
+       */
+      unsigned int addLight(glm::vec3 position, glm::vec3 colour);
+
+      /**
+       * @brief Moves an existing light.
+       * 
+       * @param i Light index
+       * @param position Light position
+       */
+      void setLightPosition(unsigned int i, glm::vec3 position);
+
+      /**
+       * @brief Attaches the scene buffers and counts as kernel parameters, the
+       *    kernel is rebound automatically when buffers are reallocated.
+       * 
+       * @param kernel Kernel to bind to
+       * @param firstIndex Index of the first of ten scene parameters
+       */
+      void bind(cmp::ComputeKernel* kernel, cl_uint firstIndex);
+
+      /**
+       * @brief Copies only the element ranges changed since the last upload to
+       *    the device.
+       * 
+       * @param queue Command queue to write with
+       */
+      void upload(cl_command_queue queue);
+
+      /**
+       * @brief Get the version, incremented by every change to the scene.
+       * 
+       * @return unsigned long long 
+       */
+      inline unsigned long long getVersion() const {
+        return version;
+      }
+
+      /**
+       * @brief Get the number of bytes written by the last upload.
+       * 
+       * @return size_t 
+       */
+      inline size_t getUploadedBytes() const {
+        return uploadedBytes;
+      }
+
+      /**
+       * @brief Get the host array of sphere centers and radii
+       * 
+       * @return const std::vector<cl_float4>& 
+       */
+      inline const std::vector<cl_float4>& getSphereGeometry() const {
+        return sphereGeometry.getHost();
+      }
+
+      /**
+       * @brief Get the host array of sphere material indices
+       * 
+       * @return const std::vector<cl_int>& 
+       */
+      inline const std::vector<cl_int>& getSphereMaterials() const {
+        return sphereMaterials.getHost();
+      }
+
+      /**
+       * @brief Get the host array of plane normals and offsets
+       * 
+       * @return const std::vector<cl_float4>& 
+       */
+      inline const std::vector<cl_float4>& getPlaneGeometry() const {
+        return planeGeometry.getHost();
+      }
+
+      /**
+       * @brief Get the host array of plane material indices
+       * 
+       * @return const std::vector<cl_int>& 
+       */
+      inline const std::vector<cl_int>& getPlaneMaterials() const {
+        return planeMaterials.getHost();
+      }
+
+      /**
+       * @brief Get the host array of light positions
+       * 
+       * @return const std::vector<cl_float4>& 
+       */
+      inline const std::vector<cl_float4>& getLightPositions() const {
+        return lightPositions.getHost();
+      }
+
+      /**
+       * @brief Get the host array of light colours
+       * 
+       * @return const std::vector<cl_float4>& 
+       */
+      inline const std::vector<cl_float4>& getLightColours() const {
+        return lightColours.getHost();
+      }
+
+      /**
+       * @brief Get the host array of material albedos
+       * 
+       * @return const std::vector<cl_float4>& 
+       */
+      inline const std::vector<cl_float4>& getMaterialColours() const {
+        return materialColours.getHost();
+      }
+
+      /**
+       * @brief Creates the scene previously hardcoded in the trace kernel: a red
+       *    sphere over an orange ground plane lit by one distant light, at the
+       *    position the kernel used.
+       * 
+       * @param scene Scene to add primitives to
+       */
+      static void createDefault(Scene& scene);
+
+      /**
+       * @brief Creates the default scene with a deterministic grid of extra
+       *    spheres behind it, used to scale scene complexity in benchmarks.
+       * 
+       * @param scene Scene to add primitives to
+       * @param sphereCount Number of extra spheres
+       */
+      static void createSphereField(Scene& scene, unsigned int sphereCount);
+    };
+
+    class PersistentScheduler
+    {
+    private:
+      cmp::ComputeKernel* k;
+      cl_uint firstIndex;
+      unsigned int tileSize;
+      unsigned int tileCount;
+      cl_mem tileCounter;
+      cmp::LaunchSize launch;
+
+    public:
+      /**
+       * @brief Construct a new Persistent Scheduler object which sizes a launch
+       *    of the tracePersistent kernel to fill the device and hands out its
+       *    tiles through a global counter.
+       * 
+       * @param kernel Persistent kernel
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param tileSize Width and height of a tile in pixels
+       * @param groupSize Work items in each group
+       * @param groupsPerUnit Groups launched per compute unit, more hides latency
+       * @param firstIndex Parameter index of the tile counter, the tile size follows
+       */
+      PersistentScheduler(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int tileSize = 8, 
+        size_t groupSize = 64, unsigned int groupsPerUnit = 4, cl_uint firstIndex = 13);
+
+      /**
+       * @brief Destroy the Persistent Scheduler object and release its counter.
+       */
+      ~PersistentScheduler();
+
+      PersistentScheduler(const PersistentScheduler&) = delete;
+      PersistentScheduler& operator=(const PersistentScheduler&) = delete;
+
+      /**
+       * @brief Rewinds the tile counter, must be enqueued before every launch.
+       * 
+       * @param queue Command queue the launch will be enqueued on
+       */
+      void prepare(cl_command_queue queue);
+
+      /**
+       * @brief Get the launch size to execute the kernel with
+       * 
+       * @return const cmp::LaunchSize& 
+       */
+      inline const cmp::LaunchSize& getLaunchSize() const {
+        return launch;
+      }
+
+      /**
+       * @brief Get the number of work-groups launched
+       * 
+       * @return size_t 
+       */
+      inline size_t getGroupCount() const {
+        return launch.global[0] / launch.local[0];
+      }
+
+      /**
+       * @brief Get the number of tiles shared between the groups
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getTileCount() const {
+        return tileCount;
+      }
+    };
+
+    /**
+     * Layout OpenGL reads an indirect indexed draw from.
+     */
+    struct DrawCommand
+    {
+      GLuint count;
+      GLuint instanceCount;
+      GLuint firstIndex;
+      GLint baseVertex;
+      GLuint baseInstance;
+    };
+
+    class GPUCuller
+    {
+    private:
+      cmp::ComputeKernel* k;
+      const gfx::Mesh* mesh;
+      unsigned int instanceCount;
+      size_t groupSize;
+
+      cl_mem transforms;
+      cl_mem bounds;
+      cl_mem planes;
+
+      // per frame slot, GL buffers and the CL views of them
+      std::vector<GLuint> instanceBuffers;
+      std::vector<GLuint> commandBuffers;
+      std::vector<cl_mem> sharedInstances;
+      std::vector<cl_mem> sharedCommands;
+      std::vector<cl_event> culled;
+      std::vector<GLsync> drawn;
+      std::vector<float> planeData;
+
+      unsigned long long frame;
+      bool glEvents;
+
+    public:
+      /**
+       * @brief Construct a new GPU Culler object which culls every instance
+       *    of a mesh in an OpenCL kernel and writes the survivors and the
+       *    draw command straight into shared OpenGL buffers, so the host does
+       *    no per-instance work after construction.
+       * 
+       * @param kernel cullInstances kernel, its context must share with OpenGL
+       * @param mesh Mesh drawn for every instance
+       * @param instanceTransforms Model matrix of each instance
+       * @param mins Minimum world space corner of each instance
+       * @param maxs Maximum world space corner of each instance
+       * @param frameCount Number of buffer sets in rotation
+       */
+      GPUCuller(cmp::ComputeKernel* kernel, const gfx::Mesh* mesh, const std::vector<glm::mat4>& instanceTransforms, 
+        const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, unsigned int frameCount = 2);
+
+      /**
+       * @brief Waits for outstanding work and releases the shared buffers.
+       */
+      ~GPUCuller();
+
+      GPUCuller(const GPUCuller&) = delete;
+      GPUCuller& operator=(const GPUCuller&) = delete;
+
+      /**
+       * @brief Enqueues the cull of every instance against a frustum into the
+       *    next buffer set, the host only blocks if OpenGL is still drawing
+       *    from that set.
+       * 
+       * @param queue Command queue on the shared context
+       * @param frustum World space frustum
+       */
+      void cull(cl_command_queue queue, const gfx::Frustum& frustum);
+
+      /**
+       * @brief Draws the instances that survived the last cull with one
+       *    indirect draw, the shader must be bound. OpenGL waits for the cull
+       *    on the GPU when GL_ARB_cl_event is available.
+       */
+      void draw();
+
+      /**
+       * @brief Reads back the instance count of the last draw, stalls until
+       *    it has been drawn so is only meant for statistics.
+       * 
+       * @return unsigned int 
+       */
+      unsigned int readVisibleCount() const;
+
+      /**
+       * @brief Get the number of instances tested each frame
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getInstanceCount() const {
+        return instanceCount;
+      }
+    };
+
+    struct DeviceShare
+    {
+      std::string name;
+      unsigned int firstRow;
+      unsigned int rowCount;
+      double milliseconds;
+      double share;
+    };
+
+    class SplitFrameRenderer
+    {
+    private:
+      struct Lane
+      {
+        const cmp::ComputeDevice* device;
+        cmp::ComputeKernel* kernel;
+        cl_mem image;
+        std::vector<cl_mem> sceneBuffers;
+        double rate;
+        cl_event launch;
+        cl_event read;
+      };
+
+      const Scene* scene;
+      unsigned int width;
+      unsigned int height;
+      unsigned int tileHeight;
+      unsigned long long sceneVersion;
+      std::vector<Lane> lanes;
+      std::vector<DeviceShare> shares;
+
+      /**
+       * @brief Copies the whole scene into buffers in a lane's context and
+       *    binds them to its kernel.
+       * 
+       * @param lane Lane to upload to
+       */
+      void uploadScene(Lane& lane);
+
+    public:
+      /**
+       * @brief Construct a new Split Frame Renderer object which traces one frame
+       *    on every device, each taking a band of tile rows sized by how fast it
+       *    finished the previous frame.
+       * 
+       * @param devices Devices to render on, their queues must have profiling enabled
+       * @param programPath Path of the program holding the trace kernel
+       * @param scene Scene to render, re-copied to every device when it changes
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param tileHeight Rows per tile, the unit frames are divided in
+       */
+      SplitFrameRenderer(const std::vector<cmp::ComputeDevice>& devices, std::string programPath, const Scene* scene, 
+        unsigned int width, unsigned int height, unsigned int tileHeight = 16);
+
+      /**
+       * @brief Destroy the Split Frame Renderer object and release device memory.
+       */
+      ~SplitFrameRenderer();
+
+      SplitFrameRenderer(const SplitFrameRenderer&) = delete;
+      SplitFrameRenderer& operator=(const SplitFrameRenderer&) = delete;
+
+      /**
+       * @brief Renders a frame across every device and blocks until all bands
+       *    have been read back, then rebalances the bands for the next frame.
+       * 
+       * @param pixels Destination of width * height RGBA8 pixels
+       */
+      void execute(unsigned char* pixels);
+
+      /**
+       * @brief Get the band and timing of each device in the last frame
+       * 
+       * @return const std::vector<DeviceShare>& 
+       */
+      inline const std::vector<DeviceShare>& getShares() const {
+        return shares;
+      }
+
+      /**
+       * @brief Get the number of primary rays cast per frame.
+       * 
+       * @return unsigned long long 
+       */
+      inline unsigned long long getRaysPerFrame() const {
+        return (unsigned long long) width * height;
+      }
+    };
+
+    class Accumulator
+    {
+    private:
+      cmp::ComputeKernel* k;
+      cl_mem buffer;
+      cl_uint firstIndex;
+      unsigned int samplesPerPixel;
+      unsigned int sampleCount;
+      unsigned long long sceneVersion;
+      bool resetPending;
+
+    public:
+      /**
+       * @brief Construct a new Accumulator object holding one float4 running
+       *    sum per pixel for the pathTrace kernel.
+       * 
+       * @param kernel Path trace kernel
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param samplesPerPixel Samples traced per pixel each frame
+       * @param firstIndex Index of the accumulation buffer parameter
+       */
+      Accumulator(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int samplesPerPixel = 1, cl_uint firstIndex = 13);
+
+      /**
+       * @brief Destroy the Accumulator object and release the buffer.
+       */
+      ~Accumulator();
+
+      Accumulator(const Accumulator&) = delete;
+      Accumulator& operator=(const Accumulator&) = delete;
+
+      /**
+       * @brief Sets the sample parameters for the next launch, restarting the
+       *    accumulation if the scene changed since the last frame. Must be
+       *    called once before every launch of the kernel.
+       * 
+       * @param scene Scene being traced
+       */
+      void nextFrame(const Scene& scene);
+
+      /**
+       * @brief Restarts the accumulation on the next frame, e.g. after the
+       *    camera moved.
+       */
+      inline void reset() {
+        resetPending = true;
+      }
+
+      /**
+       * @brief Set the number of samples traced per pixel each frame, which
+       *    sets the cost of a frame without restarting the accumulation.
+       * 
+       * @param samplesPerPixel 
+       */
+      inline void setSamplesPerPixel(unsigned int samplesPerPixel) {
+        this->samplesPerPixel = std::max(1u, samplesPerPixel);
+      }
+
+      /**
+       * @brief Get the number of samples per pixel in the image after the
+       *    last launch.
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getSampleCount() const {
+        return sampleCount;
+      }
+    };
+
+    class AdaptiveSampler
+    {
+    private:
+      cmp::ComputeKernel* k;
+      cmp::ComputeKernel* resolveKernel;
+      unsigned int width;
+      unsigned int height;
+      unsigned int tileSize;
+      unsigned int tilesX;
+      unsigned int tilesY;
+
+      unsigned int samplesPerPass;
+      unsigned int minSamples;
+      unsigned int maxSamples;
+      float threshold;
+
+      cl_mem accumulation;
+      cl_mem tileErrors;
+      DeviceArray<cl_uint> tileSamples;
+      DeviceArray<cl_uint> activeTiles;
+      std::vector<cl_int> errors;
+
+      unsigned long long sceneVersion;
+      unsigned long long samplesTraced;
+      bool resetPending;
+
+      /**
+       * @brief Uploads changed tile state and rebinds reallocated buffers.
+       * 
+       * @param queue Command queue to write with
+       */
+      void upload(cl_command_queue queue);
+
+    public:
+      /**
+       * @brief Construct a new Adaptive Sampler object which splits the image
+       *    into tiles and keeps path tracing only the tiles whose estimated
+       *    error is above a threshold.
+       * 
+       * @param kernel pathTraceAdaptive kernel, with the scene bound from index 3
+       * @param resolve resolveTiles kernel, run through a tracer to write the image
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param tileSize Width and height of a tile in pixels
+       * @param samplesPerPass Samples per pixel of an active tile each pass
+       * @param threshold Relative standard error at which a tile stops
+       */
+      AdaptiveSampler(cmp::ComputeKernel* kernel, cmp::ComputeKernel* resolve, unsigned int width, unsigned int height, 
+        unsigned int tileSize = 16, unsigned int samplesPerPass = 4, float threshold = 0.01f);
+
+      /**
+       * @brief Destroy the Adaptive Sampler object and release its buffers.
+       */
+      ~AdaptiveSampler();
+
+      AdaptiveSampler(const AdaptiveSampler&) = delete;
+      AdaptiveSampler& operator=(const AdaptiveSampler&) = delete;
+
+      /**
+       * @brief Traces one pass over the active tiles, then reads back their
+       *    error estimates and retires the tiles which have converged. All
+       *    tiles restart when the scene changes.
+       * 
+       * @param queue Command queue
+       * @param scene Scene being traced
+       * @return true If any tile was traced
+       */
+      bool pass(cl_command_queue queue, const Scene& scene);
+
+      /**
+       * @brief Restarts every tile on the next pass, e.g. after the camera moved.
+       */
+      inline void reset() {
+        resetPending = true;
+      }
+
+      /**
+       * @brief Set the sample limits of a tile, it never stops before the
+       *    minimum since few samples give a poor variance estimate.
+       * 
+       * @param minSamples Samples per pixel before a tile may stop
+       * @param maxSamples Samples per pixel after which a tile always stops
+       */
+      inline void setSampleLimits(unsigned int minSamples, unsigned int maxSamples) {
+        this->minSamples = minSamples;
+        this->maxSamples = std::max(minSamples, maxSamples);
+      }
+
+      /**
+       * @brief Get the number of tiles still being sampled
+       * 
+       * @return size_t 
+       */
+      inline size_t getActiveTileCount() const {
+        return activeTiles.size();
+      }
+
+      /**
+       * @brief Get the total number of tiles
+       * 
+       * @return size_t 
+       */
+      inline size_t getTileCount() const {
+        return (size_t) tilesX * tilesY;
+      }
+
+      /**
+       * @brief Get the number of path samples traced since the last reset
+       * 
+       * @return unsigned long long 
+       */
+      inline unsigned long long getSamplesTraced() const {
+        return samplesTraced;
+      }
+
+      /**
+       * @brief Get the per tile sample counts
+       * 
+       * @return const std::vector<cl_uint>& 
+       */
+      inline const std::vector<cl_uint>& getTileSamples() const {
+        return tileSamples.getHost();
+      }
+    };
+
+    // layouts must match the structs in res/cl/ray_trace.cl
+    struct WavefrontRay
+    {
+      cl_float4 origin;
+      cl_float4 direction;
+      cl_float4 throughput;
+      cl_int pixel;
+      cl_int bounce;
+      cl_uint seed;
+      cl_int pad;
+    };
+
+    struct WavefrontHit
+    {
+      cl_float4 normal;
+      cl_int material;
+      cl_int pad[3];
+    };
+
+    struct ShadowRay
+    {
+      cl_float4 origin;
+      cl_float4 direction;
+      cl_float4 contribution;
+      cl_int pixel;
+      cl_int pad[3];
+    };
+
+    class WavefrontTracer
+    {
+    private:
+      cmp::ComputeKernel* generate;
+      cmp::ComputeKernel* extend;
+      cmp::ComputeKernel* shade;
+      cmp::ComputeKernel* connect;
+      cmp::ComputeKernel* resolve;
+      unsigned int width;
+      unsigned int height;
+      unsigned int samplesPerFrame;
+
+      cl_mem rays[2];
+      cl_mem hits;
+      cl_mem shadowRays;
+      cl_mem counters;
+      cl_mem accumulation;
+
+      // queue counters after every bounce of a frame, read back once without blocking
+      cl_mem statistics;
+      std::vector<cl_uint> frameCounters;
+      cl_event statisticsRead;
+
+      unsigned int sampleCount;
+      unsigned long long sceneVersion;
+      bool resetPending;
+
+      // rays traced by each stage since the last call to resetStats
+      std::vector<unsigned long long> bounceRays;
+      unsigned long long shadowRayCount;
+
+      /**
+       * @brief Waits for the counters of the last frame and adds them to the
+       *    ray counts, by then the frame has usually long finished.
+       */
+      void collectStats();
+
+    public:
+      /**
+       * @brief Construct a new Wavefront Tracer object which runs path tracing
+       *    as separate generate, extend, shade and connect kernels passing
+       *    paths through device queues.
+       * 
+       * @param program Program holding the wavefront kernels
+       * @param scene Scene to bind to the stages which intersect it
+       * @param resolve Kernel writing the image, run through a tracer
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param samplesPerFrame Paths started per pixel each frame
+       */
+      WavefrontTracer(cmp::ComputeProgram* program, Scene& scene, cmp::ComputeKernel* resolve, 
+        unsigned int width, unsigned int height, unsigned int samplesPerFrame = 1);
+
+      /**
+       * @brief Destroy the Wavefront Tracer object and release its queues.
+       */
+      ~WavefrontTracer();
+
+      WavefrontTracer(const WavefrontTracer&) = delete;
+      WavefrontTracer& operator=(const WavefrontTracer&) = delete;
+
+      /**
+       * @brief Traces a frame of samples into the accumulation buffer, each
+       *    bounce is sized by the number of paths still alive.
+       * 
+       * @param queue Command queue
+       * @param scene Scene being traced, accumulation restarts when it changes
+       */
+      void render(cl_command_queue queue, const Scene& scene);
+
+      /**
+       * @brief Restarts the accumulation on the next frame.
+       */
+      inline void reset() {
+        resetPending = true;
+      }
+
+      /**
+       * @brief Clears the per bounce ray counts.
+       */
+      void resetStats();
+
+      /**
+       * @brief Get the number of paths extended at each bounce, including the
+       *    last frame rendered.
+       * 
+       * @return const std::vector<unsigned long long>& 
+       */
+      const std::vector<unsigned long long>& getBounceRays();
+
+      /**
+       * @brief Get the number of shadow rays traced, including the last frame
+       *    rendered.
+       * 
+       * @return unsigned long long 
+       */
+      unsigned long long getShadowRays();
+
+      /**
+       * @brief Get the number of samples per pixel in the image
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getSampleCount() const {
+        return sampleCount;
+      }
+    };
+
+    struct ThreadStats
+    {
+      unsigned long long rays;
+      unsigned long long tiles;
+      long long busyMicroseconds;
+    };
+
+    class CPURayTracer
+    {
+    private:
+      jobs::ThreadPool* pool;
+      const Scene* scene;
+      unsigned int width;
+      unsigned int height;
+      unsigned int tileSize;
+      std::vector<ThreadStats> stats;
+      simd::Intersector intersector;
+      simd::Spheres spheres;
+      simd::Planes planes;
+
+      /**
+       * @brief Traces every pixel of a single tile on the calling worker.
+       * 
+       * @param tile Tile index in row-major order
+       * @param pixels Destination RGBA8 image
+       * @return unsigned long long Number of primary rays cast
+       */
+      unsigned long long traceTile(size_t tile, unsigned char* pixels) const;
+
+    public:
+      /**
+       * @brief Construct a new CPU Ray Tracer object which runs a host port of the
+       *    trace kernel, used as a fallback and correctness baseline.
+       * 
+       * @param pool Worker pool to spread tiles across
+       * @param scene Scene to render
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param tileSize Width and height of a tile in pixels
+       */
+      CPURayTracer(jobs::ThreadPool* pool, const Scene* scene, unsigned int width, unsigned int height, unsigned int tileSize = 16);
+
+      /**
+       * @brief Renders a full frame and blocks until every tile is complete.
+       * 
+       * @param pixels Destination of width * height RGBA8 pixels
+       */
+      void execute(unsigned char* pixels);
+
+      /**
+       * @brief Clears the accumulated per-thread statistics.
+       */
+      void resetStats();
+
+      /**
+       * @brief Get the statistics accumulated by each worker since the last reset.
+       * 
+       * @return const std::vector<ThreadStats>& 
+       */
+      inline const std::vector<ThreadStats>& getThreadStats() const {
+        return stats;
+      }
+
+      /**
+       * @brief Get the number of primary rays cast per frame.
+       * 
+       * @return unsigned long long 
+       */
+      inline unsigned long long getRaysPerFrame() const {
+        return (unsigned long long) width * height;
+      }
+
+      /**
+       * @brief Get the instruction set used to intersect primary ray packets
+       * 
+       * @return simd::ISA 
+       */
+      inline simd::ISA getISA() const {
+        return intersector.getISA();
+      }
+    };
+
+    struct BVHNode
+    {
+      cl_float bmin[3];
+      cl_int leftFirst;
+      cl_float bmax[3];
+      cl_int count;
+    };
+
+    struct BVHTriangle
+    {
+      cl_float4 v0;
+      cl_float4 e1;
+      cl_float4 e2;
+      cl_float4 normal;
+    };
+
+    class BVH
+    {
+    private:
+      std::vector<BVHNode> nodes;
+      std::vector<BVHTriangle> triangles;
+      unsigned int depth;
+
+      /**
+       * @brief Splits a node along the binned surface area heuristic plane and
+       *    returns false if keeping it as a leaf is cheaper.
+       * 
+       * @param nodeIndex Node to split
+       * @param order Triangle indices, partitioned in place
+       * @param centroids Triangle centroids
+       * @param bounds Triangle bounds as min/max pairs
+       * @return true If the node was split into two children
+       */
+      bool subdivide(unsigned int nodeIndex, std::vector<unsigned int>& order, const std::vector<glm::vec3>& centroids, const std::vector<glm::vec3>& bounds);
+
+      /**
+       * @brief Recomputes the node bounds from the triangles it contains.
+       * 
+       * @param nodeIndex Leaf node
+       * @param order Triangle indices
+       * @param bounds Triangle bounds as min/max pairs
+       */
+      void updateBounds(unsigned int nodeIndex, const std::vector<unsigned int>& order, const std::vector<glm::vec3>& bounds);
+
+    public:
+      /**
+       * @brief Builds a bounding volume hierarchy over the triangles of a mesh,
+       *    flattened so that it can be uploaded and traversed by a kernel.
+       * 
+       * @param mesh Host mesh data
+       * @param transform Model transform baked into the triangles
+       */
+      BVH(const io::MeshData& mesh, glm::mat4 transform = glm::mat4(1.0f));
+
+      /**
+       * @brief Builds a bounding volume hierarchy over indexed triangles with
+       *    strided positions, such as a memory mapped mesh file.
+       * 
+       * @param positions First vertex position
+       * @param stride Floats between consecutive positions
+       * @param indices Triangle indices
+       * @param indexCount Number of indices
+       * @param transform Model transform baked into the triangles
+       */
+      BVH(const float* positions, size_t stride, const unsigned int* indices, size_t indexCount, glm::mat4 transform = glm::mat4(1.0f));
+
+      /**
+       * @brief Copies the node and triangle arrays into device buffers and
+       *    attaches them as kernel parameters.
+       * 
+       * @param kernel Kernel to attach the buffers to
+       * @param nodeIndex Index of the node buffer parameter
+       * @param triangleIndex Index of the triangle buffer parameter
+       */
+      void upload(cmp::ComputeKernel* kernel, cl_uint nodeIndex, cl_uint triangleIndex);
+
+      /**
+       * @brief Get the number of flattened nodes
+       * 
+       * @return size_t 
+       */
+      inline size_t getNodeCount() const {
+        return nodes.size();
+      }
+
+      /**
+       * @brief Get the number of triangles
+       * 
+       * @return size_t 
+       */
+      inline size_t getTriangleCount() const {
+        return triangles.size();
+      }
+
+      /**
+       * @brief Get the depth of the deepest leaf
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getDepth() const {
+        return depth;
+      }
+    };
+  }
+}
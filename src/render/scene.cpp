@@ -0,0 +1,151 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    static cl_float4 toFloat4(glm::vec3 v, float w)
+    {
+      cl_float4 f;
+      f.s[0] = v.x;
+      f.s[1] = v.y;
+      f.s[2] = v.z;
+      f.s[3] = w;
+      return f;
+    }
+
+    Scene::Scene() : version(0), uploadedBytes(0), countsChanged(true)
+    {
+    }
+
+    unsigned int Scene::addMaterial(glm::vec3 colour)
+    {
+      version++;
+      return materialColours.push(toFloat4(colour, 1.0f));
+    }
+
+    unsigned int Scene::addSphere(glm::vec3 center, float radius, unsigned int material)
+    {
+      version++;
+      countsChanged = true;
+      sphereMaterials.push((cl_int) material);
+      return sphereGeometry.push(toFloat4(center, radius));
+    }
+
+    void Scene::setSphere(unsigned int i, glm::vec3 center, float radius)
+    {
+      version++;
+      sphereGeometry.set(i, toFloat4(center, radius));
+    }
+
+    unsigned int Scene::addPlane(glm::vec3 normal, float d, unsigned int material)
+    {
+      version++;
+      countsChanged = true;
+      planeMaterials.push((cl_int) material);
+      return planeGeometry.push(toFloat4(normal, d));
+    }
+
+    unsigned int Scene::addLight(glm::vec3 position, glm::vec3 colour)
+    {
+      version++;
+      countsChanged = true;
+      lightColours.push(toFloat4(colour, 1.0f));
+      return lightPositions.push(toFloat4(position, 1.0f));
+    }
+
+    void Scene::setLightPosition(unsigned int i, glm::vec3 position)
+    {
+      version++;
+      lightPositions.set(i, toFloat4(position, 1.0f));
+    }
+
+    void Scene::bind(cmp::ComputeKernel* kernel, cl_uint firstIndex)
+    {
+      bindings.push_back({ kernel, firstIndex });
+
+      // buffers only exist after the first upload
+      if (sphereGeometry.getBuffer()) {
+        setArgs(kernel, firstIndex);
+      }
+    }
+
+    void Scene::upload(cl_command_queue queue)
+    {
+      uploadedBytes = 0;
+      bool reallocated = false;
+      reallocated |= sphereGeometry.upload(queue, uploadedBytes);
+      reallocated |= sphereMaterials.upload(queue, uploadedBytes);
+      reallocated |= planeGeometry.upload(queue, uploadedBytes);
+      reallocated |= planeMaterials.upload(queue, uploadedBytes);
+      reallocated |= lightPositions.upload(queue, uploadedBytes);
+      reallocated |= lightColours.upload(queue, uploadedBytes);
+      reallocated |= materialColours.upload(queue, uploadedBytes);
+
+      if (reallocated || countsChanged) {
+        for (size_t i = 0; i < bindings.size(); i++) {
+          setArgs(bindings[i].first, bindings[i].second);
+        }
+        countsChanged = false;
+      }
+    }
+
+    void Scene::setArgs(cmp::ComputeKernel* kernel, cl_uint firstIndex) const
+    {
+      cl_uint sphereCount = (cl_uint) sphereGeometry.size();
+      cl_uint planeCount = (cl_uint) planeGeometry.size();
+      cl_uint lightCount = (cl_uint) lightPositions.size();
+      cl_kernel k = kernel->getKernel();
+
+      kernel->setMemoryArg(firstIndex, sphereGeometry.getBuffer());
+      kernel->setMemoryArg(firstIndex + 1, sphereMaterials.getBuffer());
+      cmp::ComputeHandler::handleError(clSetKernelArg(k, firstIndex + 2, sizeof(cl_uint), &sphereCount));
+      kernel->setMemoryArg(firstIndex + 3, planeGeometry.getBuffer());
+      kernel->setMemoryArg(firstIndex + 4, planeMaterials.getBuffer());
+      cmp::ComputeHandler::handleError(clSetKernelArg(k, firstIndex + 5, sizeof(cl_uint), &planeCount));
+      kernel->setMemoryArg(firstIndex + 6, lightPositions.getBuffer());
+      kernel->setMemoryArg(firstIndex + 7, lightColours.getBuffer());
+      cmp::ComputeHandler::handleError(clSetKernelArg(k, firstIndex + 8, sizeof(cl_uint), &lightCount));
+      kernel->setMemoryArg(firstIndex + 9, materialColours.getBuffer());
+    }
+
+    void Scene::createDefault(Scene& scene)
+    {
+      unsigned int red = scene.addMaterial(glm::vec3(1.0f, 0.0f, 0.0f));
+      unsigned int ground = scene.addMaterial(glm::vec3(0.96f, 0.31f, 0.21f));
+
+      scene.addSphere(glm::vec3(0.0f, 0.0f, -3.0f), 1.0f, red);
+      scene.addPlane(glm::vec3(0.0f, 1.0f, 0.0f), 2.0f, ground);
+      scene.addLight(glm::vec3(-500.0f, 1000.0f, -700.0f), glm::vec3(1.0f));
+    }
+
+    void Scene::createSphereField(Scene& scene, unsigned int sphereCount)
+    {
+      createDefault(scene);
+
+      unsigned int materials[] = {
+        scene.addMaterial(glm::vec3(0.2f, 0.4f, 0.9f)),
+        scene.addMaterial(glm::vec3(0.3f, 0.8f, 0.3f)),
+        scene.addMaterial(glm::vec3(0.9f, 0.9f, 0.9f)),
+      };
+
+      // square layers of spheres receding from the camera so every ray tests against all of them
+      unsigned int side = (unsigned int) std::ceil(std::sqrt((float) sphereCount));
+      side = std::max(1u, std::min(side, 8u));
+      float spacing = 6.0f / side;
+
+      for (unsigned int i = 0; i < sphereCount; i++) {
+        unsigned int layer = i / (side * side);
+        unsigned int x = i % side;
+        unsigned int y = (i / side) % side;
+
+        glm::vec3 center = glm::vec3(
+          -3.0f + spacing * (x + 0.5f), 
+          -1.5f + spacing * 0.5f * (y + 0.5f), 
+          -6.0f - 2.0f * layer
+        );
+        scene.addSphere(center, spacing * 0.3f, materials[i % 3]);
+      }
+    }
+  }
+}
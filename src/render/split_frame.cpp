@@ -0,0 +1,200 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    // weight of the newest frame in each device's throughput estimate, damps swings from one slow frame
+    static const double RATE_SMOOTHING = 0.5;
+
+    SplitFrameRenderer::SplitFrameRenderer(const std::vector<cmp::ComputeDevice>& devices, std::string programPath, const Scene* scene, 
+      unsigned int width, unsigned int height, unsigned int tileHeight)
+      : scene(scene), width(width), height(height), tileHeight(std::max(1u, tileHeight)), sceneVersion(scene->getVersion())
+    {
+      cmp::ComputeHandler* handler = cmp::ComputeHandler::global;
+
+      for (const cmp::ComputeDevice& device : devices) {
+        cl_bool images = CL_FALSE;
+        cmp::ComputeHandler::handleError(clGetDeviceInfo(device.device, CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &images, NULL));
+        if (!images) {
+          SSRT_DBG_OUTPUT("Skipping device without image support: " << device.name);
+          continue;
+        }
+
+        cl_command_queue_properties props = 0;
+        cmp::ComputeHandler::handleError(clGetCommandQueueInfo(device.queue, CL_QUEUE_PROPERTIES, sizeof(props), &props, NULL));
+        if (!(props & CL_QUEUE_PROFILING_ENABLE)) {
+          throw std::runtime_error("Split frame rendering needs profiling enabled on the queue of: " + device.name);
+        }
+
+        Lane lane = {};
+        lane.device = &device;
+        lane.kernel = handler->createProgram(programPath, "", &device)->createKernel("trace");
+        lane.rate = 0.0;
+
+        // each device writes its band into a full size image so the kernel addresses pixels unchanged
+        cl_int error;
+        cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+        cl_image_desc descriptor = {};
+        descriptor.image_type = CL_MEM_OBJECT_IMAGE2D;
+        descriptor.image_width = width;
+        descriptor.image_height = height;
+        lane.image = clCreateImage(device.context, CL_MEM_WRITE_ONLY, &format, &descriptor, nullptr, &error);
+        cmp::ComputeHandler::handleError(error);
+
+        lane.kernel->setMemoryArg(0, lane.image);
+        cmp::ComputeHandler::handleError(clSetKernelArg(lane.kernel->getKernel(), 1, sizeof(unsigned int), &width));
+        cmp::ComputeHandler::handleError(clSetKernelArg(lane.kernel->getKernel(), 2, sizeof(unsigned int), &height));
+
+        lanes.push_back(lane);
+        uploadScene(lanes.back());
+      }
+
+      if (lanes.empty()) {
+        throw std::runtime_error("No compute device can render the frame!");
+      }
+      shares.resize(lanes.size());
+    }
+
+    SplitFrameRenderer::~SplitFrameRenderer()
+    {
+      for (Lane& lane : lanes) {
+        for (cl_mem buffer : lane.sceneBuffers) {
+          clReleaseMemObject(buffer);
+        }
+        clReleaseMemObject(lane.image);
+      }
+    }
+
+    template <typename T>
+    static cl_mem copyToContext(cl_context context, const std::vector<T>& values)
+    {
+      // empty arrays still need a valid buffer to bind
+      T empty = {};
+      cl_int error;
+      cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, std::max<size_t>(values.size(), 1) * sizeof(T), 
+        values.empty() ? &empty : (void*) values.data(), &error);
+      cmp::ComputeHandler::handleError(error);
+      return buffer;
+    }
+
+    void SplitFrameRenderer::uploadScene(Lane& lane)
+    {
+      for (cl_mem buffer : lane.sceneBuffers) {
+        clReleaseMemObject(buffer);
+      }
+
+      // devices may sit on different platforms so the scene cannot share one set of buffers
+      cl_context context = lane.device->context;
+      lane.sceneBuffers = {
+        copyToContext(context, scene->getSphereGeometry()),
+        copyToContext(context, scene->getSphereMaterials()),
+        copyToContext(context, scene->getPlaneGeometry()),
+        copyToContext(context, scene->getPlaneMaterials()),
+        copyToContext(context, scene->getLightPositions()),
+        copyToContext(context, scene->getLightColours()),
+        copyToContext(context, scene->getMaterialColours())
+      };
+
+      cl_uint counts[] = {
+        (cl_uint) scene->getSphereGeometry().size(),
+        (cl_uint) scene->getPlaneGeometry().size(),
+        (cl_uint) scene->getLightPositions().size()
+      };
+
+      // same layout as Scene::bind from parameter 3
+      cmp::ComputeKernel* k = lane.kernel;
+      k->setMemoryArg(3, lane.sceneBuffers[0]);
+      k->setMemoryArg(4, lane.sceneBuffers[1]);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 5, sizeof(cl_uint), &counts[0]));
+      k->setMemoryArg(6, lane.sceneBuffers[2]);
+      k->setMemoryArg(7, lane.sceneBuffers[3]);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 8, sizeof(cl_uint), &counts[1]));
+      k->setMemoryArg(9, lane.sceneBuffers[4]);
+      k->setMemoryArg(10, lane.sceneBuffers[5]);
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 11, sizeof(cl_uint), &counts[2]));
+      k->setMemoryArg(12, lane.sceneBuffers[6]);
+    }
+
+    void SplitFrameRenderer::execute(unsigned char* pixels)
+    {
+      if (scene->getVersion() != sceneVersion) {
+        sceneVersion = scene->getVersion();
+        for (Lane& lane : lanes) {
+          uploadScene(lane);
+        }
+      }
+
+      // bands follow each device's share of the measured throughput, the first frame splits evenly
+      unsigned int tilesY = (height + tileHeight - 1) / tileHeight;
+      double totalRate = 0.0;
+      for (const Lane& lane : lanes) {
+        totalRate += lane.rate;
+      }
+
+      unsigned int tile = 0;
+      double cumulative = 0.0;
+      for (size_t i = 0; i < lanes.size(); i++) {
+        cumulative += totalRate > 0.0 ? lanes[i].rate / totalRate : 1.0 / lanes.size();
+
+        // every device keeps at least one tile so its throughput stays measured
+        unsigned int remaining = (unsigned int) (lanes.size() - i - 1);
+        unsigned int end = (unsigned int) std::lround(cumulative * tilesY);
+        end = std::min(std::max(std::min(end, tilesY - std::min(remaining, tilesY)), tile + 1), tilesY);
+        if (i + 1 == lanes.size()) {
+          end = tilesY;
+        }
+
+        DeviceShare& share = shares[i];
+        share.name = lanes[i].device->name;
+        share.firstRow = std::min(tile * tileHeight, height);
+        share.rowCount = std::min(end * tileHeight, height) - share.firstRow;
+        share.share = totalRate > 0.0 ? lanes[i].rate / totalRate : 1.0 / lanes.size();
+        tile = end;
+      }
+
+      // every band is submitted before any is waited on so the devices run side by side
+      for (size_t i = 0; i < lanes.size(); i++) {
+        Lane& lane = lanes[i];
+        const DeviceShare& share = shares[i];
+        lane.launch = NULL;
+        lane.read = NULL;
+        if (share.rowCount == 0) {
+          continue;
+        }
+
+        size_t offset[] = { 0, share.firstRow };
+        size_t global[] = { width, share.rowCount };
+        lane.kernel->enqueue(lane.device->queue, 2, offset, global, NULL, 0, NULL, &lane.launch);
+
+        size_t origin[] = { 0, share.firstRow, 0 };
+        size_t region[] = { width, share.rowCount, 1 };
+        unsigned char* band = pixels + (size_t) share.firstRow * width * 4;
+        cmp::ComputeHandler::handleError(clEnqueueReadImage(lane.device->queue, lane.image, CL_FALSE, origin, region, 0, 0, band, 0, NULL, &lane.read));
+        cmp::ComputeHandler::handleError(clFlush(lane.device->queue));
+      }
+
+      for (size_t i = 0; i < lanes.size(); i++) {
+        Lane& lane = lanes[i];
+        DeviceShare& share = shares[i];
+        share.milliseconds = 0.0;
+        if (!lane.read) {
+          continue;
+        }
+
+        cmp::ComputeHandler::handleError(clWaitForEvents(1, &lane.read));
+
+        // device timestamps cover the trace and the read back, the host wait order does not skew them
+        cl_ulong start = 0, end = 0;
+        cmp::ComputeHandler::handleError(clGetEventProfilingInfo(lane.launch, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL));
+        cmp::ComputeHandler::handleError(clGetEventProfilingInfo(lane.read, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL));
+        clReleaseEvent(lane.launch);
+        clReleaseEvent(lane.read);
+
+        share.milliseconds = std::max<double>((double) (end - start), 1.0) / 1e6;
+        double rate = (double) share.rowCount * width / share.milliseconds;
+        lane.rate = lane.rate > 0.0 ? lane.rate + (rate - lane.rate) * RATE_SMOOTHING : rate;
+      }
+    }
+  }
+}
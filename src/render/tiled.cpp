@@ -0,0 +1,146 @@
+#include "render.h"
+
+#include <cstring>
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    TiledRenderer::TiledRenderer(cmp::ComputeKernel* kernel, unsigned int width, unsigned int height, unsigned int tileWidth,
+      unsigned int tileHeight, unsigned int slotCount)
+      : k(kernel), width(width), height(height)
+    {
+      if (width == 0 || height == 0) {
+        throw std::runtime_error("Cannot render an empty frame!");
+      }
+
+      size_t maxWidth = 0, maxHeight = 0;
+      cl_device_id device = cmp::ComputeHandler::global->getDevice();
+      cmp::ComputeHandler::handleError(clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(size_t), &maxWidth, NULL));
+      cmp::ComputeHandler::handleError(clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(size_t), &maxHeight, NULL));
+
+      // tiles never need to be larger than the frame
+      this->tileWidth = std::max(1u, std::min({ tileWidth, width, (unsigned int) maxWidth }));
+      this->tileHeight = std::max(1u, std::min({ tileHeight, height, (unsigned int) maxHeight }));
+
+      cl_image_format format = {};
+      format.image_channel_order = CL_RGBA;
+      format.image_channel_data_type = CL_UNORM_INT8;
+
+      cl_image_desc descriptor = {};
+      descriptor.image_type = CL_MEM_OBJECT_IMAGE2D;
+      descriptor.image_width = this->tileWidth;
+      descriptor.image_height = this->tileHeight;
+
+      slots.resize(std::max(2u, slotCount));
+      for (TileSlot& slot : slots) {
+        slot.image = k->createImage(0, CL_MEM_WRITE_ONLY, format, descriptor);
+        slot.pixels.resize((size_t) this->tileWidth * this->tileHeight * 4);
+        slot.read = NULL;
+      }
+
+      // the kernel sees the whole frame, so rays are cast exactly as in an untiled render
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 1, sizeof(unsigned int), &width));
+      cmp::ComputeHandler::handleError(clSetKernelArg(k->getKernel(), 2, sizeof(unsigned int), &height));
+
+      SSRT_DBG_OUTPUT("Created Tiled Renderer: " << width << "x" << height << " in " << getTileCount() << " tiles of "
+                      << this->tileWidth << "x" << this->tileHeight << ", " << slots.size() << " in flight");
+    }
+
+    TiledRenderer::~TiledRenderer()
+    {
+      // the slot images are owned by the kernel, only a read left by a failed render is outstanding
+      for (TileSlot& slot : slots) {
+        if (slot.read) {
+          clWaitForEvents(1, &slot.read);
+          clReleaseEvent(slot.read);
+        }
+      }
+    }
+
+    void TiledRenderer::submit(TileSlot& slot, unsigned int tile, const size_t* localSize)
+    {
+      // rows of tiles run from the top of the frame, the order the image file is written in
+      unsigned int tilesX = (width + tileWidth - 1) / tileWidth;
+      unsigned int top = height - (tile / tilesX) * tileHeight;
+      slot.x = (tile % tilesX) * tileWidth;
+      slot.y = top > tileHeight ? top - tileHeight : 0;
+      slot.width = std::min(tileWidth, width - slot.x);
+      slot.height = top - slot.y;
+
+      size_t offset[] = { slot.x, slot.y };
+      size_t global[] = { slot.width, slot.height };
+      if (localSize) {
+        global[0] = (global[0] + localSize[0] - 1) / localSize[0] * localSize[0];
+        global[1] = (global[1] + localSize[1] - 1) / localSize[1] * localSize[1];
+      }
+
+      cl_command_queue queue = cmp::ComputeHandler::global->getQueue(0);
+      k->setMemoryArg(0, slot.image);
+      k->enqueue(queue, 2, offset, global, localSize);
+
+      size_t origin[] = { 0, 0, 0 };
+      size_t region[] = { slot.width, slot.height, 1 };
+      cmp::ComputeHandler::handleError(clEnqueueReadImage(queue, slot.image, CL_FALSE, origin, region, 0, 0, slot.pixels.data(), 0, NULL, &slot.read));
+      cmp::ComputeHandler::handleError(clFlush(queue));
+
+      if (cmp::Profiler::global) {
+        cmp::Profiler::global->record("readImage", slot.read);
+      }
+    }
+
+    void TiledRenderer::wait(TileSlot& slot)
+    {
+      cl_event read = slot.read;
+      slot.read = NULL;
+      cmp::ComputeHandler::handleError(clWaitForEvents(1, &read));
+      clReleaseEvent(read);
+    }
+
+    void TiledRenderer::traceTile(unsigned int tile, const size_t* localSize)
+    {
+      submit(slots[0], tile % getTileCount(), localSize);
+      wait(slots[0]);
+    }
+
+    void TiledRenderer::render(const size_t* localSize, io::PNGStreamWriter& writer)
+    {
+      if (writer.getWidth() != width || writer.getHeight() != height) {
+        throw std::runtime_error("Image stream does not match the size of the frame!");
+      }
+
+      unsigned int tilesX = (width + tileWidth - 1) / tileWidth;
+      unsigned int tiles = getTileCount();
+      size_t slotCount = slots.size();
+      std::vector<unsigned char> band;
+
+      // each slot is retired just before it is reused, so the device always has the next tiles queued
+      for (unsigned int t = 0; t < tiles + slotCount; t++) {
+        TileSlot& slot = slots[t % slotCount];
+
+        if (t >= slotCount) {
+          wait(slot);
+
+          // tiles are bottom-up like the frame, bands are top-down like the file
+          if (band.empty()) {
+            band.resize((size_t) width * slot.height * 4);
+          }
+          for (unsigned int row = 0; row < slot.height; row++) {
+            std::memcpy(&band[((size_t) (slot.height - 1 - row) * width + slot.x) * 4], &slot.pixels[(size_t) row * slot.width * 4],
+              (size_t) slot.width * 4);
+          }
+
+          // a finished row of tiles is handed to the writer, which blocks here if it falls behind
+          if ((t - slotCount) % tilesX == tilesX - 1) {
+            writer.write(std::move(band));
+            band.clear();
+          }
+        }
+
+        if (t < tiles) {
+          submit(slot, t, localSize);
+        }
+      }
+    }
+  }
+}
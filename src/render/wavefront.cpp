@@ -0,0 +1,207 @@
+#include "render.h"
+
+namespace sunstorm
+{
+  namespace rt
+  {
+    // kernel parameters after the scene arguments
+    static const cl_uint WAVEFRONT_RAYS = 10;
+    static const cl_uint WAVEFRONT_COUNTERS = 11;
+    static const cl_uint WAVEFRONT_QUEUE = 12;
+    static const cl_uint WAVEFRONT_HITS = 13;
+    static const cl_uint WAVEFRONT_NEXT_RAYS = 14;
+    static const cl_uint WAVEFRONT_NEXT_QUEUE = 15;
+    static const cl_uint WAVEFRONT_SHADOW_RAYS = 16;
+    static const cl_uint WAVEFRONT_ACCUMULATION = 17;
+
+    // connect kernel parameters after the scene arguments
+    static const cl_uint CONNECT_SHADOW_RAYS = 10;
+    static const cl_uint CONNECT_COUNTERS = 11;
+    static const cl_uint CONNECT_ACCUMULATION = 12;
+
+    // resolve kernel parameters after the image and its size
+    static const cl_uint RESOLVE_ACCUMULATION = 3;
+    static const cl_uint RESOLVE_SAMPLE_COUNT = 4;
+
+    // must match MAX_BOUNCES and SHADOW_QUEUE in res/cl/ray_trace.cl
+    static const unsigned int WAVEFRONT_MAX_BOUNCES = 4;
+    static const unsigned int WAVEFRONT_SHADOW_QUEUE = 2;
+
+    static const size_t WAVEFRONT_GROUP_SIZE = 64;
+
+    static size_t roundToGroup(size_t count)
+    {
+      return (count + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE * WAVEFRONT_GROUP_SIZE;
+    }
+
+    WavefrontTracer::WavefrontTracer(cmp::ComputeProgram* program, Scene& scene, cmp::ComputeKernel* resolve, 
+      unsigned int width, unsigned int height, unsigned int samplesPerFrame)
+      : resolve(resolve), width(width), height(height), samplesPerFrame(std::max(1u, samplesPerFrame)), 
+        statisticsRead(NULL), sampleCount(0), sceneVersion(0), resetPending(true), bounceRays(WAVEFRONT_MAX_BOUNCES, 0), shadowRayCount(0)
+    {
+      generate = program->createKernel("wavefrontGenerate");
+      extend = program->createKernel("wavefrontExtend");
+      shade = program->createKernel("wavefrontShade");
+      connect = program->createKernel("wavefrontConnect");
+      scene.bind(extend, 0);
+      scene.bind(shade, 0);
+      scene.bind(connect, 0);
+
+      // every queue is sized for one path per pixel, the most a bounce can hold
+      size_t pixels = (size_t) width * height;
+      cl_int error;
+      cl_context context = cmp::ComputeHandler::global->getContext();
+      for (cl_mem& queue : rays) {
+        queue = clCreateBuffer(context, CL_MEM_READ_WRITE, pixels * sizeof(WavefrontRay), nullptr, &error);
+        cmp::ComputeHandler::handleError(error);
+      }
+      hits = clCreateBuffer(context, CL_MEM_READ_WRITE, pixels * sizeof(WavefrontHit), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+      shadowRays = clCreateBuffer(context, CL_MEM_READ_WRITE, pixels * sizeof(ShadowRay), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+      counters = clCreateBuffer(context, CL_MEM_READ_WRITE, 4 * sizeof(cl_uint), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+      accumulation = clCreateBuffer(context, CL_MEM_READ_WRITE, pixels * sizeof(cl_float4), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+
+      frameCounters.resize((size_t) this->samplesPerFrame * WAVEFRONT_MAX_BOUNCES * 4);
+      statistics = clCreateBuffer(context, CL_MEM_READ_WRITE, frameCounters.size() * sizeof(cl_uint), nullptr, &error);
+      cmp::ComputeHandler::handleError(error);
+
+      generate->setMemoryArg(0, rays[0]);
+      generate->setMemoryArg(1, accumulation);
+      cmp::ComputeHandler::handleError(clSetKernelArg(generate->getKernel(), 2, sizeof(unsigned int), &width));
+      cmp::ComputeHandler::handleError(clSetKernelArg(generate->getKernel(), 3, sizeof(unsigned int), &height));
+
+      extend->setMemoryArg(WAVEFRONT_COUNTERS, counters);
+      extend->setMemoryArg(WAVEFRONT_HITS, hits);
+
+      shade->setMemoryArg(WAVEFRONT_COUNTERS, counters);
+      shade->setMemoryArg(WAVEFRONT_HITS, hits);
+      shade->setMemoryArg(WAVEFRONT_SHADOW_RAYS, shadowRays);
+      shade->setMemoryArg(WAVEFRONT_ACCUMULATION, accumulation);
+
+      connect->setMemoryArg(CONNECT_SHADOW_RAYS, shadowRays);
+      connect->setMemoryArg(CONNECT_COUNTERS, counters);
+      connect->setMemoryArg(CONNECT_ACCUMULATION, accumulation);
+
+      resolve->setMemoryArg(RESOLVE_ACCUMULATION, accumulation);
+    }
+
+    WavefrontTracer::~WavefrontTracer()
+    {
+      if (statisticsRead) {
+        clWaitForEvents(1, &statisticsRead);
+        clReleaseEvent(statisticsRead);
+      }
+      clReleaseMemObject(statistics);
+      clReleaseMemObject(rays[0]);
+      clReleaseMemObject(rays[1]);
+      clReleaseMemObject(hits);
+      clReleaseMemObject(shadowRays);
+      clReleaseMemObject(counters);
+      clReleaseMemObject(accumulation);
+    }
+
+    void WavefrontTracer::render(cl_command_queue queue, const Scene& scene)
+    {
+      if (resetPending || scene.getVersion() != sceneVersion) {
+        sceneVersion = scene.getVersion();
+        sampleCount = 0;
+        resetPending = false;
+      }
+
+      // the read back of the previous frame's counters is reused, so it must have landed
+      collectStats();
+
+      cl_uint pixels = width * height;
+      cl_uint zero = 0;
+
+      for (unsigned int s = 0; s < samplesPerFrame; s++) {
+        // fills copy their pattern on enqueue so nothing here waits on the device
+        cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, counters, &zero, sizeof(zero), 0, 4 * sizeof(cl_uint), 0, NULL, NULL));
+        cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, counters, &pixels, sizeof(pixels), 0, sizeof(cl_uint), 0, NULL, NULL));
+
+        cmp::ComputeHandler::handleError(clSetKernelArg(generate->getKernel(), 4, sizeof(unsigned int), &sampleCount));
+        size_t generateSize = roundToGroup(pixels);
+        generate->enqueue(queue, 1, NULL, &generateSize, &WAVEFRONT_GROUP_SIZE);
+
+        // the host never waits on a bounce, launches cover every pixel and lanes past the live count of the
+        // queue exit at once, since paths only terminate this bounds each queue without reading it back
+        cl_uint current = 0;
+        size_t liveSize = roundToGroup(pixels);
+        for (unsigned int bounce = 0; bounce < WAVEFRONT_MAX_BOUNCES; bounce++) {
+          cl_uint next = 1 - current;
+
+          extend->setMemoryArg(WAVEFRONT_RAYS, rays[current]);
+          cmp::ComputeHandler::handleError(clSetKernelArg(extend->getKernel(), WAVEFRONT_QUEUE, sizeof(cl_uint), &current));
+          shade->setMemoryArg(WAVEFRONT_RAYS, rays[current]);
+          shade->setMemoryArg(WAVEFRONT_NEXT_RAYS, rays[next]);
+          cmp::ComputeHandler::handleError(clSetKernelArg(shade->getKernel(), WAVEFRONT_QUEUE, sizeof(cl_uint), &current));
+          cmp::ComputeHandler::handleError(clSetKernelArg(shade->getKernel(), WAVEFRONT_NEXT_QUEUE, sizeof(cl_uint), &next));
+
+          extend->enqueue(queue, 1, NULL, &liveSize, &WAVEFRONT_GROUP_SIZE);
+          shade->enqueue(queue, 1, NULL, &liveSize, &WAVEFRONT_GROUP_SIZE);
+          connect->enqueue(queue, 1, NULL, &liveSize, &WAVEFRONT_GROUP_SIZE);
+
+          // kept on the device for the stats, the counters are cleared for the next bounce straight after
+          size_t offset = ((size_t) s * WAVEFRONT_MAX_BOUNCES + bounce) * 4 * sizeof(cl_uint);
+          cmp::ComputeHandler::handleError(clEnqueueCopyBuffer(queue, counters, statistics, 0, offset, 4 * sizeof(cl_uint), 0, NULL, NULL));
+
+          // the consumed queue becomes the append target of the next bounce
+          cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, counters, &zero, sizeof(zero), current * sizeof(cl_uint), sizeof(cl_uint), 0, NULL, NULL));
+          cmp::ComputeHandler::handleError(clEnqueueFillBuffer(queue, counters, &zero, sizeof(zero), WAVEFRONT_SHADOW_QUEUE * sizeof(cl_uint), sizeof(cl_uint), 0, NULL, NULL));
+
+          current = next;
+        }
+
+        sampleCount++;
+      }
+
+      cmp::ComputeHandler::handleError(clSetKernelArg(resolve->getKernel(), RESOLVE_SAMPLE_COUNT, sizeof(unsigned int), &sampleCount));
+      cmp::ComputeHandler::handleError(clEnqueueReadBuffer(queue, statistics, CL_FALSE, 0, frameCounters.size() * sizeof(cl_uint), 
+        frameCounters.data(), 0, NULL, &statisticsRead));
+      cmp::ComputeHandler::handleError(clFlush(queue));
+    }
+
+    void WavefrontTracer::collectStats()
+    {
+      if (!statisticsRead) {
+        return;
+      }
+
+      cl_event read = statisticsRead;
+      statisticsRead = NULL;
+      cmp::ComputeHandler::handleError(clWaitForEvents(1, &read));
+      clReleaseEvent(read);
+
+      // bounces alternate between the two path queues starting with the first
+      for (unsigned int s = 0; s < samplesPerFrame; s++) {
+        for (unsigned int bounce = 0; bounce < WAVEFRONT_MAX_BOUNCES; bounce++) {
+          const cl_uint* sizes = &frameCounters[((size_t) s * WAVEFRONT_MAX_BOUNCES + bounce) * 4];
+          bounceRays[bounce] += sizes[bounce % 2];
+          shadowRayCount += sizes[WAVEFRONT_SHADOW_QUEUE];
+        }
+      }
+    }
+
+    void WavefrontTracer::resetStats()
+    {
+      collectStats();
+      std::fill(bounceRays.begin(), bounceRays.end(), 0);
+      shadowRayCount = 0;
+    }
+
+    const std::vector<unsigned long long>& WavefrontTracer::getBounceRays()
+    {
+      collectStats();
+      return bounceRays;
+    }
+
+    unsigned long long WavefrontTracer::getShadowRays()
+    {
+      collectStats();
+      return shadowRayCount;
+    }
+  }
+}
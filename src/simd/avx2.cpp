@@ -0,0 +1,56 @@
+#include "packet.h"
+
+#ifdef SSRT_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace sunstorm
+{
+  namespace simd
+  {
+#ifdef SSRT_SIMD_X86
+    namespace
+    {
+      // built with AVX2 enabled, only called once cpuid reports support
+      struct AVX2Traits
+      {
+        typedef __m256 F;
+        typedef __m256 M;
+        typedef __m256i I;
+        static const unsigned int W = 8;
+
+        static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+        static inline void store(float* p, F a) { _mm256_storeu_ps(p, a); }
+        static inline I loadi(const int* p) { return _mm256_loadu_si256((const __m256i*) p); }
+        static inline void storei(int* p, I a) { _mm256_storeu_si256((__m256i*) p, a); }
+        static inline F set1(float a) { return _mm256_set1_ps(a); }
+        static inline I seti(int a) { return _mm256_set1_epi32(a); }
+        static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+        static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+        static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+        static inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+        static inline F sqrt(F a) { return _mm256_sqrt_ps(a); }
+        static inline F min(F a, F b) { return _mm256_min_ps(a, b); }
+        static inline F max(F a, F b) { return _mm256_max_ps(a, b); }
+        static inline M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static inline M gt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static inline M ge(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        static inline M andm(M a, M b) { return _mm256_and_ps(a, b); }
+        static inline F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+        static inline I selecti(M m, I a, I b) { return _mm256_blendv_epi8(b, a, _mm256_castps_si256(m)); }
+      };
+    }
+
+    const Kernels* getAVX2Kernels()
+    {
+      static const Kernels kernels = makeKernels<AVX2Traits>(ISA::AVX2);
+      return &kernels;
+    }
+#else
+    const Kernels* getAVX2Kernels()
+    {
+      return nullptr;
+    }
+#endif
+  }
+}
@@ -0,0 +1,58 @@
+#include "packet.h"
+
+#ifdef SSRT_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace sunstorm
+{
+  namespace simd
+  {
+#ifdef SSRT_SIMD_X86
+    namespace
+    {
+      // built with AVX-512F enabled, only called once cpuid reports support
+      struct AVX512Traits
+      {
+        typedef __m512 F;
+        typedef __mmask16 M;
+        typedef __m512i I;
+        static const unsigned int W = 16;
+
+        static inline F load(const float* p) { return _mm512_loadu_ps(p); }
+        static inline void store(float* p, F a) { _mm512_storeu_ps(p, a); }
+        static inline I loadi(const int* p) { return _mm512_loadu_si512(p); }
+        static inline void storei(int* p, I a) { _mm512_storeu_si512(p, a); }
+        static inline F set1(float a) { return _mm512_set1_ps(a); }
+        static inline I seti(int a) { return _mm512_set1_epi32(a); }
+        static inline F add(F a, F b) { return _mm512_add_ps(a, b); }
+        static inline F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+        static inline F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+        static inline F div(F a, F b) { return _mm512_div_ps(a, b); }
+        static inline F sqrt(F a) { return _mm512_sqrt_ps(a); }
+        static inline F min(F a, F b) { return _mm512_min_ps(a, b); }
+        static inline F max(F a, F b) { return _mm512_max_ps(a, b); }
+        static inline M lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static inline M gt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+        static inline M ge(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+        static inline M andm(M a, M b) { return (M) (a & b); }
+
+        // mask registers select lanes directly, set bits take the second operand
+        static inline F select(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+        static inline I selecti(M m, I a, I b) { return _mm512_mask_blend_epi32(m, b, a); }
+      };
+    }
+
+    const Kernels* getAVX512Kernels()
+    {
+      static const Kernels kernels = makeKernels<AVX512Traits>(ISA::AVX512);
+      return &kernels;
+    }
+#else
+    const Kernels* getAVX512Kernels()
+    {
+      return nullptr;
+    }
+#endif
+  }
+}
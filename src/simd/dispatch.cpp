@@ -0,0 +1,214 @@
+#include "simd.h"
+
+#if defined(SSRT_SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(SSRT_SIMD_X86)
+#include <cpuid.h>
+#endif
+
+namespace sunstorm
+{
+  namespace simd
+  {
+#ifdef SSRT_SIMD_X86
+    static void cpuid(int leaf, int subleaf, unsigned int out[4])
+    {
+#ifdef _MSC_VER
+      int registers[4];
+      __cpuidex(registers, leaf, subleaf);
+      for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned int) registers[i];
+      }
+#else
+      __cpuid_count(leaf, subleaf, out[0], out[1], out[2], out[3]);
+#endif
+    }
+
+    // register state the operating system saves on a context switch
+    static unsigned long long xgetbv()
+    {
+#ifdef _MSC_VER
+      return _xgetbv(0);
+#else
+      unsigned int eax, edx;
+      __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+      return ((unsigned long long) edx << 32) | eax;
+#endif
+    }
+
+    static ISA queryISA()
+    {
+      unsigned int info[4];
+      cpuid(0, 0, info);
+      unsigned int maxLeaf = info[0];
+
+      cpuid(1, 0, info);
+      bool sse2 = (info[3] >> 26) & 1;
+      bool osxsave = (info[2] >> 27) & 1;
+      bool avx = (info[2] >> 28) & 1;
+      if (!sse2) {
+        return ISA::Scalar;
+      }
+
+      // the cpu supporting an extension is not enough, the os must also save its registers
+      unsigned long long xcr0 = osxsave ? xgetbv() : 0;
+      bool ymmState = (xcr0 & 0x6) == 0x6;
+      bool zmmState = (xcr0 & 0xE6) == 0xE6;
+      if (!avx || !ymmState || maxLeaf < 7) {
+        return ISA::SSE;
+      }
+
+      cpuid(7, 0, info);
+      bool avx2 = (info[1] >> 5) & 1;
+      bool avx512f = (info[1] >> 16) & 1;
+
+      if (avx512f && zmmState) {
+        return ISA::AVX512;
+      }
+      return avx2 ? ISA::AVX2 : ISA::SSE;
+    }
+#else
+    static ISA queryISA()
+    {
+      return ISA::Scalar;
+    }
+#endif
+
+    static const Kernels* getKernels(ISA isa)
+    {
+      switch (isa) {
+        case ISA::SSE:
+          return getSSEKernels();
+        case ISA::AVX2:
+          return getAVX2Kernels();
+        case ISA::AVX512:
+          return getAVX512Kernels();
+        default:
+          return getScalarKernels();
+      }
+    }
+
+    ISA detectISA()
+    {
+      static const ISA isa = queryISA();
+      return isa;
+    }
+
+    bool isSupported(ISA isa)
+    {
+      return isa <= detectISA() && getKernels(isa) != nullptr;
+    }
+
+    std::string getISAName(ISA isa)
+    {
+      switch (isa) {
+        case ISA::SSE:
+          return "SSE";
+        case ISA::AVX2:
+          return "AVX2";
+        case ISA::AVX512:
+          return "AVX-512";
+        default:
+          return "Scalar";
+      }
+    }
+
+    // ----- SoA Primitives ----- //
+
+    void Spheres::add(float cx, float cy, float cz, float r)
+    {
+      x.push_back(cx);
+      y.push_back(cy);
+      z.push_back(cz);
+      radius.push_back(r);
+    }
+
+    PrimitiveArrays Spheres::getArrays() const
+    {
+      return { { x.data(), y.data(), z.data(), radius.data() }, size() };
+    }
+
+    void Planes::add(float nx, float ny, float nz, float distance)
+    {
+      normalX.push_back(nx);
+      normalY.push_back(ny);
+      normalZ.push_back(nz);
+      d.push_back(distance);
+    }
+
+    PrimitiveArrays Planes::getArrays() const
+    {
+      return { { normalX.data(), normalY.data(), normalZ.data(), d.data() }, size() };
+    }
+
+    void Triangles::add(const float* v0, const float* v1, const float* v2)
+    {
+      x.push_back(v0[0]);
+      y.push_back(v0[1]);
+      z.push_back(v0[2]);
+      edge1X.push_back(v1[0] - v0[0]);
+      edge1Y.push_back(v1[1] - v0[1]);
+      edge1Z.push_back(v1[2] - v0[2]);
+      edge2X.push_back(v2[0] - v0[0]);
+      edge2Y.push_back(v2[1] - v0[1]);
+      edge2Z.push_back(v2[2] - v0[2]);
+    }
+
+    PrimitiveArrays Triangles::getArrays() const
+    {
+      return { { x.data(), y.data(), z.data(), edge1X.data(), edge1Y.data(), edge1Z.data(), edge2X.data(), edge2Y.data(), edge2Z.data() }, size() };
+    }
+
+    void Boxes::add(const float* min, const float* max)
+    {
+      minX.push_back(min[0]);
+      minY.push_back(min[1]);
+      minZ.push_back(min[2]);
+      maxX.push_back(max[0]);
+      maxY.push_back(max[1]);
+      maxZ.push_back(max[2]);
+    }
+
+    PrimitiveArrays Boxes::getArrays() const
+    {
+      return { { minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data() }, size() };
+    }
+
+    // ----- Intersector ----- //
+
+    Intersector::Intersector(ISA isa)
+    {
+      // walks down to the widest set that is both requested and runnable
+      int level = (int) isa;
+      while (level > 0 && !isSupported((ISA) level)) {
+        level--;
+      }
+      kernels = getKernels((ISA) level);
+    }
+
+    void Intersector::intersect(const RayStream& rays, const Spheres& spheres, int firstIndex) const
+    {
+      kernels->spheres(rays, spheres.getArrays(), firstIndex);
+    }
+
+    void Intersector::intersect(const RayStream& rays, const Planes& planes, int firstIndex) const
+    {
+      kernels->planes(rays, planes.getArrays(), firstIndex);
+    }
+
+    void Intersector::intersect(const RayStream& rays, const Triangles& triangles, int firstIndex) const
+    {
+      kernels->triangles(rays, triangles.getArrays(), firstIndex);
+    }
+
+    void Intersector::intersect(const RayStream& rays, const Boxes& boxes, int firstIndex) const
+    {
+      kernels->boxes(rays, boxes.getArrays(), firstIndex);
+    }
+
+    void Intersector::cull(const PrimitiveArrays& boxes, const float* planes, int planeCount, int* visible) const
+    {
+      kernels->cullBoxes(boxes, planes, planeCount, visible);
+    }
+  }
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "simd.h"
+
+/*
+ * Packet kernels written once against a vector traits type V, each instruction
+ * set translation unit defines its traits in an anonymous namespace and
+ * instantiates these. The traits having internal linkage keeps every
+ * instantiation local to the unit compiled with the right flags, so nothing
+ * here may call an inline function that is not templated on V.
+ *
+ * V provides the types F (floats), M (lane mask) and I (ints), the width W and
+ * load, store, loadi, storei, set1, seti, add, sub, mul, div, sqrt, min, max,
+ * lt, gt, ge, andm, select and selecti.
+ */
+
+namespace sunstorm
+{
+  namespace simd
+  {
+    // matches EPSILON in res/cl/ray_trace.cl
+    static const float PACKET_EPSILON = 0.00001f;
+
+    template <typename V>
+    struct Packet
+    {
+      typename V::F originX, originY, originZ;
+      typename V::F directionX, directionY, directionZ;
+    };
+
+    template <typename V>
+    inline typename V::F dot3(typename V::F ax, typename V::F ay, typename V::F az, typename V::F bx, typename V::F by, typename V::F bz)
+    {
+      return V::add(V::add(V::mul(ax, bx), V::mul(ay, by)), V::mul(az, bz));
+    }
+
+    /**
+     * Runs a test over the stream one packet at a time, the tail is padded
+     * by repeating its last ray and the padding lanes are discarded.
+     */
+    template <typename V, typename Test>
+    inline void forEachPacket(const RayStream& rays, Test test)
+    {
+      size_t full = rays.count - rays.count % V::W;
+
+      for (size_t i = 0; i < full; i += V::W) {
+        Packet<V> packet = {
+          V::load(rays.originX + i), V::load(rays.originY + i), V::load(rays.originZ + i),
+          V::load(rays.directionX + i), V::load(rays.directionY + i), V::load(rays.directionZ + i)
+        };
+        typename V::F dist = V::load(rays.dist + i);
+        typename V::I primitive = V::loadi(rays.primitive + i);
+
+        test(packet, dist, primitive);
+
+        V::store(rays.dist + i, dist);
+        V::storei(rays.primitive + i, primitive);
+      }
+
+      if (full == rays.count) {
+        return;
+      }
+
+      size_t tail = rays.count - full;
+      const float* sources[] = { rays.originX, rays.originY, rays.originZ, rays.directionX, rays.directionY, rays.directionZ, rays.dist };
+      float lanes[7][V::W];
+      int primitives[V::W];
+
+      for (unsigned int lane = 0; lane < V::W; lane++) {
+        size_t ray = full + (lane < tail ? lane : tail - 1);
+        for (int s = 0; s < 7; s++) {
+          lanes[s][lane] = sources[s][ray];
+        }
+        primitives[lane] = rays.primitive[ray];
+      }
+
+      Packet<V> packet = {
+        V::load(lanes[0]), V::load(lanes[1]), V::load(lanes[2]),
+        V::load(lanes[3]), V::load(lanes[4]), V::load(lanes[5])
+      };
+      typename V::F dist = V::load(lanes[6]);
+      typename V::I primitive = V::loadi(primitives);
+
+      test(packet, dist, primitive);
+
+      V::store(lanes[6], dist);
+      V::storei(primitives, primitive);
+      for (size_t lane = 0; lane < tail; lane++) {
+        rays.dist[full + lane] = lanes[6][lane];
+        rays.primitive[full + lane] = primitives[lane];
+      }
+    }
+
+    template <typename V>
+    void intersectSpheres(const RayStream& rays, const PrimitiveArrays& spheres, int firstIndex)
+    {
+      typedef typename V::F F;
+      typedef typename V::M M;
+      typedef typename V::I I;
+
+      forEachPacket<V>(rays, [&](const Packet<V>& ray, F& dist, I& primitive) {
+        F zero = V::set1(0.0f);
+        F epsilon = V::set1(PACKET_EPSILON);
+
+        for (size_t i = 0; i < spheres.count; i++) {
+          float radius = spheres.data[3][i];
+          F toCenterX = V::sub(V::set1(spheres.data[0][i]), ray.originX);
+          F toCenterY = V::sub(V::set1(spheres.data[1][i]), ray.originY);
+          F toCenterZ = V::sub(V::set1(spheres.data[2][i]), ray.originZ);
+
+          // same quadratic as raySphereIntersect, the nearer root must be in front of the origin
+          F b = V::mul(V::set1(-2.0f), dot3<V>(toCenterX, toCenterY, toCenterZ, ray.directionX, ray.directionY, ray.directionZ));
+          F c = V::sub(dot3<V>(toCenterX, toCenterY, toCenterZ, toCenterX, toCenterY, toCenterZ), V::set1(radius * radius));
+          F discriminant = V::sub(V::mul(b, b), V::mul(V::set1(4.0f), c));
+          F lambda = V::mul(V::sub(V::sub(zero, b), V::sqrt(V::max(discriminant, zero))), V::set1(0.5f));
+
+          M hit = V::andm(V::andm(V::ge(discriminant, zero), V::gt(lambda, epsilon)), V::lt(lambda, dist));
+          dist = V::select(hit, lambda, dist);
+          primitive = V::selecti(hit, V::seti(firstIndex + (int) i), primitive);
+        }
+      });
+    }
+
+    template <typename V>
+    void intersectPlanes(const RayStream& rays, const PrimitiveArrays& planes, int firstIndex)
+    {
+      typedef typename V::F F;
+      typedef typename V::M M;
+      typedef typename V::I I;
+
+      forEachPacket<V>(rays, [&](const Packet<V>& ray, F& dist, I& primitive) {
+        F epsilon = V::set1(PACKET_EPSILON);
+
+        for (size_t i = 0; i < planes.count; i++) {
+          F normalX = V::set1(planes.data[0][i]);
+          F normalY = V::set1(planes.data[1][i]);
+          F normalZ = V::set1(planes.data[2][i]);
+
+          F a = V::add(V::set1(planes.data[3][i]), dot3<V>(normalX, normalY, normalZ, ray.originX, ray.originY, ray.originZ));
+          F b = dot3<V>(normalX, normalY, normalZ, ray.directionX, ray.directionY, ray.directionZ);
+
+          // parallel rays divide by zero, the infinity or nan fails both comparisons
+          F t = V::div(V::sub(V::set1(0.0f), a), b);
+
+          M hit = V::andm(V::gt(t, epsilon), V::lt(t, dist));
+          dist = V::select(hit, t, dist);
+          primitive = V::selecti(hit, V::seti(firstIndex + (int) i), primitive);
+        }
+      });
+    }
+
+    template <typename V>
+    void intersectTriangles(const RayStream& rays, const PrimitiveArrays& triangles, int firstIndex)
+    {
+      typedef typename V::F F;
+      typedef typename V::M M;
+      typedef typename V::I I;
+
+      forEachPacket<V>(rays, [&](const Packet<V>& ray, F& dist, I& primitive) {
+        F zero = V::set1(0.0f);
+        F one = V::set1(1.0f);
+        F epsilon = V::set1(PACKET_EPSILON);
+        F parallel = V::set1(PACKET_EPSILON * PACKET_EPSILON);
+
+        for (size_t i = 0; i < triangles.count; i++) {
+          F edge1X = V::set1(triangles.data[3][i]);
+          F edge1Y = V::set1(triangles.data[4][i]);
+          F edge1Z = V::set1(triangles.data[5][i]);
+          F edge2X = V::set1(triangles.data[6][i]);
+          F edge2Y = V::set1(triangles.data[7][i]);
+          F edge2Z = V::set1(triangles.data[8][i]);
+
+          // p = direction x edge2
+          F pX = V::sub(V::mul(ray.directionY, edge2Z), V::mul(ray.directionZ, edge2Y));
+          F pY = V::sub(V::mul(ray.directionZ, edge2X), V::mul(ray.directionX, edge2Z));
+          F pZ = V::sub(V::mul(ray.directionX, edge2Y), V::mul(ray.directionY, edge2X));
+
+          F det = dot3<V>(edge1X, edge1Y, edge1Z, pX, pY, pZ);
+          F inverseDet = V::div(one, det);
+
+          F tX = V::sub(ray.originX, V::set1(triangles.data[0][i]));
+          F tY = V::sub(ray.originY, V::set1(triangles.data[1][i]));
+          F tZ = V::sub(ray.originZ, V::set1(triangles.data[2][i]));
+          F u = V::mul(dot3<V>(tX, tY, tZ, pX, pY, pZ), inverseDet);
+
+          // q = t x edge1
+          F qX = V::sub(V::mul(tY, edge1Z), V::mul(tZ, edge1Y));
+          F qY = V::sub(V::mul(tZ, edge1X), V::mul(tX, edge1Z));
+          F qZ = V::sub(V::mul(tX, edge1Y), V::mul(tY, edge1X));
+          F v = V::mul(dot3<V>(ray.directionX, ray.directionY, ray.directionZ, qX, qY, qZ), inverseDet);
+          F t = V::mul(dot3<V>(edge2X, edge2Y, edge2Z, qX, qY, qZ), inverseDet);
+
+          M inside = V::andm(V::andm(V::ge(u, zero), V::ge(v, zero)), V::ge(one, V::add(u, v)));
+          M hit = V::andm(V::andm(inside, V::gt(V::mul(det, det), parallel)), V::andm(V::gt(t, epsilon), V::lt(t, dist)));
+          dist = V::select(hit, t, dist);
+          primitive = V::selecti(hit, V::seti(firstIndex + (int) i), primitive);
+        }
+      });
+    }
+
+    template <typename V>
+    void intersectBoxes(const RayStream& rays, const PrimitiveArrays& boxes, int firstIndex)
+    {
+      typedef typename V::F F;
+      typedef typename V::M M;
+      typedef typename V::I I;
+
+      forEachPacket<V>(rays, [&](const Packet<V>& ray, F& dist, I& primitive) {
+        F zero = V::set1(0.0f);
+        F one = V::set1(1.0f);
+        F inverseX = V::div(one, ray.directionX);
+        F inverseY = V::div(one, ray.directionY);
+        F inverseZ = V::div(one, ray.directionZ);
+
+        for (size_t i = 0; i < boxes.count; i++) {
+          F t0X = V::mul(V::sub(V::set1(boxes.data[0][i]), ray.originX), inverseX);
+          F t0Y = V::mul(V::sub(V::set1(boxes.data[1][i]), ray.originY), inverseY);
+          F t0Z = V::mul(V::sub(V::set1(boxes.data[2][i]), ray.originZ), inverseZ);
+          F t1X = V::mul(V::sub(V::set1(boxes.data[3][i]), ray.originX), inverseX);
+          F t1Y = V::mul(V::sub(V::set1(boxes.data[4][i]), ray.originY), inverseY);
+          F t1Z = V::mul(V::sub(V::set1(boxes.data[5][i]), ray.originZ), inverseZ);
+
+          F entryTime = V::max(V::max(V::min(t0X, t1X), V::min(t0Y, t1Y)), V::min(t0Z, t1Z));
+          F exitTime = V::min(V::min(V::max(t0X, t1X), V::max(t0Y, t1Y)), V::max(t0Z, t1Z));
+          F entry = V::max(entryTime, zero);
+
+          M hit = V::andm(V::ge(exitTime, entry), V::lt(entry, dist));
+          dist = V::select(hit, entry, dist);
+          primitive = V::selecti(hit, V::seti(firstIndex + (int) i), primitive);
+        }
+      });
+    }
+
+    /**
+     * Tests a packet of boxes per iteration against every plane, the extent
+     * projected onto the plane normal decides whether any corner is in front.
+     * Tail lanes are padded with the last box and discarded.
+     */
+    template <typename V>
+    void cullBoxes(const PrimitiveArrays& boxes, const float* planes, int planeCount, int* visible)
+    {
+      typedef typename V::F F;
+      typedef typename V::M M;
+      typedef typename V::I I;
+
+      F zero = V::set1(0.0f);
+      F half = V::set1(0.5f);
+
+      for (size_t i = 0; i < boxes.count; i += V::W) {
+        size_t lanes = boxes.count - i < V::W ? boxes.count - i : V::W;
+        float padded[6][V::W];
+        F bounds[6];
+
+        for (int k = 0; k < 6; k++) {
+          const float* source = boxes.data[k] + i;
+          if (lanes == V::W) {
+            bounds[k] = V::load(source);
+          } else {
+            for (unsigned int lane = 0; lane < V::W; lane++) {
+              padded[k][lane] = source[lane < lanes ? lane : lanes - 1];
+            }
+            bounds[k] = V::load(padded[k]);
+          }
+        }
+
+        F centerX = V::mul(V::add(bounds[0], bounds[3]), half);
+        F centerY = V::mul(V::add(bounds[1], bounds[4]), half);
+        F centerZ = V::mul(V::add(bounds[2], bounds[5]), half);
+        F extentX = V::mul(V::sub(bounds[3], bounds[0]), half);
+        F extentY = V::mul(V::sub(bounds[4], bounds[1]), half);
+        F extentZ = V::mul(V::sub(bounds[5], bounds[2]), half);
+
+        M inside = V::ge(zero, zero);
+        for (int p = 0; p < planeCount; p++) {
+          const float* plane = planes + p * 4;
+
+          // plain comparisons, std::fabs would be an inline function shared with other units
+          float absX = plane[0] < 0.0f ? -plane[0] : plane[0];
+          float absY = plane[1] < 0.0f ? -plane[1] : plane[1];
+          float absZ = plane[2] < 0.0f ? -plane[2] : plane[2];
+
+          F distance = V::add(dot3<V>(V::set1(plane[0]), V::set1(plane[1]), V::set1(plane[2]), centerX, centerY, centerZ), V::set1(plane[3]));
+          F radius = dot3<V>(V::set1(absX), V::set1(absY), V::set1(absZ), extentX, extentY, extentZ);
+          inside = V::andm(inside, V::ge(V::add(distance, radius), zero));
+        }
+
+        I result = V::selecti(inside, V::seti(1), V::seti(0));
+        if (lanes == V::W) {
+          V::storei(visible + i, result);
+        } else {
+          int flags[V::W];
+          V::storei(flags, result);
+          for (size_t lane = 0; lane < lanes; lane++) {
+            visible[i + lane] = flags[lane];
+          }
+        }
+      }
+    }
+
+    /**
+     * Fills a kernel table with the instantiations for one traits type.
+     */
+    template <typename V>
+    inline Kernels makeKernels(ISA isa)
+    {
+      Kernels kernels = { isa, V::W, &intersectSpheres<V>, &intersectPlanes<V>, &intersectTriangles<V>, &intersectBoxes<V>, &cullBoxes<V> };
+      return kernels;
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#include "packet.h"
+
+#include <cmath>
+
+namespace sunstorm
+{
+  namespace simd
+  {
+    namespace
+    {
+      // one ray per packet, the baseline the wider kernels are measured against
+      struct ScalarTraits
+      {
+        typedef float F;
+        typedef bool M;
+        typedef int I;
+        static const unsigned int W = 1;
+
+        static inline F load(const float* p) { return *p; }
+        static inline void store(float* p, F a) { *p = a; }
+        static inline I loadi(const int* p) { return *p; }
+        static inline void storei(int* p, I a) { *p = a; }
+        static inline F set1(float a) { return a; }
+        static inline I seti(int a) { return a; }
+        static inline F add(F a, F b) { return a + b; }
+        static inline F sub(F a, F b) { return a - b; }
+        static inline F mul(F a, F b) { return a * b; }
+        static inline F div(F a, F b) { return a / b; }
+        static inline F sqrt(F a) { return std::sqrt(a); }
+        static inline F min(F a, F b) { return a < b ? a : b; }
+        static inline F max(F a, F b) { return a > b ? a : b; }
+        static inline M lt(F a, F b) { return a < b; }
+        static inline M gt(F a, F b) { return a > b; }
+        static inline M ge(F a, F b) { return a >= b; }
+        static inline M andm(M a, M b) { return a && b; }
+        static inline F select(M m, F a, F b) { return m ? a : b; }
+        static inline I selecti(M m, I a, I b) { return m ? a : b; }
+      };
+    }
+
+    const Kernels* getScalarKernels()
+    {
+      static const Kernels kernels = makeKernels<ScalarTraits>(ISA::Scalar);
+      return &kernels;
+    }
+  }
+}
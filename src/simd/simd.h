@@ -0,0 +1,276 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define SSRT_SIMD_X86
+#endif
+
+namespace sunstorm
+{
+  namespace simd
+  {
+    /**
+     * Instruction sets with a packet implementation, ordered from narrowest
+     * to widest so they can be compared.
+     */
+    enum class ISA
+    {
+      Scalar = 0,
+      SSE = 1,
+      AVX2 = 2,
+      AVX512 = 3
+    };
+
+    /**
+     * Rays in SoA form, the count need not be a multiple of the packet width.
+     * Each ray keeps the nearest hit found so far so primitive sets can be
+     * intersected one after another.
+     */
+    struct RayStream
+    {
+      const float* originX;
+      const float* originY;
+      const float* originZ;
+      const float* directionX;
+      const float* directionY;
+      const float* directionZ;
+      float* dist;                // in: furthest distance accepted, out: nearest hit
+      int* primitive;             // out: index of the nearest primitive, untouched on a miss
+      size_t count;
+    };
+
+    /**
+     * Raw SoA arrays of one primitive set, what the packet kernels read.
+     */
+    struct PrimitiveArrays
+    {
+      const float* data[9];
+      size_t count;
+    };
+
+    // every packet kernel has this signature so they can sit in one table
+    typedef void (*IntersectFn)(const RayStream& rays, const PrimitiveArrays& primitives, int firstIndex);
+
+    // writes 1 for boxes not wholly behind any of the planes, 0 for the rest
+    typedef void (*CullFn)(const PrimitiveArrays& boxes, const float* planes, int planeCount, int* visible);
+
+    /**
+     * Table of packet kernels compiled for one instruction set.
+     */
+    struct Kernels
+    {
+      ISA isa;
+      unsigned int width;
+      IntersectFn spheres;
+      IntersectFn planes;
+      IntersectFn triangles;
+      IntersectFn boxes;
+      CullFn cullBoxes;
+    };
+
+    /**
+     * @brief Get the kernels for an instruction set, each lives in its own
+     *    translation unit built with the matching compiler flags.
+     *
+     * @return const Kernels* Kernel table or nullptr if not built for this target
+     */
+    const Kernels* getScalarKernels();
+    const Kernels* getSSEKernels();
+    const Kernels* getAVX2Kernels();
+    const Kernels* getAVX512Kernels();
+
+    /**
+     * @brief Finds the widest instruction set the CPU and operating system
+     *    support, queried once with cpuid and cached.
+     *
+     * @return ISA
+     */
+    ISA detectISA();
+
+    /**
+     * @brief Query if the kernels for an instruction set can run on this machine.
+     *
+     * @param isa Instruction set
+     * @return true If built in and supported by the CPU
+     */
+    bool isSupported(ISA isa);
+
+    /**
+     * @brief Get the display name of an instruction set.
+     *
+     * @param isa Instruction set
+     * @return std::string
+     */
+    std::string getISAName(ISA isa);
+
+    struct Spheres
+    {
+      std::vector<float> x, y, z, radius;
+
+      /**
+       * @brief Appends a sphere.
+       */
+      void add(float cx, float cy, float cz, float r);
+
+      /**
+       * @brief Get the arrays read by the packet kernels.
+       *
+       * @return PrimitiveArrays
+       */
+      PrimitiveArrays getArrays() const;
+
+      inline size_t size() const {
+        return x.size();
+      }
+    };
+
+    struct Planes
+    {
+      std::vector<float> normalX, normalY, normalZ, d;
+
+      /**
+       * @brief Appends a plane, points on it satisfy dot(normal, p) + d = 0.
+       */
+      void add(float nx, float ny, float nz, float distance);
+
+      /**
+       * @brief Get the arrays read by the packet kernels.
+       *
+       * @return PrimitiveArrays
+       */
+      PrimitiveArrays getArrays() const;
+
+      inline size_t size() const {
+        return normalX.size();
+      }
+    };
+
+    struct Triangles
+    {
+      // first vertex and the two edges leaving it, precomputed for Moller-Trumbore
+      std::vector<float> x, y, z, edge1X, edge1Y, edge1Z, edge2X, edge2Y, edge2Z;
+
+      /**
+       * @brief Appends a triangle from its three vertex positions.
+       */
+      void add(const float* v0, const float* v1, const float* v2);
+
+      /**
+       * @brief Get the arrays read by the packet kernels.
+       *
+       * @return PrimitiveArrays
+       */
+      PrimitiveArrays getArrays() const;
+
+      inline size_t size() const {
+        return x.size();
+      }
+    };
+
+    struct Boxes
+    {
+      std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+      /**
+       * @brief Appends an axis aligned box.
+       */
+      void add(const float* min, const float* max);
+
+      /**
+       * @brief Get the arrays read by the packet kernels.
+       *
+       * @return PrimitiveArrays
+       */
+      PrimitiveArrays getArrays() const;
+
+      inline size_t size() const {
+        return minX.size();
+      }
+    };
+
+    class Intersector
+    {
+    private:
+      const Kernels* kernels;
+
+    public:
+      /**
+       * @brief Construct a new Intersector object which runs ray streams through
+       *    the packet kernels of one instruction set.
+       *
+       * @param isa Instruction set, falls back to the widest supported one
+       */
+      Intersector(ISA isa = detectISA());
+
+      /**
+       * @brief Finds the nearest sphere along each ray, hits must be in front of
+       *    the origin and closer than the distance already stored.
+       *
+       * @param rays Ray stream updated in place
+       * @param spheres Spheres to test
+       * @param firstIndex Index written for the first primitive
+       */
+      void intersect(const RayStream& rays, const Spheres& spheres, int firstIndex = 0) const;
+
+      /**
+       * @brief Finds the nearest plane along each ray.
+       *
+       * @param rays Ray stream updated in place
+       * @param planes Planes to test
+       * @param firstIndex Index written for the first primitive
+       */
+      void intersect(const RayStream& rays, const Planes& planes, int firstIndex = 0) const;
+
+      /**
+       * @brief Finds the nearest triangle along each ray.
+       *
+       * @param rays Ray stream updated in place
+       * @param triangles Triangles to test
+       * @param firstIndex Index written for the first primitive
+       */
+      void intersect(const RayStream& rays, const Triangles& triangles, int firstIndex = 0) const;
+
+      /**
+       * @brief Finds the nearest box entry along each ray, rays starting inside
+       *    a box enter it at distance 0.
+       *
+       * @param rays Ray stream updated in place
+       * @param boxes Boxes to test
+       * @param firstIndex Index written for the first primitive
+       */
+      void intersect(const RayStream& rays, const Boxes& boxes, int firstIndex = 0) const;
+
+      /**
+       * @brief Tests boxes against a set of planes a packet of boxes at a time,
+       *    a box is culled once it lies wholly behind any plane.
+       * 
+       * @param boxes Boxes to test
+       * @param planes Plane equations as nx, ny, nz, d, inside where dot(n, p) + d >= 0
+       * @param planeCount Number of planes
+       * @param visible Output flag per box, 1 if it may be visible
+       */
+      void cull(const PrimitiveArrays& boxes, const float* planes, int planeCount, int* visible) const;
+
+      /**
+       * @brief Get the instruction set in use
+       *
+       * @return ISA
+       */
+      inline ISA getISA() const {
+        return kernels->isa;
+      }
+
+      /**
+       * @brief Get the number of rays in a packet
+       *
+       * @return unsigned int
+       */
+      inline unsigned int getWidth() const {
+        return kernels->width;
+      }
+    };
+  }
+}
@@ -0,0 +1,63 @@
+#include "packet.h"
+
+#ifdef SSRT_SIMD_X86
+#include <emmintrin.h>
+#endif
+
+namespace sunstorm
+{
+  namespace simd
+  {
+#ifdef SSRT_SIMD_X86
+    namespace
+    {
+      // SSE2 only, which every x86-64 target has, so this unit needs no extra flags
+      struct SSETraits
+      {
+        typedef __m128 F;
+        typedef __m128 M;
+        typedef __m128i I;
+        static const unsigned int W = 4;
+
+        static inline F load(const float* p) { return _mm_loadu_ps(p); }
+        static inline void store(float* p, F a) { _mm_storeu_ps(p, a); }
+        static inline I loadi(const int* p) { return _mm_loadu_si128((const __m128i*) p); }
+        static inline void storei(int* p, I a) { _mm_storeu_si128((__m128i*) p, a); }
+        static inline F set1(float a) { return _mm_set1_ps(a); }
+        static inline I seti(int a) { return _mm_set1_epi32(a); }
+        static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+        static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+        static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+        static inline F div(F a, F b) { return _mm_div_ps(a, b); }
+        static inline F sqrt(F a) { return _mm_sqrt_ps(a); }
+        static inline F min(F a, F b) { return _mm_min_ps(a, b); }
+        static inline F max(F a, F b) { return _mm_max_ps(a, b); }
+        static inline M lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+        static inline M gt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+        static inline M ge(F a, F b) { return _mm_cmpge_ps(a, b); }
+        static inline M andm(M a, M b) { return _mm_and_ps(a, b); }
+
+        // no blend before SSE4.1, so masks pick lanes with and/andnot/or
+        static inline F select(M m, F a, F b) { 
+          return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); 
+        }
+        static inline I selecti(M m, I a, I b) { 
+          __m128i mi = _mm_castps_si128(m);
+          return _mm_or_si128(_mm_and_si128(mi, a), _mm_andnot_si128(mi, b)); 
+        }
+      };
+    }
+
+    const Kernels* getSSEKernels()
+    {
+      static const Kernels kernels = makeKernels<SSETraits>(ISA::SSE);
+      return &kernels;
+    }
+#else
+    const Kernels* getSSEKernels()
+    {
+      return nullptr;
+    }
+#endif
+  }
+}
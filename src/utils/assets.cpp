@@ -0,0 +1,337 @@
+#include "utils.h"
+
+#include <cstring>
+
+namespace sunstorm
+{
+  namespace io
+  {
+    // staging slots in flight, a slot is reused once the GPU is this many frames behind
+    static const size_t STAGING_FRAMES = 3;
+
+    AssetLoader::AssetLoader(unsigned int threadCount, size_t frameBudget, VertexLayout layout) 
+      : pending(0), stopping(false), layout(layout), staging(nullptr), frameBudget(std::max<size_t>(frameBudget, 4096)), 
+        fences(STAGING_FRAMES, nullptr), frame(0), uploadedBytes(0)
+    {
+      if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+      }
+
+      // a persistent coherent mapping lets frames write into slots with no map calls or flushes
+      size_t stagingSize = this->frameBudget * STAGING_FRAMES;
+      glGenBuffers(1, &stagingBuffer);
+      glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+      if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_READ_BUFFER, (GLsizeiptr) stagingSize, nullptr, flags);
+        staging = (unsigned char*) glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr) stagingSize, flags);
+      } else {
+        glBufferData(GL_COPY_READ_BUFFER, (GLsizeiptr) stagingSize, nullptr, GL_STREAM_DRAW);
+      }
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+      for (unsigned int i = 0; i < threadCount; i++) {
+        threads.emplace_back(&AssetLoader::workerLoop, this);
+      }
+
+      SSRT_DBG_OUTPUT("Created Asset Loader: " << threadCount << " workers, " << (staging ? "persistent" : "buffered") << " staging");
+    }
+
+    AssetLoader::~AssetLoader()
+    {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      wake.notify_all();
+
+      for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+      }
+
+      // the objects of partly uploaded assets are released with them
+      for (PendingAsset* asset : requests) {
+        delete asset;
+      }
+      for (PendingAsset* asset : decoded) {
+        delete asset->texture;
+        delete asset->mesh;
+        delete asset;
+      }
+
+      for (GLsync fence : fences) {
+        if (fence) {
+          glDeleteSync(fence);
+        }
+      }
+
+      if (staging) {
+        glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+      }
+      glDeleteBuffers(1, &stagingBuffer);
+
+      SSRT_DBG_OUTPUT("Destroyed Asset Loader");
+    }
+
+    std::shared_future<gfx::Texture*> AssetLoader::loadTexture(std::string filepath)
+    {
+      PendingAsset* asset = new PendingAsset();
+      asset->type = AssetType::Texture;
+      asset->filepath = filepath;
+      std::shared_future<gfx::Texture*> future = asset->texturePromise.get_future().share();
+
+      pending++;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        requests.push_back(asset);
+      }
+      wake.notify_one();
+      return future;
+    }
+
+    std::shared_future<gfx::Mesh*> AssetLoader::loadMesh(std::string filepath)
+    {
+      PendingAsset* asset = new PendingAsset();
+      asset->type = AssetType::Mesh;
+      asset->filepath = filepath;
+      asset->layout = layout;
+      std::shared_future<gfx::Mesh*> future = asset->meshPromise.get_future().share();
+
+      pending++;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        requests.push_back(asset);
+      }
+      wake.notify_one();
+      return future;
+    }
+
+    void AssetLoader::workerLoop()
+    {
+      // the global stb flag is not thread safe, readTextureFile may be changing it on the GL thread
+      stbi_set_flip_vertically_on_load_thread(true);
+
+      while (true) {
+        PendingAsset* asset;
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          wake.wait(guard, [this] { return stopping || !requests.empty(); });
+
+          if (stopping) {
+            return;
+          }
+          asset = requests.front();
+          requests.pop_front();
+        }
+
+        decode(*asset);
+
+        std::lock_guard<std::mutex> guard(lock);
+        decoded.push_back(asset);
+      }
+    }
+
+    void AssetLoader::decode(PendingAsset& asset)
+    {
+      if (asset.type == AssetType::Texture) {
+        int comp;
+        unsigned char* image = stbi_load((RES_DIR + asset.filepath).c_str(), &asset.width, &asset.height, &comp, STBI_rgb_alpha);
+
+        if (image == nullptr) {
+          std::cerr << "[Error] Failed to read image file: " << asset.filepath << "! - " << stbi_failure_reason() << std::endl;
+          return;
+        }
+
+        asset.data.assign(image, image + (size_t) asset.width * asset.height * 4);
+        stbi_image_free(image);
+        asset.loaded = true;
+        return;
+      }
+
+      // packed straight out of the mapping so page faults and conversion happen here rather than on the GL thread
+      MeshData mesh;
+      MeshFile* file = importMeshFile(asset.filepath, nullptr, &mesh);
+      if (file) {
+        asset.vertexCount = file->getVertexCount();
+        asset.indexCount = file->getIndexCount();
+        asset.boundsMin = file->getBoundsMin();
+        asset.boundsMax = file->getBoundsMax();
+        asset.vertexBytes = packMesh(asset.layout, file->getVertices(), asset.vertexCount, file->getIndices(), asset.indexCount, asset.data);
+        asset.loaded = true;
+        delete file;
+        return;
+      }
+
+      // the cache directory may not be writable, so falls back to interleaving the optimized arrays the import left
+      if (mesh.indices.empty()) {
+        return;
+      }
+
+      std::vector<MeshVertex> vertices;
+      interleaveMesh(mesh, vertices);
+
+      asset.vertexCount = vertices.size();
+      asset.indexCount = mesh.indices.size();
+      computeBounds(vertices.data(), vertices.size(), asset.boundsMin, asset.boundsMax);
+      asset.vertexBytes = packMesh(asset.layout, vertices.data(), asset.vertexCount, mesh.indices.data(), asset.indexCount, asset.data);
+      asset.loaded = true;
+    }
+
+    void AssetLoader::createObject(PendingAsset& asset)
+    {
+      if (asset.type == AssetType::Texture) {
+        asset.texture = new gfx::Texture(asset.filepath, GL_TEXTURE_2D);
+        asset.texture->bind(0);
+        asset.texture->storeTexture2D(asset.width, asset.height, 0, nullptr);
+        asset.texture->unbind(0);
+        return;
+      }
+
+      asset.mesh = new gfx::Mesh(asset.filepath);
+      asset.mesh->setVertexCount((int) asset.indexCount);
+      asset.mesh->setBounds(asset.boundsMin, asset.boundsMax);
+      asset.mesh->createInterleavedBuffer(nullptr, (GLsizeiptr) asset.vertexBytes, getVertexStride(asset.layout), getVertexAttributes(asset.layout));
+      asset.mesh->createElementBuffer(nullptr, getIndexType(asset.layout, asset.vertexCount));
+    }
+
+    void AssetLoader::copyFromStaging(PendingAsset& asset, size_t offset, size_t size)
+    {
+      if (asset.type == AssetType::Texture) {
+        // ranges are whole rows, the pixel pointer becomes an offset into the bound unpack buffer
+        size_t rowBytes = (size_t) asset.width * 4;
+        asset.texture->bind(0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint) (asset.uploaded / rowBytes), asset.width, (GLsizei) (size / rowBytes), 
+          GL_RGBA, GL_UNSIGNED_BYTE, (const void*) offset);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        asset.texture->unbind(0);
+        return;
+      }
+
+      // ranges never straddle the vertex and index data so each lands in one buffer
+      bool vertices = asset.uploaded < asset.vertexBytes;
+      GLuint target = vertices ? asset.mesh->getVertexBufferId(0) : asset.mesh->getElementBufferId();
+      size_t targetOffset = vertices ? asset.uploaded : asset.uploaded - asset.vertexBytes;
+
+      glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) offset, (GLintptr) targetOffset, (GLsizeiptr) size);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    void AssetLoader::complete(PendingAsset* asset)
+    {
+      if (asset->type == AssetType::Texture) {
+        if (asset->texture) {
+          asset->texture->bind(0);
+          asset->texture->genMipmaps();
+          asset->texture->unbind(0);
+        }
+        asset->texturePromise.set_value(asset->texture);
+      } else {
+        asset->meshPromise.set_value(asset->mesh);
+      }
+      delete asset;
+    }
+
+    void AssetLoader::update()
+    {
+      uploadedBytes = 0;
+      size_t slot = frame % STAGING_FRAMES;
+
+      // the GPU still reading this slot means it is behind, skipping a frame of uploads beats stalling
+      if (fences[slot]) {
+        GLenum status = glClientWaitSync(fences[slot], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+          return;
+        }
+        glDeleteSync(fences[slot]);
+        fences[slot] = nullptr;
+      }
+
+      size_t slotOffset = slot * frameBudget;
+      size_t used = 0;
+
+      while (used < frameBudget) {
+        PendingAsset* asset;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          if (decoded.empty()) {
+            break;
+          }
+          asset = decoded.front();
+        }
+
+        if (!asset->loaded) {
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            decoded.pop_front();
+          }
+          complete(asset);
+          pending--;
+          continue;
+        }
+
+        if (!asset->texture && !asset->mesh) {
+          createObject(*asset);
+        }
+
+        size_t total = asset->data.size();
+        size_t size = std::min(total - asset->uploaded, frameBudget - used);
+        if (asset->type == AssetType::Texture) {
+          size_t rowBytes = (size_t) asset->width * 4;
+          size = size / rowBytes * rowBytes;
+
+          // a row wider than the whole budget could never be staged
+          if (rowBytes > frameBudget) {
+            std::cerr << "[Error] Texture rows exceed the upload budget: " << asset->filepath << "!" << std::endl;
+            delete asset->texture;
+            asset->texture = nullptr;
+            asset->uploaded = total;
+            size = 0;
+          }
+        } else if (asset->uploaded < asset->vertexBytes) {
+          size = std::min(size, asset->vertexBytes - asset->uploaded);
+        }
+
+        // the rest of this asset waits for the next frame's budget
+        if (size == 0 && asset->uploaded < total) {
+          break;
+        }
+
+        if (size > 0) {
+          size_t offset = slotOffset + used;
+          if (staging) {
+            std::memcpy(staging + offset, asset->data.data() + asset->uploaded, size);
+          } else {
+            glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+            glBufferSubData(GL_COPY_READ_BUFFER, (GLintptr) offset, (GLsizeiptr) size, asset->data.data() + asset->uploaded);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+          }
+
+          copyFromStaging(*asset, offset, size);
+          asset->uploaded += size;
+          used += size;
+        }
+
+        if (asset->uploaded == total) {
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            decoded.pop_front();
+          }
+          complete(asset);
+          pending--;
+        }
+      }
+
+      if (used > 0) {
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame++;
+      }
+      uploadedBytes = used;
+    }
+  }
+}
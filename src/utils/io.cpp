@@ -4,19 +4,24 @@ namespace sunstorm
 {
   namespace io 
   {
-    void splitString(std::string str, std::vector<std::string>& out, char delimeter)
+    unsigned long long hashBytes(const void* data, size_t size)
     {
-      out.clear();
-      size_t i0 = 0;
-      size_t i1 = i0;
-
-      while (i1 <= str.length()) {
-        if (str[i1] == delimeter || str[i1] == '\0') {
-          out.push_back(str.substr(i0, i1 - i0));
-          i0 = ++i1;
-        }
-        i1++;
+      const unsigned char* bytes = (const unsigned char*) data;
+      unsigned long long hash = 14695981039346656037ull;
+
+      for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
       }
+
+      return hash;
+    }
+
+    std::string toHex(unsigned long long hash)
+    {
+      char buf[17];
+      std::snprintf(buf, sizeof(buf), "%016llx", hash);
+      return std::string(buf);
     }
 
     std::string readFile(std::string filepath)
@@ -54,92 +59,62 @@ namespace sunstorm
       return texture;
     }
     
-    gfx::Mesh* readOBJFile(std::string filepath)
+    bool writeImageFile(std::string filepath, int width, int height, const unsigned char* pixels)
     {
-      std::ifstream input(RES_DIR + filepath);
+      // rendered images are stored bottom-up like OpenGL textures
+      stbi_flip_vertically_on_write(true);
 
-      if (input.fail() || !input.is_open()) {
-        std::cerr << "[Error] Failed to open file: " << filepath << "!" << std::endl;
+      if (!stbi_write_png(filepath.c_str(), width, height, 4, pixels, width * 4)) {
+        std::cerr << "[Error] Failed to write image file: " << filepath << "!" << std::endl;
+        return false;
       }
 
-      std::vector<glm::vec3> vertices;
-      std::vector<glm::vec2> uvCoords;
-      std::vector<glm::vec3> normals;
-      std::vector<unsigned int> indices;
-
-      std::map<std::string, unsigned int> indexMap;
-
-      // buffered file reading
-      std::vector<std::string> data;
-      
-      for (std::string line; std::getline(input, line);) 
-      {
-        splitString(line, data, ' ');
-        
-        if (data[0] == "v") {
-          vertices.push_back(glm::vec3(
-            std::stof(data[1]),
-            std::stof(data[2]),
-            std::stof(data[3])
-          ));
-        } else if (data[0] == "vt") {
-          uvCoords.push_back(glm::vec2(
-            std::stof(data[1]),
-            std::stof(data[2])
-          ));
-        } else if (data[0] == "vn") {
-          normals.push_back(glm::vec3(
-            std::stof(data[1]),
-            std::stof(data[2]),
-            std::stof(data[3])
-          ));
-        } else if (data[0] == "f") {
-          for (int i=1; i < 4; i++) {
-            if (indexMap.contains(data[i])) {
-              indices.push_back(indexMap[data[i]]);
-            } else {
-              indices.push_back(indexMap.size());
-              indexMap[data[i]] = indexMap.size();
-            }
-          }
+      return true;
+    }
+    
+    gfx::Mesh* readOBJFile(std::string filepath, jobs::ThreadPool* pool, VertexLayout layout)
+    {
+      gfx::Mesh* mesh = new gfx::Mesh(filepath);
+      MeshData data;
+      MeshFile* file = importMeshFile(filepath, pool, &data);
+      std::vector<unsigned char> packed;
+
+      if (file) {
+        mesh->setVertexCount((int) file->getIndexCount());
+        mesh->setBounds(file->getBoundsMin(), file->getBoundsMax());
+
+        // the float layout is the cache's own, so it is uploaded from the mapping without a copy
+        if (layout == VertexLayout::Float) {
+          mesh->createInterleavedBuffer(file->getVertices(), (GLsizeiptr) file->getVertexBytes(), getVertexStride(layout), getVertexAttributes(layout));
+          mesh->createElementBuffer(file->getIndices());
+        } else {
+          size_t vertexBytes = packMesh(layout, file->getVertices(), file->getVertexCount(), file->getIndices(), file->getIndexCount(), packed);
+          mesh->createInterleavedBuffer(packed.data(), (GLsizeiptr) vertexBytes, getVertexStride(layout), getVertexAttributes(layout));
+          mesh->createElementBuffer(packed.data() + vertexBytes, getIndexType(layout, file->getVertexCount()));
         }
+
+        delete file;
+        return mesh;
       }
 
-      size_t vertexCount = (unsigned int) indexMap.size();
-      float* vertexData = new float[vertexCount * 3];
-      float* uvData     = new float[vertexCount * 2];
-      float* normalData = new float[vertexCount * 3];
-
-      int ii, vi, ui, ni;
-      for (std::pair<std::string, unsigned int> kv : indexMap)
-      {
-        splitString(kv.first, data, '/');
-        ii = kv.second;
-        vi = std::stoi(data[0]) - 1;
-        ui = std::stoi(data[1]) - 1;
-        ni = std::stoi(data[2]) - 1;
-
-        vertexData[ii * 3]     = (vertices[vi].x);
-        vertexData[ii * 3 + 1] = (vertices[vi].y);
-        vertexData[ii * 3 + 2] = (vertices[vi].z);
-
-        uvData[ii * 2]         = (uvCoords[ui].x);
-        uvData[ii * 2 + 1]     = (uvCoords[ui].y);
-
-        normalData[ii * 3]     = (normals[ni].x);
-        normalData[ii * 3 + 1] = (normals[ni].y);
-        normalData[ii * 3 + 2] = (normals[ni].z);
+      // the cache directory may not be writable, so falls back to uploading the optimized arrays the import left
+      if (data.indices.empty()) {
+        std::cerr << "[Error] Failed to load mesh: " << filepath << "!" << std::endl;
+        delete mesh;
+        return nullptr;
       }
 
-      gfx::Mesh* mesh = new gfx::Mesh(filepath);
-      mesh->setVertexCount(indices.size());
-      mesh->createVertexBuffer(0, 3, vertexData, vertexCount);
-      mesh->createVertexBuffer(1, 2, uvData, vertexCount);
-      mesh->createVertexBuffer(2, 3, normalData, vertexCount);
-      mesh->createElementBuffer(indices.data());
-      free(vertexData);
-      free(uvData);
-      free(normalData);
+      std::vector<MeshVertex> vertices;
+      interleaveMesh(data, vertices);
+
+      glm::vec3 boundsMin, boundsMax;
+      computeBounds(vertices.data(), vertices.size(), boundsMin, boundsMax);
+      mesh->setBounds(boundsMin, boundsMax);
+
+      size_t vertexBytes = packMesh(layout, vertices.data(), vertices.size(), data.indices.data(), data.indices.size(), packed);
+      mesh->setVertexCount((int) data.indices.size());
+      mesh->createInterleavedBuffer(packed.data(), (GLsizeiptr) vertexBytes, getVertexStride(layout), getVertexAttributes(layout));
+      mesh->createElementBuffer(packed.data() + vertexBytes, getIndexType(layout, vertices.size()));
 
       return mesh;
     }
@@ -0,0 +1,136 @@
+#include "utils.h"
+
+namespace sunstorm
+{
+  namespace jobs
+  {
+    ThreadPool::ThreadPool(unsigned int threadCount) : remaining(0), generation(0), stopping(false)
+    {
+      if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+      }
+
+      for (unsigned int i = 0; i < threadCount; i++) {
+        queues.push_back(new WorkQueue());
+      }
+
+      // worker 0 is the thread calling parallelFor
+      for (unsigned int i = 1; i < threadCount; i++) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+      }
+
+      SSRT_DBG_OUTPUT("Created Thread Pool: " << threadCount << " workers");
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      wake.notify_all();
+
+      for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+      }
+
+      for (size_t i = 0; i < queues.size(); i++) {
+        delete queues[i];
+      }
+
+      SSRT_DBG_OUTPUT("Destroyed Thread Pool");
+    }
+
+    void ThreadPool::parallelFor(size_t count, std::function<void(size_t, unsigned int)> fn)
+    {
+      if (count == 0) {
+        return;
+      }
+
+      job = fn;
+      remaining = count;
+
+      // deals contiguous blocks so neighbouring tiles stay on one core
+      size_t workers = queues.size();
+      for (size_t w = 0; w < workers; w++) {
+        std::lock_guard<std::mutex> guard(queues[w]->lock);
+        for (size_t t = count * w / workers; t < count * (w + 1) / workers; t++) {
+          queues[w]->tasks.push_back(t);
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+      }
+      wake.notify_all();
+
+      runTasks(0);
+
+      std::unique_lock<std::mutex> guard(lock);
+      done.wait(guard, [this] { return remaining == 0; });
+    }
+
+    void ThreadPool::workerLoop(unsigned int index)
+    {
+      unsigned long long seen = 0;
+
+      while (true) {
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          wake.wait(guard, [this, seen] { return stopping || generation != seen; });
+
+          if (stopping) {
+            return;
+          }
+          seen = generation;
+        }
+
+        runTasks(index);
+      }
+    }
+
+    void ThreadPool::runTasks(unsigned int index)
+    {
+      size_t workers = queues.size();
+
+      while (true) {
+        size_t task = 0;
+        bool found = false;
+
+        // own queue is consumed from the front
+        {
+          WorkQueue* own = queues[index];
+          std::lock_guard<std::mutex> guard(own->lock);
+          if (!own->tasks.empty()) {
+            task = own->tasks.front();
+            own->tasks.pop_front();
+            found = true;
+          }
+        }
+
+        // victims are robbed from the back to avoid contending with their owner
+        for (size_t i = 1; i < workers && !found; i++) {
+          WorkQueue* victim = queues[(index + i) % workers];
+          std::lock_guard<std::mutex> guard(victim->lock);
+          if (!victim->tasks.empty()) {
+            task = victim->tasks.back();
+            victim->tasks.pop_back();
+            found = true;
+          }
+        }
+
+        if (!found) {
+          return;
+        }
+
+        job(task, index);
+
+        if (--remaining == 0) {
+          std::lock_guard<std::mutex> guard(lock);
+          done.notify_all();
+        }
+      }
+    }
+  }
+}
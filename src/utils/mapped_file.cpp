@@ -0,0 +1,101 @@
+#include "utils.h"
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace sunstorm
+{
+  namespace io
+  {
+#ifdef _WIN32
+    MappedFile::MappedFile(std::string filepath) : data(nullptr), size(0), valid(false), fileHandle(nullptr), mappingHandle(nullptr)
+    {
+      HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "[Error] Failed to open file: " << filepath << "!" << std::endl;
+        return;
+      }
+      fileHandle = file;
+
+      LARGE_INTEGER fileSize;
+      GetFileSizeEx(file, &fileSize);
+      size = (size_t) fileSize.QuadPart;
+
+      // empty files cannot be mapped but are still valid
+      if (size == 0) {
+        valid = true;
+        return;
+      }
+
+      mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mappingHandle) {
+        data = (const char*) MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+      }
+
+      if (!data) {
+        std::cerr << "[Error] Failed to map file: " << filepath << "!" << std::endl;
+        return;
+      }
+      valid = true;
+    }
+
+    MappedFile::~MappedFile()
+    {
+      if (data) {
+        UnmapViewOfFile(data);
+      }
+      if (mappingHandle) {
+        CloseHandle(mappingHandle);
+      }
+      if (fileHandle) {
+        CloseHandle(fileHandle);
+      }
+    }
+#else
+    MappedFile::MappedFile(std::string filepath) : data(nullptr), size(0), valid(false), fileDescriptor(-1)
+    {
+      fileDescriptor = open(filepath.c_str(), O_RDONLY);
+      struct stat info;
+
+      if (fileDescriptor < 0 || fstat(fileDescriptor, &info) != 0) {
+        std::cerr << "[Error] Failed to open file: " << filepath << "!" << std::endl;
+        return;
+      }
+      size = (size_t) info.st_size;
+
+      // empty files cannot be mapped but are still valid
+      if (size == 0) {
+        valid = true;
+        return;
+      }
+
+      void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+      if (mapping == MAP_FAILED) {
+        std::cerr << "[Error] Failed to map file: " << filepath << "!" << std::endl;
+        return;
+      }
+
+      madvise(mapping, size, MADV_SEQUENTIAL);
+      data = (const char*) mapping;
+      valid = true;
+    }
+
+    MappedFile::~MappedFile()
+    {
+      if (data) {
+        munmap((void*) data, size);
+      }
+      if (fileDescriptor >= 0) {
+        close(fileDescriptor);
+      }
+    }
+#endif
+  }
+}
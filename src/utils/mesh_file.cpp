@@ -0,0 +1,166 @@
+#include "utils.h"
+
+#include <cstring>
+
+namespace sunstorm
+{
+  namespace io
+  {
+    // bumped whenever the stored layout or triangle order changes so old caches are reimported
+    static const char MESH_MAGIC[8] = { 'S', 'S', 'M', 'E', 'S', 'H', '0', '2' };
+
+    // keeps the arrays aligned for SIMD loads and the driver's copy paths
+    static const unsigned long long MESH_ALIGNMENT = 64;
+
+    static unsigned long long alignOffset(unsigned long long offset)
+    {
+      return (offset + MESH_ALIGNMENT - 1) & ~(MESH_ALIGNMENT - 1);
+    }
+
+    MeshFile::MeshFile(std::string filepath) : file(filepath), header(nullptr)
+    {
+      if (!file.isOpen() || file.getSize() < sizeof(MeshFileHeader)) {
+        return;
+      }
+
+      const MeshFileHeader* h = (const MeshFileHeader*) file.getData();
+      unsigned long long size = file.getSize();
+      unsigned long long vertexBytes = (unsigned long long) h->vertexCount * sizeof(MeshVertex);
+      unsigned long long indexBytes = (unsigned long long) h->indexCount * sizeof(unsigned int);
+
+      // offsets are checked against the file so a truncated cache is never read past its end
+      bool valid = std::memcmp(h->magic, MESH_MAGIC, sizeof(MESH_MAGIC)) == 0
+        && h->vertexStride == sizeof(MeshVertex)
+        && h->vertexOffset % MESH_ALIGNMENT == 0 && h->indexOffset % MESH_ALIGNMENT == 0
+        && h->vertexOffset <= size && vertexBytes <= size - h->vertexOffset
+        && h->indexOffset <= size && indexBytes <= size - h->indexOffset;
+
+      if (valid) {
+        header = h;
+      }
+    }
+
+    bool MeshFile::write(std::string filepath, const MeshData& mesh, unsigned long long sourceSize, long long sourceTime)
+    {
+      MeshFileHeader header = {};
+      std::memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+      header.sourceSize = sourceSize;
+      header.sourceTime = sourceTime;
+      header.vertexCount = (unsigned int) mesh.getVertexCount();
+      header.indexCount = (unsigned int) mesh.indices.size();
+      header.vertexStride = sizeof(MeshVertex);
+      header.vertexOffset = alignOffset(sizeof(MeshFileHeader));
+      header.indexOffset = alignOffset(header.vertexOffset + (unsigned long long) header.vertexCount * sizeof(MeshVertex));
+
+      glm::vec3 bmin = glm::vec3(header.vertexCount > 0 ? INFINITY : 0.0f);
+      glm::vec3 bmax = glm::vec3(header.vertexCount > 0 ? -INFINITY : 0.0f);
+      std::vector<MeshVertex> vertices(header.vertexCount);
+
+      for (size_t i = 0; i < vertices.size(); i++) {
+        MeshVertex& v = vertices[i];
+        std::memcpy(v.position, &mesh.positions[i * 3], sizeof(v.position));
+        std::memcpy(v.uv, &mesh.uvs[i * 2], sizeof(v.uv));
+        std::memcpy(v.normal, &mesh.normals[i * 3], sizeof(v.normal));
+
+        glm::vec3 p = glm::vec3(v.position[0], v.position[1], v.position[2]);
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+      }
+
+      for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = bmin[i];
+        header.boundsMax[i] = bmax[i];
+      }
+
+      std::error_code ec;
+      std::filesystem::path path = std::filesystem::path(filepath);
+      std::filesystem::create_directories(path.parent_path(), ec);
+
+      // written under a temporary name so a crash never leaves a partial cache behind, unique per
+      // thread as loader workers may import the same model at once
+      std::string temp = filepath + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+        + "-" + std::to_string(time::getTimeMicroseconds());
+      std::ofstream output(temp, std::ios::binary);
+      if (!output.is_open()) {
+        return false;
+      }
+
+      static const char padding[MESH_ALIGNMENT] = {};
+      output.write((const char*) &header, sizeof(header));
+      output.write(padding, header.vertexOffset - sizeof(header));
+      output.write((const char*) vertices.data(), vertices.size() * sizeof(MeshVertex));
+      output.write(padding, header.indexOffset - header.vertexOffset - vertices.size() * sizeof(MeshVertex));
+      output.write((const char*) mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+      output.close();
+
+      if (!output) {
+        std::filesystem::remove(temp, ec);
+        return false;
+      }
+
+      std::filesystem::rename(temp, path, ec);
+      if (ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+      }
+      return true;
+    }
+
+    MeshFile* importMeshFile(std::string filepath, jobs::ThreadPool* pool, MeshData* fallback)
+    {
+      std::error_code ec;
+      std::filesystem::path source = std::filesystem::path(RES_DIR + filepath);
+      unsigned long long sourceSize = std::filesystem::file_size(source, ec);
+      if (ec) {
+        std::cerr << "[Error] Failed to open file: " << filepath << "!" << std::endl;
+        return nullptr;
+      }
+      long long sourceTime = (long long) std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+
+      // keyed on the path so models with the same name in different folders do not collide
+      std::string cachePath = CACHE_DIR + "meshes/" + source.stem().string() + "-" + toHex(hashBytes(filepath.data(), filepath.size())) + ".ssmesh";
+
+      if (std::filesystem::exists(cachePath, ec)) {
+        MeshFile* file = new MeshFile(cachePath);
+        if (file->isOpen() && file->getHeader().sourceSize == sourceSize && file->getHeader().sourceTime == sourceTime) {
+          SSRT_DBG_OUTPUT("Loaded mesh cache: " << cachePath);
+          return file;
+        }
+
+        // the stale mapping must be closed before the file can be replaced
+        delete file;
+      }
+
+      MeshData data;
+      long long t0 = time::getTimeMicroseconds();
+      if (!parseOBJFile(filepath, data, pool)) {
+        return nullptr;
+      }
+
+      // paid once per import, every later load maps the optimized order
+      MeshOptimizeStats stats = optimizeMesh(data);
+      SSRT_DBG_OUTPUT("Optimized " << filepath << ": ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter << " over " << stats.clusters << " clusters");
+
+      // the optimized arrays are handed back so an unwritable cache costs neither a second parse nor the ordering
+      if (!MeshFile::write(cachePath, data, sourceSize, sourceTime)) {
+        SSRT_DBG_OUTPUT("Failed to write mesh cache: " << cachePath);
+        if (fallback) {
+          *fallback = std::move(data);
+        }
+        return nullptr;
+      }
+
+      MeshFile* file = new MeshFile(cachePath);
+      if (!file->isOpen()) {
+        delete file;
+        if (fallback) {
+          *fallback = std::move(data);
+        }
+        return nullptr;
+      }
+
+      SSRT_DBG_OUTPUT("Imported " << filepath << " into mesh cache in " << (time::getTimeMicroseconds() - t0) / 1000.0 << " ms");
+      return file;
+    }
+  }
+}
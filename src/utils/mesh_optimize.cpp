@@ -0,0 +1,347 @@
+#include "utils.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+
+namespace sunstorm
+{
+  namespace io
+  {
+    // LRU cache modelled while ordering triangles, larger than real hardware so orders degrade gracefully
+    static const int FORSYTH_CACHE_SIZE = 32;
+
+    // FIFO cache modelled for ACMR and cluster boundaries, a common post-transform cache size
+    static const unsigned int FIFO_CACHE_SIZE = 16;
+
+    /**
+     * Score of a vertex in Forsyth's algorithm, vertices near the front of
+     * the cache and with few triangles left are preferred.
+     */
+    static float forsythScore(int cachePosition, unsigned int remaining)
+    {
+      if (remaining == 0) {
+        return -1.0f;
+      }
+
+      float score = 0.0f;
+      if (cachePosition >= 0) {
+        // the last triangle's vertices get a fixed score so it is not immediately repeated
+        if (cachePosition < 3) {
+          score = 0.75f;
+        } else {
+          score = std::pow(1.0f - (cachePosition - 3) / (float) (FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+      }
+      return score + 2.0f * std::pow((float) remaining, -0.5f);
+    }
+
+    /**
+     * Simulates the FIFO cache for one triangle, vertices are cached while
+     * fewer than the cache size of misses happened since they were loaded.
+     */
+    static unsigned int simulateTriangle(const unsigned int* triangle, std::vector<unsigned int>& timestamps, unsigned int& time)
+    {
+      unsigned int misses = 0;
+      for (int c = 0; c < 3; c++) {
+        unsigned int v = triangle[c];
+        if (time - timestamps[v] > FIFO_CACHE_SIZE) {
+          timestamps[v] = time++;
+          misses++;
+        }
+      }
+      return misses;
+    }
+
+    /**
+     * Cuts an order into clusters. Hard boundaries are where a triangle misses
+     * on all three vertices anyway, each hard cluster is then cut wherever
+     * restarting with a cold cache keeps its ACMR within the threshold.
+     */
+    static std::vector<size_t> findClusters(const std::vector<unsigned int>& indices, size_t vertexCount, float threshold)
+    {
+      size_t triangleCount = indices.size() / 3;
+      std::vector<size_t> hard;
+      std::vector<unsigned int> timestamps(vertexCount, 0);
+      unsigned int time = FIFO_CACHE_SIZE + 1;
+
+      for (size_t t = 0; t < triangleCount; t++) {
+        if (simulateTriangle(&indices[t * 3], timestamps, time) == 3 || t == 0) {
+          hard.push_back(t);
+        }
+      }
+      hard.push_back(triangleCount);
+
+      std::vector<size_t> clusters;
+      for (size_t h = 0; h + 1 < hard.size(); h++) {
+        size_t start = hard[h], end = hard[h + 1];
+
+        // bumping the clock past the cache size empties it without clearing the timestamps
+        time += FIFO_CACHE_SIZE + 1;
+        size_t misses = 0;
+        for (size_t t = start; t < end; t++) {
+          misses += simulateTriangle(&indices[t * 3], timestamps, time);
+        }
+        float limit = (float) misses / (end - start) * threshold;
+
+        clusters.push_back(start);
+        time += FIFO_CACHE_SIZE + 1;
+        misses = 0;
+        for (size_t t = start; t < end; t++) {
+          misses += simulateTriangle(&indices[t * 3], timestamps, time);
+
+          if (t + 1 < end && (float) misses / (t + 1 - clusters.back()) <= limit) {
+            clusters.push_back(t + 1);
+            time += FIFO_CACHE_SIZE + 1;
+            misses = 0;
+          }
+        }
+      }
+      return clusters;
+    }
+
+    float computeACMR(const std::vector<unsigned int>& indices, size_t vertexCount)
+    {
+      if (indices.size() < 3) {
+        return 0.0f;
+      }
+
+      std::vector<unsigned int> timestamps(vertexCount, 0);
+      unsigned int time = FIFO_CACHE_SIZE + 1;
+      size_t misses = 0;
+
+      for (size_t t = 0; t < indices.size() / 3; t++) {
+        misses += simulateTriangle(&indices[t * 3], timestamps, time);
+      }
+      return (float) misses / (indices.size() / 3);
+    }
+
+    void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+    {
+      size_t triangleCount = indices.size() / 3;
+      if (triangleCount == 0) {
+        return;
+      }
+
+      // triangles of each vertex, the first remaining[v] entries are the ones not yet emitted
+      std::vector<unsigned int> remaining(vertexCount, 0);
+      for (unsigned int v : indices) {
+        remaining[v]++;
+      }
+
+      std::vector<size_t> offsets(vertexCount + 1, 0);
+      for (size_t v = 0; v < vertexCount; v++) {
+        offsets[v + 1] = offsets[v] + remaining[v];
+      }
+
+      std::vector<unsigned int> adjacency(indices.size());
+      std::vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+      for (size_t t = 0; t < triangleCount; t++) {
+        for (int c = 0; c < 3; c++) {
+          adjacency[cursor[indices[t * 3 + c]]++] = (unsigned int) t;
+        }
+      }
+
+      std::vector<int> cachePosition(vertexCount, -1);
+      std::vector<float> vertexScore(vertexCount);
+      for (size_t v = 0; v < vertexCount; v++) {
+        vertexScore[v] = forsythScore(-1, remaining[v]);
+      }
+
+      std::vector<float> triangleScore(triangleCount);
+      std::vector<bool> emitted(triangleCount, false);
+      for (size_t t = 0; t < triangleCount; t++) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+      }
+
+      std::vector<unsigned int> output;
+      output.reserve(indices.size());
+
+      unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+      int cacheCount = 0;
+      size_t scan = 0;
+      long long best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+
+      while (output.size() < indices.size()) {
+        // nothing in the cache touches a remaining triangle, restarts from the next unemitted one
+        if (best < 0) {
+          while (emitted[scan]) {
+            scan++;
+          }
+          best = (long long) scan;
+        }
+
+        const unsigned int* triangle = &indices[best * 3];
+        emitted[best] = true;
+
+        unsigned int newCache[FORSYTH_CACHE_SIZE + 3];
+        int newCount = 0;
+
+        for (int c = 0; c < 3; c++) {
+          unsigned int v = triangle[c];
+          output.push_back(v);
+
+          // swap-removes the triangle from the vertex's remaining list
+          unsigned int* list = &adjacency[offsets[v]];
+          for (unsigned int i = 0; i < remaining[v]; i++) {
+            if (list[i] == (unsigned int) best) {
+              std::swap(list[i], list[remaining[v] - 1]);
+              remaining[v]--;
+              break;
+            }
+          }
+
+          if (std::find(newCache, newCache + newCount, v) == newCache + newCount) {
+            newCache[newCount++] = v;
+          }
+        }
+
+        // the emitted triangle moves to the front, everything else shifts back
+        for (int i = 0; i < cacheCount; i++) {
+          if (std::find(newCache, newCache + newCount, cache[i]) == newCache + newCount) {
+            newCache[newCount++] = cache[i];
+          }
+        }
+
+        for (int i = 0; i < newCount; i++) {
+          unsigned int v = newCache[i];
+          cachePosition[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+          vertexScore[v] = forsythScore(cachePosition[v], remaining[v]);
+        }
+
+        // only triangles around vertices whose score changed need rescoring
+        best = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < newCount; i++) {
+          unsigned int v = newCache[i];
+          for (unsigned int j = 0; j < remaining[v]; j++) {
+            unsigned int t = adjacency[offsets[v] + j];
+            float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+            triangleScore[t] = score;
+
+            if (score > bestScore) {
+              bestScore = score;
+              best = t;
+            }
+          }
+        }
+
+        cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+        std::copy(newCache, newCache + cacheCount, cache);
+      }
+
+      indices.swap(output);
+    }
+
+    size_t optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<float>& positions, float threshold)
+    {
+      size_t vertexCount = positions.size() / 3;
+      size_t triangleCount = indices.size() / 3;
+      if (triangleCount == 0) {
+        return 0;
+      }
+
+      std::vector<size_t> clusters = findClusters(indices, vertexCount, threshold);
+      clusters.push_back(triangleCount);
+
+      auto position = [&](unsigned int v) {
+        return glm::vec3(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]);
+      };
+
+      // area weighted so dense patches do not pull the centre
+      glm::vec3 meshCentroid = glm::vec3(0.0f);
+      float meshArea = 0.0f;
+      std::vector<glm::vec3> clusterCentroids(clusters.size() - 1, glm::vec3(0.0f));
+      std::vector<glm::vec3> clusterNormals(clusters.size() - 1, glm::vec3(0.0f));
+
+      for (size_t c = 0; c + 1 < clusters.size(); c++) {
+        float clusterArea = 0.0f;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+          glm::vec3 p0 = position(indices[t * 3]);
+          glm::vec3 p1 = position(indices[t * 3 + 1]);
+          glm::vec3 p2 = position(indices[t * 3 + 2]);
+          glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+          float area = glm::length(normal);
+          glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+          clusterCentroids[c] += centroid * area;
+          clusterNormals[c] += normal;
+          clusterArea += area;
+          meshCentroid += centroid * area;
+          meshArea += area;
+        }
+        clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : position(indices[clusters[c] * 3]);
+      }
+      meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+      // clusters facing out from the centre are likely in front of the rest of the mesh, so are drawn first
+      std::vector<float> keys(clusters.size() - 1);
+      for (size_t c = 0; c < keys.size(); c++) {
+        float length = glm::length(clusterNormals[c]);
+        keys[c] = length > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / length) : 0.0f;
+      }
+
+      std::vector<size_t> order(keys.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+      std::vector<unsigned int> output;
+      output.reserve(indices.size());
+      for (size_t c : order) {
+        output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+      }
+      indices.swap(output);
+      return order.size();
+    }
+
+    void optimizeVertexFetch(MeshData& mesh)
+    {
+      size_t vertexCount = mesh.getVertexCount();
+      std::vector<unsigned int> remap(vertexCount, UINT_MAX);
+      unsigned int next = 0;
+
+      // renumbers in order of first use so the vertex fetch walks memory forwards
+      for (unsigned int& v : mesh.indices) {
+        if (remap[v] == UINT_MAX) {
+          remap[v] = next++;
+        }
+        v = remap[v];
+      }
+
+      // unreferenced vertices are kept at the end so counts do not change
+      for (size_t v = 0; v < vertexCount; v++) {
+        if (remap[v] == UINT_MAX) {
+          remap[v] = next++;
+        }
+      }
+
+      std::vector<float> positions(mesh.positions.size());
+      std::vector<float> uvs(mesh.uvs.size());
+      std::vector<float> normals(mesh.normals.size());
+      for (size_t v = 0; v < vertexCount; v++) {
+        std::copy_n(&mesh.positions[v * 3], 3, &positions[remap[v] * 3]);
+        std::copy_n(&mesh.uvs[v * 2], 2, &uvs[remap[v] * 2]);
+        std::copy_n(&mesh.normals[v * 3], 3, &normals[remap[v] * 3]);
+      }
+
+      mesh.positions.swap(positions);
+      mesh.uvs.swap(uvs);
+      mesh.normals.swap(normals);
+    }
+
+    MeshOptimizeStats optimizeMesh(MeshData& mesh)
+    {
+      MeshOptimizeStats stats = {};
+      stats.acmrBefore = computeACMR(mesh.indices, mesh.getVertexCount());
+
+      optimizeVertexCache(mesh.indices, mesh.getVertexCount());
+      stats.acmrCache = computeACMR(mesh.indices, mesh.getVertexCount());
+
+      stats.clusters = optimizeOverdraw(mesh.indices, mesh.positions);
+      optimizeVertexFetch(mesh);
+      stats.acmrAfter = computeACMR(mesh.indices, mesh.getVertexCount());
+      return stats;
+    }
+  }
+}
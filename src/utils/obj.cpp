@@ -0,0 +1,325 @@
+#include "utils.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace sunstorm
+{
+  namespace io
+  {
+    // chunks smaller than this are not worth a task of their own
+    static const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
+
+    struct OBJChunk
+    {
+      std::vector<float> positions;
+      std::vector<float> uvs;
+      std::vector<float> normals;
+
+      // v, vt, vn triples for each triangle corner, 0-based with -1 if missing
+      std::vector<int> corners;
+
+      // corners holding negative OBJ indices, stored relative to this chunk
+      std::vector<size_t> relative;
+    };
+
+    struct CornerTable
+    {
+      std::vector<int> keys;
+      std::vector<unsigned int> values;
+      size_t mask;
+      size_t count;
+
+      CornerTable(size_t expected) : count(0)
+      {
+        size_t capacity = 16;
+        while (capacity < expected * 2) {
+          capacity <<= 1;
+        }
+        resize(capacity);
+      }
+
+      static inline size_t hash(const int* key)
+      {
+        unsigned long long h = (unsigned int) key[0];
+        h = h * 0x9E3779B97F4A7C15ull + (unsigned int) key[1];
+        h = h * 0x9E3779B97F4A7C15ull + (unsigned int) key[2];
+        return (size_t) (h ^ (h >> 29));
+      }
+
+      void resize(size_t capacity)
+      {
+        std::vector<int> oldKeys = std::move(keys);
+        std::vector<unsigned int> oldValues = std::move(values);
+
+        // slots with an empty marker of -2 can never collide with a real or missing index
+        keys.assign(capacity * 3, -2);
+        values.assign(capacity, 0);
+        mask = capacity - 1;
+
+        for (size_t i = 0; i < oldValues.size(); i++) {
+          if (oldKeys[i * 3] != -2) {
+            size_t slot = hash(&oldKeys[i * 3]) & mask;
+            while (keys[slot * 3] != -2) {
+              slot = (slot + 1) & mask;
+            }
+            std::memcpy(&keys[slot * 3], &oldKeys[i * 3], sizeof(int) * 3);
+            values[slot] = oldValues[i];
+          }
+        }
+      }
+
+      /**
+       * @brief Finds the vertex for a corner or inserts it with the next index.
+       * 
+       * @param key v, vt, vn triple
+       * @param inserted Set if the corner was not seen before
+       * @return unsigned int Vertex index
+       */
+      unsigned int insert(const int* key, bool& inserted)
+      {
+        if ((count + 1) * 2 > values.size()) {
+          resize(values.size() * 2);
+        }
+
+        size_t slot = hash(key) & mask;
+        while (keys[slot * 3] != -2) {
+          if (keys[slot * 3] == key[0] && keys[slot * 3 + 1] == key[1] && keys[slot * 3 + 2] == key[2]) {
+            inserted = false;
+            return values[slot];
+          }
+          slot = (slot + 1) & mask;
+        }
+
+        std::memcpy(&keys[slot * 3], key, sizeof(int) * 3);
+        values[slot] = (unsigned int) count;
+        inserted = true;
+        return (unsigned int) count++;
+      }
+    };
+
+    static inline bool isSpace(char c)
+    {
+      return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static inline const char* skipSpaces(const char* p, const char* end)
+    {
+      while (p < end && isSpace(*p)) {
+        p++;
+      }
+      return p;
+    }
+
+    static inline const char* parseFloat(const char* p, const char* end, float& out)
+    {
+      p = skipSpaces(p, end);
+      if (p < end && *p == '+') {
+        p++;
+      }
+
+      std::from_chars_result result = std::from_chars(p, end, out);
+      if (result.ec != std::errc()) {
+        out = 0.0f;
+        while (p < end && !isSpace(*p)) {
+          p++;
+        }
+        return p;
+      }
+      return result.ptr;
+    }
+
+    static inline const char* parseIndex(const char* p, const char* end, int& out)
+    {
+      std::from_chars_result result = std::from_chars(p, end, out);
+      if (result.ec != std::errc()) {
+        out = 0;
+        return p;
+      }
+      return result.ptr;
+    }
+
+    static void parseChunk(const char* begin, const char* end, OBJChunk& chunk)
+    {
+      // face corners before triangulation, with a relative flag per attribute
+      std::vector<int> face;
+      std::vector<bool> faceRelative;
+      const char* p = begin;
+
+      while (p < end) {
+        const char* lineEnd = (const char*) std::memchr(p, '\n', end - p);
+        if (!lineEnd) {
+          lineEnd = end;
+        }
+
+        p = skipSpaces(p, lineEnd);
+
+        if (lineEnd - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+          float x, y, z;
+          p = parseFloat(p + 1, lineEnd, x);
+          p = parseFloat(p, lineEnd, y);
+          p = parseFloat(p, lineEnd, z);
+          chunk.positions.insert(chunk.positions.end(), { x, y, z });
+        } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+          float u, v = 0.0f;
+          p = parseFloat(p + 2, lineEnd, u);
+          p = parseFloat(p, lineEnd, v);
+          chunk.uvs.insert(chunk.uvs.end(), { u, v });
+        } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+          float x, y, z;
+          p = parseFloat(p + 2, lineEnd, x);
+          p = parseFloat(p, lineEnd, y);
+          p = parseFloat(p, lineEnd, z);
+          chunk.normals.insert(chunk.normals.end(), { x, y, z });
+        } else if (lineEnd - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+          int counts[3] = { 
+            (int) chunk.positions.size() / 3, 
+            (int) chunk.uvs.size() / 2, 
+            (int) chunk.normals.size() / 3 
+          };
+          face.clear();
+          faceRelative.clear();
+          p = skipSpaces(p + 1, lineEnd);
+
+          // corners are v, v/vt, v//vn or v/vt/vn
+          while (p < lineEnd && *p != '#') {
+            int raw[3] = { 0, 0, 0 };
+            for (int a = 0; a < 3 && p < lineEnd && !isSpace(*p); a++) {
+              if (*p != '/') {
+                p = parseIndex(p, lineEnd, raw[a]);
+              }
+              if (p < lineEnd && *p == '/') {
+                p++;
+              } else {
+                break;
+              }
+            }
+
+            for (int a = 0; a < 3; a++) {
+              face.push_back(raw[a] > 0 ? raw[a] - 1 : raw[a] < 0 ? counts[a] + raw[a] : -1);
+              faceRelative.push_back(raw[a] < 0);
+            }
+
+            while (p < lineEnd && !isSpace(*p)) {
+              p++;
+            }
+            p = skipSpaces(p, lineEnd);
+          }
+
+          // triangulates polygons as a fan around the first corner
+          size_t cornerCount = face.size() / 3;
+          for (size_t i = 1; i + 1 < cornerCount; i++) {
+            size_t triangle[3] = { 0, i, i + 1 };
+            for (size_t c : triangle) {
+              for (size_t a = 0; a < 3; a++) {
+                if (faceRelative[c * 3 + a]) {
+                  chunk.relative.push_back(chunk.corners.size());
+                }
+                chunk.corners.push_back(face[c * 3 + a]);
+              }
+            }
+          }
+        }
+
+        p = lineEnd + 1;
+      }
+    }
+
+    bool parseOBJFile(std::string filepath, MeshData& mesh, jobs::ThreadPool* pool)
+    {
+      MappedFile file = MappedFile(RES_DIR + filepath);
+      if (!file.isOpen()) {
+        return false;
+      }
+
+      const char* data = file.getData();
+      size_t size = file.getSize();
+
+      // splits on line boundaries so no line spans two chunks
+      size_t chunkCount = 1;
+      if (pool) {
+        chunkCount = std::max<size_t>(1, std::min<size_t>(pool->getThreadCount() * 4, size / OBJ_MIN_CHUNK_SIZE));
+      }
+
+      std::vector<size_t> bounds = { 0 };
+      for (size_t i = 1; i < chunkCount; i++) {
+        size_t at = std::max(size * i / chunkCount, bounds.back());
+        const char* newline = (const char*) std::memchr(data + at, '\n', size - at);
+        bounds.push_back(newline ? (size_t) (newline - data) + 1 : size);
+      }
+      bounds.push_back(size);
+
+      std::vector<OBJChunk> chunks(chunkCount);
+      auto parse = [&](size_t i, unsigned int) {
+        parseChunk(data + bounds[i], data + bounds[i + 1], chunks[i]);
+      };
+
+      if (pool) {
+        pool->parallelFor(chunkCount, parse);
+      } else {
+        parse(0, 0);
+      }
+
+      // converts chunk-relative indices to file-wide ones using the preceding counts
+      int prefix[3] = { 0, 0, 0 };
+      for (OBJChunk& chunk : chunks) {
+        for (size_t slot : chunk.relative) {
+          chunk.corners[slot] += prefix[slot % 3];
+        }
+        prefix[0] += (int) chunk.positions.size() / 3;
+        prefix[1] += (int) chunk.uvs.size() / 2;
+        prefix[2] += (int) chunk.normals.size() / 3;
+      }
+
+      std::vector<const float*> positions, uvs, normals;
+      for (OBJChunk& chunk : chunks) {
+        for (size_t i = 0; i < chunk.positions.size(); i += 3) positions.push_back(&chunk.positions[i]);
+        for (size_t i = 0; i < chunk.uvs.size(); i += 2) uvs.push_back(&chunk.uvs[i]);
+        for (size_t i = 0; i < chunk.normals.size(); i += 3) normals.push_back(&chunk.normals[i]);
+      }
+
+      size_t cornerCount = 0;
+      for (OBJChunk& chunk : chunks) {
+        cornerCount += chunk.corners.size() / 3;
+      }
+
+      // deduplicates corners on their integer index triple
+      CornerTable table = CornerTable(std::max(positions.size(), cornerCount / 4));
+      unsigned int base = (unsigned int) mesh.getVertexCount();
+      mesh.indices.reserve(mesh.indices.size() + cornerCount);
+      size_t invalid = 0;
+      static const float zero[3] = { 0.0f, 0.0f, 0.0f };
+
+      for (OBJChunk& chunk : chunks) {
+        for (size_t i = 0; i < chunk.corners.size(); i += 3) {
+          const int* key = &chunk.corners[i];
+          bool inserted;
+          unsigned int index = table.insert(key, inserted);
+          mesh.indices.push_back(base + index);
+
+          if (!inserted) {
+            continue;
+          }
+
+          bool vi = key[0] >= 0 && (size_t) key[0] < positions.size();
+          bool ui = key[1] >= 0 && (size_t) key[1] < uvs.size();
+          bool ni = key[2] >= 0 && (size_t) key[2] < normals.size();
+          invalid += !vi + (key[1] != -1 && !ui) + (key[2] != -1 && !ni);
+
+          const float* v = vi ? positions[key[0]] : zero;
+          const float* u = ui ? uvs[key[1]] : zero;
+          const float* n = ni ? normals[key[2]] : zero;
+          mesh.positions.insert(mesh.positions.end(), { v[0], v[1], v[2] });
+          mesh.uvs.insert(mesh.uvs.end(), { u[0], u[1] });
+          mesh.normals.insert(mesh.normals.end(), { n[0], n[1], n[2] });
+        }
+      }
+
+      if (invalid > 0) {
+        std::cerr << "[Error] " << invalid << " out of range indices in file: " << filepath << "!" << std::endl;
+      }
+
+      return true;
+    }
+  }
+}
@@ -0,0 +1,300 @@
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sunstorm
+{
+  namespace io
+  {
+    // largest byte count whose adler sums cannot overflow 32 bits before the modulo
+    static const size_t ADLER_BLOCK = 5552;
+    static const unsigned int ADLER_MODULO = 65521;
+
+    // deflate length symbols 257 to 285, their base lengths and extra bits
+    static const unsigned short LENGTH_BASE[] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const unsigned char LENGTH_EXTRA[] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+
+    /**
+     * Fixed Huffman codes of deflate, bit reversed so they can be written
+     * least significant bit first like every other field.
+     */
+    struct FixedCodes
+    {
+      unsigned short code[288];
+      unsigned char length[288];
+
+      FixedCodes()
+      {
+        for (unsigned int symbol = 0; symbol < 288; symbol++) {
+          unsigned int value, bits;
+          if (symbol < 144) {
+            value = 0x30 + symbol, bits = 8;
+          } else if (symbol < 256) {
+            value = 0x190 + symbol - 144, bits = 9;
+          } else if (symbol < 280) {
+            value = symbol - 256, bits = 7;
+          } else {
+            value = 0xC0 + symbol - 280, bits = 8;
+          }
+
+          unsigned int reversed = 0;
+          for (unsigned int i = 0; i < bits; i++) {
+            reversed |= ((value >> i) & 1) << (bits - 1 - i);
+          }
+          code[symbol] = (unsigned short) reversed;
+          length[symbol] = (unsigned char) bits;
+        }
+      }
+    };
+
+    static const FixedCodes& getFixedCodes()
+    {
+      static const FixedCodes codes;
+      return codes;
+    }
+
+    static unsigned int updateCRC(unsigned int crc, const unsigned char* data, size_t size)
+    {
+      static const std::vector<unsigned int> table = [] {
+        std::vector<unsigned int> values(256);
+        for (unsigned int n = 0; n < 256; n++) {
+          unsigned int c = n;
+          for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+          }
+          values[n] = c;
+        }
+        return values;
+      }();
+
+      for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+      }
+      return crc;
+    }
+
+    static void storeBigEndian(unsigned char* output, unsigned int value)
+    {
+      output[0] = (unsigned char) (value >> 24);
+      output[1] = (unsigned char) (value >> 16);
+      output[2] = (unsigned char) (value >> 8);
+      output[3] = (unsigned char) value;
+    }
+
+    PNGStreamWriter::PNGStreamWriter(std::string filepath, unsigned int width, unsigned int height, size_t maxPending)
+      : filepath(filepath), width(width), height(height), rowsQueued(0), maxPending(std::max<size_t>(maxPending, 1)),
+        closing(false), finished(false), failed(false), rowsWritten(0), bitBuffer(0), bitCount(0), previous(-1), adlerA(1), adlerB(0)
+    {
+      if (width == 0 || height == 0) {
+        throw std::runtime_error("Cannot stream an empty image: " + filepath);
+      }
+
+      file.open(filepath, std::ios::binary);
+      if (!file) {
+        throw std::runtime_error("Failed to open image file: " + filepath);
+      }
+
+      const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+      file.write((const char*) signature, sizeof(signature));
+
+      // 8 bit RGBA, no interlacing so rows can be written in order
+      unsigned char header[13] = {};
+      storeBigEndian(header, width);
+      storeBigEndian(header + 4, height);
+      header[8] = 8;
+      header[9] = 6;
+      writeChunk("IHDR", header, sizeof(header));
+
+      // zlib header for deflate with a 32K window, sent with the first band
+      compressed = { 0x78, 0x01 };
+      worker = std::thread(&PNGStreamWriter::writerLoop, this);
+    }
+
+    PNGStreamWriter::~PNGStreamWriter()
+    {
+      finish();
+    }
+
+    void PNGStreamWriter::write(std::vector<unsigned char> rows)
+    {
+      size_t stride = (size_t) width * 4;
+      size_t count = rows.size() / stride;
+      if (count == 0 || rows.size() != count * stride) {
+        throw std::runtime_error("Image stream takes whole RGBA8 rows: " + filepath);
+      }
+
+      std::unique_lock<std::mutex> guard(lock);
+      if (closing || rowsQueued + count > height) {
+        throw std::runtime_error("Too many rows written to image stream: " + filepath);
+      }
+
+      // holding the producer back bounds memory to the bands in flight
+      drained.wait(guard, [this] { return pending.size() < maxPending; });
+      rowsQueued += (unsigned int) count;
+      pending.push_back(std::move(rows));
+      wake.notify_one();
+    }
+
+    bool PNGStreamWriter::finish()
+    {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (finished) {
+          return !failed;
+        }
+        closing = true;
+        finished = true;
+      }
+      wake.notify_all();
+      worker.join();
+
+      if (rowsWritten != height) {
+        std::cerr << "[Error] Image stream closed after " << rowsWritten << " of " << height << " rows: " << filepath << "!" << std::endl;
+        failed = true;
+      }
+
+      file.close();
+      if (failed || !file) {
+        std::cerr << "[Error] Failed to write image file: " << filepath << "!" << std::endl;
+        failed = true;
+      }
+      return !failed;
+    }
+
+    void PNGStreamWriter::writerLoop()
+    {
+      while (true) {
+        std::vector<unsigned char> rows;
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          wake.wait(guard, [this] { return closing || !pending.empty(); });
+
+          // queued rows are still written after the stream is closed
+          if (pending.empty()) {
+            return;
+          }
+          rows = std::move(pending.front());
+          pending.pop_front();
+        }
+        drained.notify_one();
+
+        rowsWritten += (unsigned int) (rows.size() / ((size_t) width * 4));
+        encodeRows(rows, rowsWritten == height);
+      }
+    }
+
+    void PNGStreamWriter::encodeRows(const std::vector<unsigned char>& rows, bool last)
+    {
+      size_t stride = (size_t) width * 4;
+      size_t count = rows.size() / stride;
+      filtered.resize(stride + 1);
+
+      // one fixed Huffman block per band, its header is not byte aligned
+      putBits(last ? 1 : 0, 1);
+      putBits(1, 2);
+
+      for (size_t r = 0; r < count; r++) {
+        const unsigned char* row = rows.data() + r * stride;
+
+        // the Sub filter turns flat colour into zero runs, which collapse into matches one byte back
+        filtered[0] = 1;
+        for (size_t i = 0; i < stride; i++) {
+          filtered[i + 1] = (unsigned char) (row[i] - (i >= 4 ? row[i - 4] : 0));
+        }
+
+        for (size_t i = 0; i < filtered.size();) {
+          size_t end = std::min(filtered.size(), i + ADLER_BLOCK);
+          for (; i < end; i++) {
+            adlerA += filtered[i];
+            adlerB += adlerA;
+          }
+          adlerA %= ADLER_MODULO;
+          adlerB %= ADLER_MODULO;
+        }
+
+        for (size_t i = 0; i < filtered.size();) {
+          unsigned char value = filtered[i];
+          size_t run = 0;
+          while (value == previous && run < 258 && i + run < filtered.size() && filtered[i + run] == value) {
+            run++;
+          }
+
+          if (run >= 3) {
+            int code = 28;
+            while (LENGTH_BASE[code] > run) {
+              code--;
+            }
+            putSymbol(257 + code);
+            putBits((unsigned int) (run - LENGTH_BASE[code]), LENGTH_EXTRA[code]);
+            putBits(0, 5);  // distance 1
+            i += run;
+          } else {
+            putSymbol(value);
+            previous = value;
+            i++;
+          }
+        }
+      }
+      putSymbol(256);
+
+      if (last) {
+        if (bitCount > 0) {
+          putBits(0, 8 - bitCount);
+        }
+        unsigned char adler[4];
+        storeBigEndian(adler, (adlerB << 16) | adlerA);
+        compressed.insert(compressed.end(), adler, adler + 4);
+      }
+
+      writeChunk("IDAT", compressed.data(), compressed.size());
+      compressed.clear();
+
+      if (last) {
+        writeChunk("IEND", nullptr, 0);
+      }
+      if (!file) {
+        failed = true;
+      }
+    }
+
+    void PNGStreamWriter::putBits(unsigned int value, int count)
+    {
+      bitBuffer |= value << bitCount;
+      bitCount += count;
+      while (bitCount >= 8) {
+        compressed.push_back((unsigned char) bitBuffer);
+        bitBuffer >>= 8;
+        bitCount -= 8;
+      }
+    }
+
+    void PNGStreamWriter::putSymbol(unsigned int symbol)
+    {
+      const FixedCodes& codes = getFixedCodes();
+      putBits(codes.code[symbol], codes.length[symbol]);
+    }
+
+    void PNGStreamWriter::writeChunk(const char* type, const unsigned char* data, size_t size)
+    {
+      unsigned char header[8];
+      storeBigEndian(header, (unsigned int) size);
+      std::memcpy(header + 4, type, 4);
+
+      unsigned int crc = updateCRC(0xFFFFFFFFu, header + 4, 4);
+      crc = updateCRC(crc, data, size) ^ 0xFFFFFFFFu;
+      unsigned char footer[4];
+      storeBigEndian(footer, crc);
+
+      file.write((const char*) header, sizeof(header));
+      if (size > 0) {
+        file.write((const char*) data, size);
+      }
+      file.write((const char*) footer, sizeof(footer));
+    }
+  }
+}
@@ -1,25 +1,302 @@
 #pragma once
 
 #include <unordered_map>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #define STB_IMAGE_STATIC
 #define STB_IMAGE_IMPLEMENTATION
 
 #include <stb/stb_image.h>
 
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include <stb/stb_image_write.h>
+
 #include "../graphics/graphics.h"
 
 #define RES_DIR std::string("res/")
+#define CACHE_DIR std::string("cache/")
 
 namespace sunstorm
 {
+  namespace jobs
+  {
+    // forward declaration
+    class ThreadPool;
+  }
+
   namespace io
   {
+    class MappedFile
+    {
+    private:
+      const char* data;
+      size_t size;
+      bool valid;
+#ifdef _WIN32
+      void* fileHandle;
+      void* mappingHandle;
+#else
+      int fileDescriptor;
+#endif
+
+    public:
+      /**
+       * @brief Maps a file read-only into the address space, the file is not
+       *    read until its pages are touched.
+       * 
+       * @param filepath Path to file (not relative to the resource directory)
+       */
+      MappedFile(std::string filepath);
+
+      /**
+       * @brief Unmaps the file and closes its handles.
+       */
+      ~MappedFile();
+
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      /**
+       * @brief Query if the file was opened and mapped.
+       * 
+       * @return true If data can be read
+       */
+      inline bool isOpen() const {
+        return valid;
+      }
+
+      /**
+       * @brief Get the mapped file content.
+       * 
+       * @return const char* 
+       */
+      inline const char* getData() const {
+        return data;
+      }
+
+      /**
+       * @brief Get the file size in bytes.
+       * 
+       * @return size_t 
+       */
+      inline size_t getSize() const {
+        return size;
+      }
+    };
+
+    struct MeshData
+    {
+      std::vector<float> positions;
+      std::vector<float> uvs;
+      std::vector<float> normals;
+      std::vector<unsigned int> indices;
+
+      /**
+       * @brief Get the number of unique vertices.
+       * 
+       * @return size_t 
+       */
+      inline size_t getVertexCount() const {
+        return positions.size() / 3;
+      }
+    };
+
+    struct MeshVertex
+    {
+      float position[3];
+      float uv[2];
+      float normal[3];
+    };
+
+    /**
+     * Vertex buffer layouts a mesh can be uploaded with.
+     */
+    enum class VertexLayout
+    {
+      Float,                      // MeshVertex, 32 bytes and 32-bit indices
+      Quantized                   // PackedVertex, 20 bytes and 16-bit indices where they fit
+    };
+
+    /**
+     * Quantized interleaved vertex. Positions stay full floats since the
+     * meshes have no common scale to quantize against, UVs are two half
+     * floats and the normal is signed normalized 10:10:10:2.
+     */
+    struct PackedVertex
+    {
+      float position[3];
+      unsigned int uv;
+      unsigned int normal;
+    };
+
+    /**
+     * @brief Header of the binary mesh cache format. The interleaved vertices
+     *    and 32-bit indices follow at the stored offsets.
+     */
+    struct MeshFileHeader
+    {
+      char magic[8];
+      unsigned long long sourceSize;
+      long long sourceTime;
+      unsigned int vertexCount;
+      unsigned int indexCount;
+      unsigned int vertexStride;
+      unsigned int reserved;
+      float boundsMin[3];
+      float boundsMax[3];
+      unsigned long long vertexOffset;
+      unsigned long long indexOffset;
+    };
+
+    class MeshFile
+    {
+    private:
+      MappedFile file;
+      const MeshFileHeader* header;
+
+    public:
+      /**
+       * @brief Maps a binary mesh file and validates its header, nothing is
+       *    parsed or copied.
+       * 
+       * @param filepath Path to file (not relative to the resource directory)
+       */
+      MeshFile(std::string filepath);
+
+      /**
+       * @brief Writes mesh data as interleaved vertices, indices and bounds.
+       * 
+       * @param filepath Path to file (not relative to the resource directory)
+       * @param mesh Host mesh data
+       * @param sourceSize Size of the file the mesh was imported from
+       * @param sourceTime Modification time of the file the mesh was imported from
+       * @return true If the file was written
+       */
+      static bool write(std::string filepath, const MeshData& mesh, unsigned long long sourceSize, long long sourceTime);
+
+      /**
+       * @brief Query if the file was mapped and has a valid header.
+       * 
+       * @return true If the vertices and indices can be read
+       */
+      inline bool isOpen() const {
+        return header != nullptr;
+      }
+
+      /**
+       * @brief Get the file header
+       * 
+       * @return const MeshFileHeader& 
+       */
+      inline const MeshFileHeader& getHeader() const {
+        return *header;
+      }
+
+      /**
+       * @brief Get the interleaved vertices
+       * 
+       * @return const MeshVertex* 
+       */
+      inline const MeshVertex* getVertices() const {
+        return (const MeshVertex*) (file.getData() + header->vertexOffset);
+      }
+
+      /**
+       * @brief Get the triangle indices
+       * 
+       * @return const unsigned int* 
+       */
+      inline const unsigned int* getIndices() const {
+        return (const unsigned int*) (file.getData() + header->indexOffset);
+      }
+
+      /**
+       * @brief Get the number of unique vertices
+       * 
+       * @return size_t 
+       */
+      inline size_t getVertexCount() const {
+        return header->vertexCount;
+      }
+
+      /**
+       * @brief Get the number of indices
+       * 
+       * @return size_t 
+       */
+      inline size_t getIndexCount() const {
+        return header->indexCount;
+      }
+
+      /**
+       * @brief Get the size of the vertex data in bytes
+       * 
+       * @return size_t 
+       */
+      inline size_t getVertexBytes() const {
+        return (size_t) header->vertexCount * sizeof(MeshVertex);
+      }
+
+      /**
+       * @brief Get the size of the index data in bytes
+       * 
+       * @return size_t 
+       */
+      inline size_t getIndexBytes() const {
+        return (size_t) header->indexCount * sizeof(unsigned int);
+      }
+
+      /**
+       * @brief Get the minimum corner of the mesh bounds
+       * 
+       * @return glm::vec3 
+       */
+      inline glm::vec3 getBoundsMin() const {
+        return glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+      }
+
+      /**
+       * @brief Get the maximum corner of the mesh bounds
+       * 
+       * @return glm::vec3 
+       */
+      inline glm::vec3 getBoundsMax() const {
+        return glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+      }
+    };
+
+    /**
+     * @brief Hashes bytes with 64-bit FNV-1a, which is stable across runs and
+     *    builds so it can key on-disk caches.
+     * 
+     * @param data 
+     * @param size Number of bytes
+     * @return unsigned long long 
+     */
+    unsigned long long hashBytes(const void* data, size_t size);
+
+    /**
+     * @brief Formats a hash as a fixed width hexadecimal string.
+     * 
+     * @param hash 
+     * @return std::string 
+     */
+    std::string toHex(unsigned long long hash);
+
     /**
      * @brief Reads file into string buffer and returns content.
      * 
@@ -37,14 +314,443 @@ namespace sunstorm
      */
     gfx::Texture* readTextureFile(std::string filepath);
 
+    /**
+     * @brief Writes bottom-up RGBA8 pixel data to a PNG file. The path is relative
+     *    to the working directory rather than the resource directory.
+     * 
+     * @param filepath 
+     * @param width Width of image in pixels
+     * @param height Height of image in pixels
+     * @param pixels Tightly packed RGBA8 pixel data
+     * @return true If the image was written
+     */
+    bool writeImageFile(std::string filepath, int width, int height, const unsigned char* pixels);
+
+    class PNGStreamWriter
+    {
+    private:
+      std::string filepath;
+      std::ofstream file;
+      unsigned int width;
+      unsigned int height;
+      unsigned int rowsQueued;
+
+      std::thread worker;
+      std::mutex lock;
+      std::condition_variable wake;
+      std::condition_variable drained;
+      std::deque<std::vector<unsigned char>> pending;
+      size_t maxPending;
+      bool closing;
+      bool finished;
+      bool failed;
+
+      // touched only on the writer thread
+      unsigned int rowsWritten;
+      std::vector<unsigned char> filtered;
+      std::vector<unsigned char> compressed;
+      unsigned int bitBuffer;
+      int bitCount;
+      int previous;
+      unsigned int adlerA;
+      unsigned int adlerB;
+
+      /**
+       * @brief Idle loop of the writer thread, encodes queued rows until the
+       *    stream is closed.
+       */
+      void writerLoop();
+
+      /**
+       * @brief Filters and compresses rows into one deflate block and writes it
+       *    as an IDAT chunk.
+       *
+       * @param rows Top-down RGBA8 rows
+       * @param last If the block ends the image
+       */
+      void encodeRows(const std::vector<unsigned char>& rows, bool last);
+
+      /**
+       * @brief Appends bits to the compressed stream, least significant first.
+       *
+       * @param value Bits to append
+       * @param count Number of bits
+       */
+      void putBits(unsigned int value, int count);
+
+      /**
+       * @brief Appends the fixed Huffman code of a literal or length symbol.
+       *
+       * @param symbol Symbol from 0 to 287
+       */
+      void putSymbol(unsigned int symbol);
+
+      /**
+       * @brief Writes a chunk with its length and checksum.
+       *
+       * @param type Four character chunk type
+       * @param data Chunk payload
+       * @param size Size of payload in bytes
+       */
+      void writeChunk(const char* type, const unsigned char* data, size_t size);
+
+    public:
+      /**
+       * @brief Construct a new PNG Stream Writer object which encodes an RGBA8
+       *    image a band of rows at a time on its own thread, so the whole
+       *    image never needs to be held in memory. The path is relative to the
+       *    working directory.
+       *
+       * @param filepath
+       * @param width Width of image in pixels
+       * @param height Height of image in pixels
+       * @param maxPending Number of bands queued before write blocks
+       */
+      PNGStreamWriter(std::string filepath, unsigned int width, unsigned int height, size_t maxPending = 1);
+
+      /**
+       * @brief Finishes the stream if it is still open.
+       */
+      ~PNGStreamWriter();
+
+      PNGStreamWriter(const PNGStreamWriter&) = delete;
+      PNGStreamWriter& operator=(const PNGStreamWriter&) = delete;
+
+      /**
+       * @brief Queues the next band of rows for encoding, rows run top-down
+       *    as in the file. Blocks while the writer is too far behind.
+       *
+       * @param rows Whole RGBA8 rows, moved into the queue
+       */
+      void write(std::vector<unsigned char> rows);
+
+      /**
+       * @brief Waits for queued rows to be encoded and closes the file.
+       *
+       * @return true If every row was written
+       */
+      bool finish();
+
+      /**
+       * @brief Get the Width of the image
+       *
+       * @return unsigned int
+       */
+      inline unsigned int getWidth() const {
+        return width;
+      }
+
+      /**
+       * @brief Get the Height of the image
+       *
+       * @return unsigned int
+       */
+      inline unsigned int getHeight() const {
+        return height;
+      }
+    };
+
+    /**
+     * @brief Reads wavefront file into host memory without touching OpenGL, so
+     *    the data can also be used by the compute path. The file is memory
+     *    mapped and split into chunks which are parsed in parallel, faces with
+     *    more than three corners are triangulated as fans.
+     * 
+     * @param filepath 
+     * @param mesh Output vertex and index data
+     * @param pool Worker pool to parse chunks on (can be nullptr)
+     * @return true If the file was read
+     */
+    bool parseOBJFile(std::string filepath, MeshData& mesh, jobs::ThreadPool* pool = nullptr);
+
+    /**
+     * Average cache miss ratios of a mesh, misses per triangle of a 16 entry
+     * FIFO post-transform cache, at each optimization stage.
+     */
+    struct MeshOptimizeStats
+    {
+      float acmrBefore;
+      float acmrCache;            // after triangle reordering only
+      float acmrAfter;
+      size_t clusters;
+    };
+
+    /**
+     * @brief Computes the average cache miss ratio of an index order, 0.5 is
+     *    ideal for large regular meshes and 3 is no reuse at all.
+     * 
+     * @param indices Triangle indices
+     * @param vertexCount Number of unique vertices
+     * @return float Vertex transforms per triangle
+     */
+    float computeACMR(const std::vector<unsigned int>& indices, size_t vertexCount);
+
+    /**
+     * @brief Reorders triangles for the post-transform vertex cache using
+     *    Forsyth's linear-speed algorithm.
+     * 
+     * @param indices Triangle indices, reordered in place
+     * @param vertexCount Number of unique vertices
+     */
+    void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+
+    /**
+     * @brief Cuts a cache optimized order into clusters that each start with
+     *    a cold cache and sorts them to draw outward facing clusters first,
+     *    reducing overdraw for a bounded loss of cache hits.
+     * 
+     * @param indices Triangle indices, reordered in place
+     * @param positions Vertex positions
+     * @param threshold Most ACMR growth allowed by cutting, 1.05 is 5%
+     * @return size_t Number of clusters
+     */
+    size_t optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<float>& positions, float threshold = 1.05f);
+
+    /**
+     * @brief Renumbers vertices in order of first use so vertex fetch reads
+     *    memory sequentially.
+     * 
+     * @param mesh Mesh data, vertices and indices are rewritten
+     */
+    void optimizeVertexFetch(MeshData& mesh);
+
+    /**
+     * @brief Runs the cache, overdraw and fetch optimizations in order.
+     * 
+     * @param mesh Mesh data, rewritten in place
+     * @return MeshOptimizeStats 
+     */
+    MeshOptimizeStats optimizeMesh(MeshData& mesh);
+
+    /**
+     * @brief Maps the binary cache of a wavefront file, importing it into the
+     *    cache directory first if it is missing or older than the source.
+     * 
+     * @param filepath 
+     * @param pool Worker pool to parse on when importing (can be nullptr)
+     * @param fallback Receives the parsed and optimized mesh if the cache could
+     *    not be written, so it need not be parsed again (can be nullptr)
+     * @return MeshFile* Mapped mesh or nullptr if it could not be imported
+     */
+    MeshFile* importMeshFile(std::string filepath, jobs::ThreadPool* pool = nullptr, MeshData* fallback = nullptr);
+
     /**
      * @brief Reads wavefront file and stores model information into OpenGL
-     *    vertex array object to be rendered.
+     *    vertex array object to be rendered. Vertex buffers are filled
+     *    straight from the mapped binary cache.
      * 
      * @param filepath 
-     * @return gfx::Mesh*
+     * @param pool Worker pool to parse on when importing (can be nullptr)
+     * @param layout Vertex buffer layout
+     * @return gfx::Mesh* Mesh or nullptr if the file could not be parsed
+     */
+    gfx::Mesh* readOBJFile(std::string filepath, jobs::ThreadPool* pool = nullptr, VertexLayout layout = VertexLayout::Quantized);
+
+    /**
+     * @brief Get the size of one vertex in a layout.
+     * 
+     * @param layout Vertex buffer layout
+     * @return GLsizei 
+     */
+    GLsizei getVertexStride(VertexLayout layout);
+
+    /**
+     * @brief Get the attribute bindings of a layout, positions, UVs and
+     *    normals at locations 0, 1 and 2.
+     * 
+     * @param layout Vertex buffer layout
+     * @return std::vector<gfx::VertexAttribute> 
+     */
+    std::vector<gfx::VertexAttribute> getVertexAttributes(VertexLayout layout);
+
+    /**
+     * @brief Get the narrowest index type a layout can use for a mesh.
+     * 
+     * @param layout Vertex buffer layout
+     * @param vertexCount Number of unique vertices
+     * @return GLenum GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+     */
+    GLenum getIndexType(VertexLayout layout, size_t vertexCount);
+
+    /**
+     * @brief Computes the axis aligned bounds of vertex positions.
+     * 
+     * @param vertices Interleaved float vertices
+     * @param count Number of vertices
+     * @param min Minimum corner, zero for an empty mesh
+     * @param max Maximum corner, zero for an empty mesh
      */
-    gfx::Mesh* readOBJFile(std::string filepath);
+    void computeBounds(const MeshVertex* vertices, size_t count, glm::vec3& min, glm::vec3& max);
+
+    /**
+     * @brief Interleaves the separate arrays of a parsed mesh into the float
+     *    vertex layout.
+     * 
+     * @param mesh Host mesh data
+     * @param vertices Output vertices, one per unique vertex of the mesh
+     */
+    void interleaveMesh(const MeshData& mesh, std::vector<MeshVertex>& vertices);
+
+    /**
+     * @brief Converts vertices into a layout and indices into an index type,
+     *    the output is the vertex bytes followed by the index bytes.
+     * 
+     * @param layout Vertex buffer layout
+     * @param vertices Interleaved float vertices
+     * @param vertexCount Number of vertices
+     * @param indices Triangle indices
+     * @param indexCount Number of indices
+     * @param output Packed vertices then indices
+     * @return size_t Size of the vertex bytes
+     */
+    size_t packMesh(VertexLayout layout, const MeshVertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount, std::vector<unsigned char>& output);
+
+    class AssetLoader
+    {
+    private:
+      enum class AssetType
+      {
+        Texture,
+        Mesh
+      };
+
+      struct PendingAsset
+      {
+        AssetType type;
+        std::string filepath;
+        VertexLayout layout;
+        bool loaded;
+
+        // tightly packed pixels, or interleaved vertices followed by indices
+        std::vector<unsigned char> data;
+        int width;
+        int height;
+        size_t vertexBytes;
+        size_t vertexCount;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        size_t indexCount;
+        size_t uploaded;
+
+        gfx::Texture* texture;
+        gfx::Mesh* mesh;
+        std::promise<gfx::Texture*> texturePromise;
+        std::promise<gfx::Mesh*> meshPromise;
+      };
+
+      std::vector<std::thread> threads;
+      std::mutex lock;
+      std::condition_variable wake;
+      std::deque<PendingAsset*> requests;
+      std::deque<PendingAsset*> decoded;
+      std::atomic<size_t> pending;
+      bool stopping;
+      VertexLayout layout;
+
+      // touched only on the GL thread
+      GLuint stagingBuffer;
+      unsigned char* staging;
+      size_t frameBudget;
+      std::vector<GLsync> fences;
+      unsigned long long frame;
+      size_t uploadedBytes;
+
+      /**
+       * @brief Idle loop of each worker thread, decodes or parses requests
+       *    until the loader is destroyed.
+       */
+      void workerLoop();
+
+      /**
+       * @brief Reads an asset into host memory, runs on a worker.
+       * 
+       * @param asset Asset to fill
+       */
+      static void decode(PendingAsset& asset);
+
+      /**
+       * @brief Creates the GL object of an asset with empty storage.
+       * 
+       * @param asset Asset to create
+       */
+      static void createObject(PendingAsset& asset);
+
+      /**
+       * @brief Issues the copy of a staged range into an asset's GL object.
+       * 
+       * @param asset Asset being uploaded
+       * @param offset Offset of the range in the staging buffer
+       * @param size Size of the range in bytes
+       */
+      void copyFromStaging(PendingAsset& asset, size_t offset, size_t size);
+
+      /**
+       * @brief Resolves an asset's future and deletes it.
+       * 
+       * @param asset Finished or failed asset
+       */
+      static void complete(PendingAsset* asset);
+
+    public:
+      /**
+       * @brief Construct a new Asset Loader which decodes textures and parses
+       *    meshes on worker threads, must be created on the GL thread.
+       * 
+       * @param threadCount Number of workers, 0 uses all but one hardware thread
+       * @param frameBudget Most bytes uploaded per call to update
+       * @param layout Vertex buffer layout of loaded meshes
+       */
+      AssetLoader(unsigned int threadCount = 0, size_t frameBudget = 4 << 20, VertexLayout layout = VertexLayout::Quantized);
+
+      /**
+       * @brief Stops and joins the workers, unfinished futures are broken.
+       */
+      ~AssetLoader();
+
+      AssetLoader(const AssetLoader&) = delete;
+      AssetLoader& operator=(const AssetLoader&) = delete;
+
+      /**
+       * @brief Queues an image file to be decoded and uploaded.
+       * 
+       * @param filepath Path relative to the resource directory
+       * @return std::shared_future<gfx::Texture*> Resolves to the texture, owned by the caller, or nullptr
+       */
+      std::shared_future<gfx::Texture*> loadTexture(std::string filepath);
+
+      /**
+       * @brief Queues a wavefront file to be imported and uploaded.
+       * 
+       * @param filepath Path relative to the resource directory
+       * @return std::shared_future<gfx::Mesh*> Resolves to the mesh, owned by the caller, or nullptr
+       */
+      std::shared_future<gfx::Mesh*> loadMesh(std::string filepath);
+
+      /**
+       * @brief Uploads decoded assets through the staging buffer up to the
+       *    frame budget, call once per frame on the GL thread. Never waits on
+       *    the GPU, a frame whose staging slot is still in use uploads nothing.
+       */
+      void update();
+
+      /**
+       * @brief Get the number of assets requested but not yet resolved
+       * 
+       * @return size_t 
+       */
+      inline size_t getPendingCount() const {
+        return pending;
+      }
+
+      /**
+       * @brief Get the number of bytes uploaded by the last update
+       * 
+       * @return size_t 
+       */
+      inline size_t getUploadedBytes() const {
+        return uploadedBytes;
+      }
+    };
   }
 
   namespace time
@@ -56,4 +762,77 @@ namespace sunstorm
      */
     long long getTimeMicroseconds();
   }
+
+  namespace jobs
+  {
+    class ThreadPool
+    {
+    private:
+      struct WorkQueue
+      {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+      };
+
+      std::vector<std::thread> threads;
+      std::vector<WorkQueue*> queues;
+      std::function<void(size_t, unsigned int)> job;
+
+      std::mutex lock;
+      std::condition_variable wake;
+      std::condition_variable done;
+      std::atomic<size_t> remaining;
+      unsigned long long generation;
+      bool stopping;
+
+      /**
+       * @brief Idle loop of each worker thread, waits for a new job and then
+       *    runs tasks until none are left to pop or steal.
+       * 
+       * @param index Worker index
+       */
+      void workerLoop(unsigned int index);
+
+      /**
+       * @brief Pops tasks from the worker's own queue and steals from the back of
+       *    other workers' queues once it is empty.
+       * 
+       * @param index Worker index
+       */
+      void runTasks(unsigned int index);
+
+    public:
+      /**
+       * @brief Construct a new Thread Pool, the calling thread participates in
+       *    jobs as worker 0 so only threadCount - 1 threads are spawned.
+       * 
+       * @param threadCount Number of workers, 0 uses all hardware threads
+       */
+      ThreadPool(unsigned int threadCount = 0);
+
+      /**
+       * @brief Stops and joins all worker threads.
+       */
+      ~ThreadPool();
+
+      /**
+       * @brief Runs fn for every task index in [0, count) and blocks until all
+       *    tasks finish. Tasks are dealt out in contiguous blocks and idle
+       *    workers steal from busy ones.
+       * 
+       * @param count Number of tasks
+       * @param fn Task function taking the task index and worker index
+       */
+      void parallelFor(size_t count, std::function<void(size_t, unsigned int)> fn);
+
+      /**
+       * @brief Get the number of workers including the calling thread.
+       * 
+       * @return unsigned int 
+       */
+      inline unsigned int getThreadCount() const {
+        return (unsigned int) queues.size();
+      }
+    };
+  }
 }
\ No newline at end of file
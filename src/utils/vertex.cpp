@@ -0,0 +1,98 @@
+#include "utils.h"
+
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
+namespace sunstorm
+{
+  namespace io
+  {
+    // largest vertex count whose indices all fit in 16 bits
+    static const size_t SHORT_INDEX_LIMIT = 65536;
+
+    GLsizei getVertexStride(VertexLayout layout)
+    {
+      return layout == VertexLayout::Quantized ? sizeof(PackedVertex) : sizeof(MeshVertex);
+    }
+
+    std::vector<gfx::VertexAttribute> getVertexAttributes(VertexLayout layout)
+    {
+      if (layout == VertexLayout::Quantized) {
+        return {
+          { 0, 3, GL_FLOAT, GL_FALSE, offsetof(PackedVertex, position) },
+          { 1, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, uv) },
+          { 2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertex, normal) },
+        };
+      }
+
+      return {
+        { 0, 3, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, position) },
+        { 1, 2, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, uv) },
+        { 2, 3, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, normal) },
+      };
+    }
+
+    GLenum getIndexType(VertexLayout layout, size_t vertexCount)
+    {
+      return layout == VertexLayout::Quantized && vertexCount <= SHORT_INDEX_LIMIT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    void computeBounds(const MeshVertex* vertices, size_t count, glm::vec3& min, glm::vec3& max)
+    {
+      min = glm::vec3(count > 0 ? INFINITY : 0.0f);
+      max = glm::vec3(count > 0 ? -INFINITY : 0.0f);
+      for (size_t i = 0; i < count; i++) {
+        glm::vec3 p = glm::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+      }
+    }
+
+    void interleaveMesh(const MeshData& mesh, std::vector<MeshVertex>& vertices)
+    {
+      vertices.resize(mesh.getVertexCount());
+      for (size_t i = 0; i < vertices.size(); i++) {
+        std::memcpy(vertices[i].position, &mesh.positions[i * 3], sizeof(vertices[i].position));
+        std::memcpy(vertices[i].uv, &mesh.uvs[i * 2], sizeof(vertices[i].uv));
+        std::memcpy(vertices[i].normal, &mesh.normals[i * 3], sizeof(vertices[i].normal));
+      }
+    }
+
+    size_t packMesh(VertexLayout layout, const MeshVertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount, std::vector<unsigned char>& output)
+    {
+      size_t vertexBytes = vertexCount * getVertexStride(layout);
+      bool shortIndices = getIndexType(layout, vertexCount) == GL_UNSIGNED_SHORT;
+      size_t indexBytes = indexCount * (shortIndices ? sizeof(unsigned short) : sizeof(unsigned int));
+      output.resize(vertexBytes + indexBytes);
+
+      if (layout == VertexLayout::Float) {
+        std::memcpy(output.data(), vertices, vertexBytes);
+      } else {
+        PackedVertex* packed = (PackedVertex*) output.data();
+        for (size_t i = 0; i < vertexCount; i++) {
+          const MeshVertex& v = vertices[i];
+          std::memcpy(packed[i].position, v.position, sizeof(v.position));
+          packed[i].uv = glm::packHalf2x16(glm::vec2(v.uv[0], v.uv[1]));
+
+          // snorm clamps to [-1, 1] so only unit normals survive packing unchanged
+          glm::vec3 normal = glm::vec3(v.normal[0], v.normal[1], v.normal[2]);
+          float length = glm::length(normal);
+          normal = length > 0.0f ? normal / length : normal;
+          packed[i].normal = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+        }
+      }
+
+      if (shortIndices) {
+        unsigned short* packed = (unsigned short*) (output.data() + vertexBytes);
+        for (size_t i = 0; i < indexCount; i++) {
+          packed[i] = (unsigned short) indices[i];
+        }
+      } else {
+        std::memcpy(output.data() + vertexBytes, indices, indexBytes);
+      }
+
+      return vertexBytes;
+    }
+  }
+}